@@ -0,0 +1,577 @@
+//
+// 性能测试：bench [--tsv] [--out FILE] [--baseline FILE] [--tolerance R] [--kernel NAME] [--utf8] [ndjson-file]
+//
+// 标准语料（数字密集、字符串密集、深层嵌套、大量小文档）分别测 parse、stringify、value_free，
+// 报告 MB/s、文档/秒、每个文档的分配次数和峰值内存。之后是 NDJSON 和顶层数组的多线程测试，
+// 不带文件参数时使用内存中生成的 NDJSON 数据，顶层数组测试由同一份数据拼接而成。
+// response 一项比较生成同一份响应的两种方式：建值树再 stringify，或者用 Writer 直接写出。
+//
+// --tsv 输出制表符分隔的结果，可以保存下来作为 --baseline 与以后的版本比较，
+// 吞吐量下降超过 tolerance（默认 0.10）的项目会被列出，并以返回值 1 退出。
+//
+// --kernel 强制使用某一种扫描内核（scalar、sse4.2、avx2、avx512），CPU 不支持时退出。
+// --kernel all 对每一种支持的内核各跑一遍标准语料，语料名后面加上 @内核名，便于对比。
+// --utf8 在标准语料的解析中开启 ParseOptions::validate_utf8。
+//
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WINDOWS
+#include <sys/resource.h>
+#endif
+
+#include "tiny_json.h"
+
+using namespace tiny_json;
+
+struct Result {
+    std::string corpus, op;
+    double mb_per_s, docs_per_s;
+    double allocs_per_doc;
+    size_t peak_heap;       // 这一步中存活内存的最大值，字节
+    size_t peak_rss;        // 到这一步为止进程的峰值常驻内存，KB
+};
+
+static std::vector<Result> results;
+
+// 标准语料的解析选项，分配器由各轮次自己设置
+static ParseOptions corpus_opt;
+
+static size_t peak_rss_kb() {
+#ifndef _WINDOWS
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (size_t) ru.ru_maxrss;
+#else
+    return 0;
+#endif
+}
+
+// 统计分配次数和存活字节数的分配器，只在单独的统计轮次中使用，不影响计时
+struct CountingHeap {
+    std::atomic<size_t> calls{0};
+    std::atomic<size_t> live{0};
+    std::atomic<size_t> peak{0};
+
+    void reset() {
+        calls = 0;
+        live = 0;
+        peak = 0;
+    }
+
+    void grow(size_t n) {
+        size_t now = live.fetch_add(n, std::memory_order_relaxed) + n;
+        size_t old = peak.load(std::memory_order_relaxed);
+        while (now > old && !peak.compare_exchange_weak(old, now, std::memory_order_relaxed));
+    }
+};
+
+static void *counting_malloc(void *user, size_t size) {
+    auto *h = (CountingHeap *) user;
+    h->calls.fetch_add(1, std::memory_order_relaxed);
+    h->grow(size);
+    return malloc(size);
+}
+
+static void *counting_realloc(void *user, void *p, size_t old_size, size_t new_size) {
+    auto *h = (CountingHeap *) user;
+    h->calls.fetch_add(1, std::memory_order_relaxed);
+    h->grow(new_size);
+    h->live.fetch_sub(old_size, std::memory_order_relaxed);
+    return realloc(p, new_size);
+}
+
+static void counting_free(void *user, void *p, size_t size) {
+    auto *h = (CountingHeap *) user;
+    h->live.fetch_sub(size, std::memory_order_relaxed);
+    free(p);
+}
+
+static CountingHeap heap;
+static const Allocator counting_allocator = {counting_malloc, counting_realloc, counting_free, &heap};
+
+// 固定种子的线性同余生成器，保证每次生成的语料完全相同
+struct Lcg {
+    unsigned long long s = 42;
+
+    unsigned next() {
+        s = s * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (unsigned) (s >> 33);
+    }
+
+    double uniform(double lo, double hi) { return lo + (hi - lo) * (next() / 2147483648.0); }
+};
+
+// canada.json：一个大多边形，几乎全是浮点数坐标
+static std::string make_canada() {
+    Lcg rng;
+    std::string s = "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\","
+                    "\"properties\":{\"name\":\"Canada\"},\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[";
+    char buf[64];
+    for (int ring = 0; ring < 480; ring++) {
+        s += ring ? ",[" : "[";
+        for (int i = 0; i < 240; i++) {
+            snprintf(buf, sizeof(buf), "%s[%.15g,%.15g]", i ? "," : "",
+                     rng.uniform(-141.0, -52.0), rng.uniform(41.0, 83.0));
+            s += buf;
+        }
+        s += "]";
+    }
+    s += "]}}]}";
+    return s;
+}
+
+// twitter.json：对象数组，字符串多，含转义和非 ASCII 字符
+static std::string make_twitter() {
+    static const char *words[] = {"json", "parser", "\\u65e5\\u672c\\u8a9e", "fast", "\\\"quoted\\\"",
+                                  "caf\xC3\xA9", "line\\nbreak", "http:\\/\\/t.co\\/x", "#tag", "@user"};
+    Lcg rng;
+    std::string s = "{\"statuses\":[";
+    char buf[128];
+    for (int i = 0; i < 1500; i++) {
+        if (i) s += ",";
+        snprintf(buf, sizeof(buf), "{\"id\":%u%u,\"id_str\":\"%u%u\",\"text\":\"", rng.next(), i, rng.next(), i);
+        s += buf;
+        for (int w = 0; w < 12; w++) {
+            s += w ? " " : "";
+            s += words[rng.next() % 10];
+        }
+        snprintf(buf, sizeof(buf), "\",\"user\":{\"id\":%u,\"screen_name\":\"user_%d\",\"name\":\"", rng.next(), i);
+        s += buf;
+        s += words[rng.next() % 10];
+        s += "\",\"location\":\"\",\"description\":\"";
+        for (int w = 0; w < 6; w++) {
+            s += w ? " " : "";
+            s += words[rng.next() % 10];
+        }
+        snprintf(buf, sizeof(buf), "\",\"followers_count\":%u,\"verified\":%s},", rng.next() % 100000,
+                 rng.next() % 2 ? "true" : "false");
+        s += buf;
+        s += "\"entities\":{\"hashtags\":[\"a\",\"b\"],\"urls\":[],\"user_mentions\":[]},"
+             "\"retweet_count\":0,\"favorited\":false,\"lang\":\"ja\",\"in_reply_to\":null}";
+    }
+    s += "]}";
+    return s;
+}
+
+// 深层嵌套：很多条深度为 200 的数组、对象交替的链
+static std::string make_nested() {
+    std::string chain;
+    const int depth = 200;
+    for (int d = 0; d < depth; d++)
+        chain += d % 2 ? "{\"k\":" : "[";
+    chain += "0";
+    for (int d = depth; d-- > 0;)
+        chain += d % 2 ? "}" : "]";
+    std::string s = "[";
+    for (int i = 0; i < 1000; i++) {
+        if (i) s += ",";
+        s += chain;
+    }
+    s += "]";
+    return s;
+}
+
+// 大量小文档，每个单独解析
+static std::vector<std::string> make_small(size_t count) {
+    Lcg rng;
+    std::vector<std::string> docs;
+    char buf[160];
+    for (size_t i = 0; i < count; i++) {
+        snprintf(buf, sizeof(buf), "{\"id\":%zu,\"ok\":%s,\"name\":\"item-%u\",\"v\":[%u,%.3f]}", i,
+                 i % 3 ? "true" : "false", rng.next() % 1000, rng.next() % 100, rng.uniform(0, 1));
+        docs.emplace_back(buf);
+    }
+    return docs;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+#ifndef BENCH_MIN_SECONDS
+#define BENCH_MIN_SECONDS 0.5
+#endif
+
+// 每一轮依次 parse、stringify、value_free 全部文档，重复到累计时间超过 BENCH_MIN_SECONDS，
+// 各取最快的一轮。另外用计数分配器单独跑一轮统计分配。
+static void bench_corpus(const char *name, const std::vector<std::string> &docs) {
+    size_t bytes = 0;
+    for (auto &d: docs) bytes += d.size();
+    std::vector<Value> values(docs.size());
+
+    const char *ops[] = {"parse", "stringify", "value_free"};
+    double best[3] = {1e30, 1e30, 1e30};
+    double total = 0;
+    for (int round = 0; round < 3 || total < BENCH_MIN_SECONDS; round++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < docs.size(); i++) {
+            init(values[i]);
+            if (parse(values[i], docs[i].data(), docs[i].size(), corpus_opt) != PARSE_OK) {
+                fprintf(stderr, "%s: parse failed\n", name);
+                exit(1);
+            }
+        }
+        double t0 = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        for (auto &v: values) {
+            size_t len;
+            free(stringify(v, len));
+        }
+        double t1 = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        for (auto &v: values)
+            value_free(v);
+        double t2 = seconds_since(start);
+
+        best[0] = std::min(best[0], t0);
+        best[1] = std::min(best[1], t1);
+        best[2] = std::min(best[2], t2);
+        total += t0 + t1 + t2;
+    }
+
+    size_t calls[3], peak[3];
+    heap.reset();
+    ParseOptions counting_opt = corpus_opt;
+    counting_opt.alloc = &counting_allocator;
+    for (size_t i = 0; i < docs.size(); i++) {
+        init(values[i]);
+        parse(values[i], docs[i].data(), docs[i].size(), counting_opt);
+    }
+    calls[0] = heap.calls;
+    peak[0] = heap.peak;
+    // 之后两步的峰值只算各自新增的部分
+    size_t base = heap.live;
+    heap.calls = 0;
+    heap.peak = base;
+    for (auto &v: values) {
+        size_t len;
+        char *s = stringify(v, len, &counting_allocator);
+        counting_free(&heap, s, len + 1);
+    }
+    calls[1] = heap.calls;
+    peak[1] = heap.peak - base;
+    heap.calls = 0;
+    heap.peak = base;
+    for (auto &v: values)
+        value_free(v, &counting_allocator);
+    calls[2] = heap.calls;
+    peak[2] = 0;
+
+    for (int op = 0; op < 3; op++) {
+        results.push_back(Result{name, ops[op], bytes / best[op] / 1e6, docs.size() / best[op],
+                                 (double) calls[op] / docs.size(), peak[op], peak_rss_kb()});
+    }
+}
+
+static void bench_standard(const std::string &suffix) {
+    bench_corpus(("canada" + suffix).c_str(), {make_canada()});
+    bench_corpus(("twitter" + suffix).c_str(), {make_twitter()});
+    bench_corpus(("nested" + suffix).c_str(), {make_nested()});
+    bench_corpus(("small" + suffix).c_str(), make_small(100000));
+}
+
+static void count_record(Value &, size_t, void *) {
+}
+
+static std::string make_ndjson(size_t records) {
+    std::string s;
+    char line[256];
+    for (size_t i = 0; i < records; i++) {
+        snprintf(line, sizeof(line),
+                 "{\"id\":%zu,\"name\":\"user_%zu\",\"score\":%.3f,\"tags\":[\"a\",\"b\\n\"],\"ok\":true}\n",
+                 i, i, i * 0.125);
+        s += line;
+    }
+    return s;
+}
+
+static void bench_ndjson(const char *json, size_t len, size_t records, unsigned threads, bool ordered,
+                         bool arena) {
+    NdjsonOptions opt;
+    opt.threads = threads;
+    opt.ordered = ordered;
+    opt.arena = arena;
+    double sec = 1e30;
+    for (int round = 0; round < 3; round++) {
+        auto start = std::chrono::steady_clock::now();
+        int ret = parse_ndjson(json, len, count_record, nullptr, opt);
+        sec = std::min(sec, seconds_since(start));
+        if (ret != PARSE_OK) {
+            fprintf(stderr, "ndjson: parse failed (%d)\n", ret);
+            exit(1);
+        }
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "ndjson-t%u-%s%s", threads, ordered ? "ordered" : "unordered",
+             arena ? "-arena" : "");
+    results.push_back(Result{name, "parse", len / sec / 1e6, records / sec, 0, 0, peak_rss_kb()});
+}
+
+static void bench_parallel_array(const std::string &ndjson, unsigned threads) {
+    // 把 NDJSON 的每一行变成顶层数组的一个元素
+    std::string json = "[";
+    for (char ch: ndjson)
+        json += ch == '\n' ? ',' : ch;
+    json.back() = ']';
+
+    double sec = 1e30;
+    for (int round = 0; round < 3; round++) {
+        Value v;
+        init(v);
+        auto start = std::chrono::steady_clock::now();
+        int ret = parse_parallel(v, json.data(), json.size(), threads);
+        sec = std::min(sec, seconds_since(start));
+        if (ret != PARSE_OK) {
+            fprintf(stderr, "array: parse failed (%d)\n", ret);
+            exit(1);
+        }
+        value_free(v);
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "array-t%u", threads);
+    results.push_back(Result{name, "parse", json.size() / sec / 1e6, 1 / sec, 0, 0, peak_rss_kb()});
+}
+
+#ifndef BENCH_RESPONSE_RECORDS
+#define BENCH_RESPONSE_RECORDS 1000
+#endif
+
+// 生成一个与 make_ndjson 的记录相同的响应数组：先建值树再 stringify，对比直接用 Writer 写出
+static void build_response_tree(Value &root, const Allocator *alloc) {
+    char name[32];
+    root.type = ARRAY;
+    root.a_size = 0;
+    root.arr = nullptr;
+    for (size_t i = 0; i < BENCH_RESPONSE_RECORDS; i++) {
+        Value *r = array_insert(root, i, alloc);
+        r->type = OBJECT;
+        r->m_size = 0;
+        r->m = nullptr;
+        set_number(*object_set(*r, "id", 2, alloc), (double) i, alloc);
+        int n = snprintf(name, sizeof(name), "user_%zu", i);
+        set_string(*object_set(*r, "name", 4, alloc), name, n, alloc);
+        set_number(*object_set(*r, "score", 5, alloc), i * 0.125, alloc);
+        Value *tags = object_set(*r, "tags", 4, alloc);
+        tags->type = ARRAY;
+        tags->a_size = 0;
+        tags->arr = nullptr;
+        set_string(*array_insert(*tags, 0, alloc), "a", 1, alloc);
+        set_string(*array_insert(*tags, 1, alloc), "b\n", 2, alloc);
+        set_boolean(*object_set(*r, "ok", 2, alloc), true, alloc);
+    }
+}
+
+static void write_response(Writer &w) {
+    char name[32];
+    writer_start_array(w);
+    for (size_t i = 0; i < BENCH_RESPONSE_RECORDS; i++) {
+        writer_start_object(w);
+        writer_key(w, "id", 2);
+        writer_number(w, (double) i);
+        writer_key(w, "name", 4);
+        int n = snprintf(name, sizeof(name), "user_%zu", i);
+        writer_string(w, name, n);
+        writer_key(w, "score", 5);
+        writer_number(w, i * 0.125);
+        writer_key(w, "tags", 4);
+        writer_start_array(w);
+        writer_string(w, "a", 1);
+        writer_string(w, "b\n", 2);
+        writer_end_array(w);
+        writer_key(w, "ok", 2);
+        writer_bool(w, true);
+        writer_end_object(w);
+    }
+    writer_end_array(w);
+}
+
+// 两种方式各跑一遍完整流程（建树、生成、释放），alloc 为 NULL 时计时，否则用来统计分配
+static size_t response_tree(const Allocator *alloc) {
+    Value root;
+    size_t len;
+    build_response_tree(root, alloc);
+    StringifyOptions opt;
+    opt.alloc = alloc;
+    char *s = stringify(root, len, opt);
+    value_free(root, alloc);
+    if (alloc) alloc->free_fn(alloc->user, s, len + 1);
+    else free(s);
+    return len;
+}
+
+static size_t response_writer(const Allocator *alloc) {
+    Writer w;
+    size_t len;
+    StringifyOptions opt;
+    opt.alloc = alloc;
+    writer_init(w, opt);
+    write_response(w);
+    char *s = writer_finish(w, len);
+    writer_free(w);
+    if (alloc) alloc->free_fn(alloc->user, s, len + 1);
+    else free(s);
+    return len;
+}
+
+static void bench_response() {
+    const char *ops[] = {"tree+stringify", "writer"};
+    size_t (*run[])(const Allocator *) = {response_tree, response_writer};
+    for (int op = 0; op < 2; op++) {
+        double best = 1e30, total = 0;
+        size_t len = 0;
+        for (int round = 0; round < 3 || total < BENCH_MIN_SECONDS; round++) {
+            auto start = std::chrono::steady_clock::now();
+            len = run[op](nullptr);
+            double t = seconds_since(start);
+            best = std::min(best, t);
+            total += t;
+        }
+        heap.reset();
+        run[op](&counting_allocator);
+        results.push_back(Result{"response", ops[op], len / best / 1e6, 1 / best,
+                                 (double) heap.calls, heap.peak, peak_rss_kb()});
+    }
+}
+
+static void print_results(FILE *fp, bool tsv) {
+    if (tsv)
+        fprintf(fp, "corpus\top\tmb_per_s\tdocs_per_s\tallocs_per_doc\tpeak_heap_bytes\tpeak_rss_kb\n");
+    else
+        fprintf(fp, "%-28s %-10s %10s %14s %12s %14s %12s\n",
+                "corpus", "op", "MB/s", "docs/s", "allocs/doc", "peak heap KB", "peak RSS KB");
+    for (auto &r: results) {
+        if (tsv)
+            fprintf(fp, "%s\t%s\t%.3f\t%.3f\t%.3f\t%zu\t%zu\n", r.corpus.c_str(), r.op.c_str(),
+                    r.mb_per_s, r.docs_per_s, r.allocs_per_doc, r.peak_heap, r.peak_rss);
+        else
+            fprintf(fp, "%-28s %-10s %10.1f %14.0f %12.2f %14zu %12zu\n", r.corpus.c_str(), r.op.c_str(),
+                    r.mb_per_s, r.docs_per_s, r.allocs_per_doc, r.peak_heap / 1024, r.peak_rss);
+    }
+}
+
+// 与之前保存的 --tsv 输出比较 MB/s，返回变慢超过 tolerance 的项目数
+static int compare_baseline(const char *path, double tolerance) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "no baseline at %s, skipping comparison\n", path);
+        return 0;
+    }
+    std::map<std::string, double> base;
+    char line[512], corpus[128], op[64];
+    double mbps;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%127[^\t]\t%63[^\t]\t%lf", corpus, op, &mbps) == 3)
+            base[std::string(corpus) + "/" + op] = mbps;
+    }
+    fclose(fp);
+
+    int regressions = 0;
+    fprintf(stderr, "\n%-33s %10s %10s %8s\n", "compared to baseline", "base MB/s", "MB/s", "ratio");
+    for (auto &r: results) {
+        auto it = base.find(r.corpus + "/" + r.op);
+        if (it == base.end() || it->second <= 0) continue;
+        double ratio = r.mb_per_s / it->second;
+        bool slow = ratio < 1.0 - tolerance;
+        regressions += slow;
+        fprintf(stderr, "%-28s %-10s %10.1f %10.1f %8.3f%s\n", r.corpus.c_str(), r.op.c_str(),
+                it->second, r.mb_per_s, ratio, slow ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    bool tsv = false;
+    const char *out = nullptr, *baseline = nullptr, *path = nullptr;
+    const char *kernel = nullptr;
+    double tolerance = 0.10;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--tsv") == 0) tsv = true;
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) out = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) baseline = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) tolerance = atof(argv[++i]);
+        else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) kernel = argv[++i];
+        else if (strcmp(argv[i], "--utf8") == 0) corpus_opt.validate_utf8 = true;
+        else if (argv[i][0] != '-') path = argv[i];
+        else {
+            fprintf(stderr, "usage: bench [--tsv] [--out FILE] [--baseline FILE] [--tolerance R] "
+                            "[--kernel NAME] [--utf8] [ndjson-file]\n");
+            return 2;
+        }
+    }
+
+    if (kernel && strcmp(kernel, "all") == 0) {
+        for (int k = KERNEL_SCALAR; k <= KERNEL_AVX512; k++) {
+            if (set_kernel((Kernel) k))
+                bench_standard(std::string("@") + kernel_name((Kernel) k));
+        }
+        set_kernel(KERNEL_AUTO);
+    } else {
+        if (kernel) {
+            int k = KERNEL_AUTO;
+            while (k <= KERNEL_AVX512 && strcmp(kernel, kernel_name((Kernel) k)) != 0)
+                k++;
+            if (k > KERNEL_AVX512 || !set_kernel((Kernel) k)) {
+                fprintf(stderr, "kernel %s is not supported\n", kernel);
+                return 2;
+            }
+        }
+        bench_standard("");
+    }
+    fprintf(stderr, "kernel: %s\n", kernel_name(active_kernel()));
+    bench_response();
+
+    std::string data;
+    if (path) {
+        FILE *fp = fopen(path, "rb");
+        if (!fp) {
+            fprintf(stderr, "cannot open %s\n", path);
+            return 1;
+        }
+        char buf[1 << 16];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+            data.append(buf, n);
+        fclose(fp);
+    } else {
+        data = make_ndjson(1000000);
+    }
+
+    size_t records = 0;
+    for (char ch: data)
+        records += ch == '\n';
+
+    unsigned hw = std::thread::hardware_concurrency();
+    if (hw == 0) hw = 1;
+    for (unsigned t = 1; t <= hw; t *= 2) {
+        bench_ndjson(data.data(), data.size(), records, t, true, false);
+        bench_ndjson(data.data(), data.size(), records, t, false, false);
+        bench_ndjson(data.data(), data.size(), records, t, false, true);
+    }
+    for (unsigned t = 1; t <= hw; t *= 2)
+        bench_parallel_array(data, t);
+
+    print_results(stdout, tsv);
+    if (out) {
+        FILE *fp = fopen(out, "w");
+        if (!fp) {
+            fprintf(stderr, "cannot write %s\n", out);
+            return 1;
+        }
+        print_results(fp, true);
+        fclose(fp);
+    }
+    if (baseline && compare_baseline(baseline, tolerance) > 0)
+        return 1;
+    return 0;
+}
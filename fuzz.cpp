@@ -0,0 +1,394 @@
+//
+// libFuzzer 入口。同一个文件按宏编译成三个目标：
+//   FUZZ_PARSE         parse（含宽松语法）以及其他直接吃原始字节的入口（decode_binary、Reader）不崩溃、不越界
+//   FUZZ_ROUNDTRIP     parse -> stringify -> parse 得到相同的值和相同的文本，只输出 ASCII 时也一样
+//   FUZZ_DIFFERENTIAL  以递归下降的 parse(v, json, len) 为参照，其他解析路径
+//                      （以 '\0' 结尾、Parser、parse_parallel、Reader、NDJSON、键表、磁带、二进制编码）
+//                      以及每一种 CPU 支持的扫描内核，必须给出相同的错误码和相同的值；
+//                      模式的值树校验和流式校验结果也必须一致
+//
+// 输入缓冲区恰好是 size 字节，不以 '\0' 结尾，配合 AddressSanitizer 可以发现越界读取。
+// 定义 FUZZ_STANDALONE 时附带一个 main，依次读取命令行给出的文件或目录，用于在没有 libFuzzer 的
+// 编译器上重放语料和崩溃用例。
+//
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "tiny_json.h"
+
+using namespace tiny_json;
+
+#define FUZZ_CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d check failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort(); \
+        } \
+    } while (0)
+
+// 按成员顺序逐字节比较，比 value_equal 更严格
+static std::string dump(const Value &v) {
+    size_t len;
+    char *s = stringify(v, len);
+    std::string ret(s, len);
+    free(s);
+    return ret;
+}
+
+#if defined(FUZZ_ROUNDTRIP)
+
+static void fuzz_one(const char *data, size_t size) {
+    Value v;
+    init(v);
+    if (parse(v, data, size) != PARSE_OK) return;
+    std::string first = dump(v);
+
+    // 超出 double 范围的数字解析成无穷，输出为 Infinity，读回时要允许
+    ParseOptions back;
+    back.allow_nan_inf = true;
+    Value v2;
+    init(v2);
+    FUZZ_CHECK(parse(v2, first.data(), first.size(), back) == PARSE_OK);
+    FUZZ_CHECK(value_equal(v, v2));
+    FUZZ_CHECK(dump(v2) == first);
+    value_free(v2);
+
+    // 只输出 ASCII 的结果不含非 ASCII 字节；字符串都是合法 UTF-8 时解析回来得到相同的值
+    StringifyOptions ascii;
+    ascii.ascii = true;
+    size_t len;
+    char *s = stringify(v, len, ascii);
+    for (size_t i = 0; i < len; i++)
+        FUZZ_CHECK((unsigned char) s[i] < 0x80);
+    ParseOptions strict;
+    strict.validate_utf8 = true;
+    init(v2);
+    if (parse(v2, data, size, strict) == PARSE_OK) {
+        value_free(v2);
+        init(v2);
+        FUZZ_CHECK(parse(v2, s, len, back) == PARSE_OK);
+        FUZZ_CHECK(dump(v2) == first);
+        value_free(v2);
+    }
+    free(s);
+    value_free(v);
+}
+
+#elif defined(FUZZ_DIFFERENTIAL)
+
+static bool same_tape(const Tape &t, size_t node, const Value &v) {
+    if (get_type(t, node) != v.type) return false;
+    switch (v.type) {
+        case NUMBER:
+            return get_number(t, node) == v.num;
+        case STRING:
+            return get_string_length(t, node) == get_string_length(v) &&
+                   memcmp(get_string(t, node), get_string(v), get_string_length(v)) == 0;
+        case ARRAY: {
+            if (get_array_size(t, node) != v.a_size) return false;
+            size_t e = node + 1;
+            for (size_t i = 0; i < v.a_size; i++, e = tape_skip(t, e))
+                if (!same_tape(t, e, v.arr[i])) return false;
+            return true;
+        }
+        case OBJECT:
+            if (get_object_size(t, node) != v.m_size) return false;
+            for (size_t i = 0; i < v.m_size; i++) {
+                if (get_object_key_length(t, node, i) != v.m[i].k_len ||
+                    memcmp(get_object_key(t, node, i), v.m[i].k, v.m[i].k_len) != 0 ||
+                    !same_tape(t, get_object_value(t, node, i), v.m[i].v))
+                    return false;
+            }
+            return true;
+        default:
+            return true;
+    }
+}
+
+struct NdjsonResult {
+    size_t count;
+    std::string text;
+};
+
+static void ndjson_collect(Value &v, size_t, void *user) {
+    auto *r = (NdjsonResult *) user;
+    r->count++;
+    r->text = dump(v);
+}
+
+// 同一个输入用另一条路径解析，错误码和值都要与参照一致
+static void check_same(int expect_ret, const std::string &expect, int ret, Value &v) {
+    FUZZ_CHECK(ret == expect_ret);
+    if (ret == PARSE_OK) FUZZ_CHECK(dump(v) == expect);
+    value_free(v);
+}
+
+static void fuzz_one(const char *data, size_t size) {
+    Value ref;
+    init(ref);
+    int ref_ret = parse(ref, data, size);
+    std::string expect = ref_ret == PARSE_OK ? dump(ref) : std::string();
+    Value v;
+    int ret;
+
+    // 以 '\0' 结尾的接口在第一个 '\0' 处停下，只有输入里没有 '\0' 时才等价
+    std::string terminated(data, size);
+    if (size == 0 || memchr(data, '\0', size) == NULL) {
+        init(v);
+        check_same(ref_ret, expect, parse(v, terminated.c_str()), v);
+    }
+
+    // 参照用自动选择的内核，其余内核的解析和生成结果必须相同。
+    // 严格 UTF-8 模式以标量内核为参照，通过校验时结果与不校验时相同
+    ParseOptions strict;
+    strict.validate_utf8 = true;
+    set_kernel(KERNEL_SCALAR);
+    init(v);
+    int strict_ret = parse(v, data, size, strict);
+    std::string strict_expect = strict_ret == PARSE_OK ? dump(v) : std::string();
+    if (strict_ret == PARSE_OK) {
+        FUZZ_CHECK(ref_ret == PARSE_OK && strict_expect == expect);
+        value_free(v);
+    }
+    for (int k = KERNEL_SCALAR; k <= KERNEL_AVX512; k++) {
+        if (!set_kernel((Kernel) k)) continue;
+        init(v);
+        check_same(ref_ret, expect, parse(v, data, size), v);
+        init(v);
+        check_same(strict_ret, strict_expect, parse(v, data, size, strict), v);
+        if (ref_ret == PARSE_OK) FUZZ_CHECK(dump(ref) == expect);
+    }
+    set_kernel(KERNEL_AUTO);
+
+    // 宽松语法只是标准语法的扩展，标准输入的解析结果不变
+    ParseOptions lenient;
+    lenient.allow_comments = lenient.allow_trailing_commas = true;
+    lenient.allow_single_quotes = lenient.allow_nan_inf = true;
+    init(v);
+    ret = parse(v, data, size, lenient);
+    if (ref_ret == PARSE_OK) check_same(ref_ret, expect, ret, v);
+    else if (ret == PARSE_OK) value_free(v);
+
+    // 没有重复键时 REJECT 的结果不变；解析时排序等于解析后调用 sort_members
+    if (ref_ret == PARSE_OK) {
+        ParseOptions members;
+        members.duplicate_keys = DUPLICATE_KEYS_REJECT;
+        init(v);
+        ret = parse(v, data, size, members);
+        if (ret == PARSE_OK) check_same(ref_ret, expect, ret, v);
+        else FUZZ_CHECK(ret == PARSE_DUPLICATE_KEY);
+
+        members.duplicate_keys = DUPLICATE_KEYS_ALLOW;
+        members.sort_members = true;
+        Value sorted;
+        init(sorted);
+        value_copy(sorted, ref);
+        sort_members(sorted);
+        init(v);
+        check_same(ref_ret, dump(sorted), parse(v, data, size, members), v);
+        value_free(sorted);
+    }
+
+    Parser p;
+    parser_init(p, 64);
+    for (int i = 0; i < 2; i++) {
+        init(v);
+        check_same(ref_ret, expect, parse(p, v, data, size), v);
+    }
+    parser_free(p);
+
+    // 编译 fuzz 目标时 PARSE_PARALLEL_MIN_SIZE 被调小，短输入也会走多线程切分
+    init(v);
+    check_same(ref_ret, expect, parse_parallel(v, data, size, 3), v);
+    ParseOptions parallel = strict;
+    parallel.threads = 3;
+    init(v);
+    check_same(strict_ret, strict_expect, parse_parallel(v, data, size, parallel), v);
+
+    Reader r;
+    reader_init(r, data, size);
+    init(v);
+    ret = reader_value(r, v);
+    if (ret == PARSE_OK && (ret = reader_end(r)) != PARSE_OK) value_free(v);
+    check_same(ref_ret, expect, ret, v);
+    reader_free(r);
+
+    // 跳过不建树，但接受的输入和错误码都要和完整解析一致
+    reader_init(r, data, size);
+    ret = reader_skip(r);
+    if (ret == PARSE_OK) ret = reader_end(r);
+    FUZZ_CHECK(ret == ref_ret);
+    reader_free(r);
+
+    KeyTable *keys = key_table_create();
+    ParseOptions opt;
+    opt.keys = keys;
+    init(v);
+    check_same(ref_ret, expect, parse(v, data, size, opt), v);
+    key_table_free(keys);
+
+    // 单行且不是空白行时，NDJSON 恰好产生一条记录
+    bool blank = true;
+    for (size_t i = 0; i < size && blank; i++)
+        blank = data[i] == ' ' || data[i] == '\t' || data[i] == '\r';
+    if (!blank && memchr(data, '\n', size) == NULL) {
+        NdjsonResult nd{0, std::string()};
+        NdjsonOptions nopt;
+        nopt.threads = 1;
+        ret = parse_ndjson(data, size, ndjson_collect, &nd, nopt);
+        FUZZ_CHECK(ret == ref_ret);
+        if (ret == PARSE_OK) FUZZ_CHECK(nd.count == 1 && nd.text == expect);
+    }
+
+    Tape t;
+    ret = parse_tape(t, data, size);
+    FUZZ_CHECK(ret == ref_ret);
+    if (ret == PARSE_OK) {
+        FUZZ_CHECK(same_tape(t, 0, ref));
+        tape_free(t);
+    }
+
+    if (ref_ret == PARSE_OK) {
+        size_t len;
+        char *bin = encode_binary(ref, len);
+        init(v);
+        check_same(PARSE_OK, expect, decode_binary(v, bin, len), v);
+        free(bin);
+
+        // 输入本身当作模式：能编译时，值树校验和流式校验必须一致
+        Schema *s;
+        if (schema_compile(s, ref) == PARSE_OK) {
+            FUZZ_CHECK(schema_validate(s, ref) == schema_validate(s, data, size));
+            schema_free(s);
+        }
+
+        // 自己和自己的差异为空，和 null 的差异应用后得到自己
+        Value null_v, patch;
+        init(null_v);
+        init(patch);
+        diff(patch, ref, ref);
+        FUZZ_CHECK(patch.type == ARRAY && patch.a_size == 0);
+        diff(patch, null_v, ref);
+        FUZZ_CHECK(apply_patch(null_v, patch) == PARSE_OK);
+        FUZZ_CHECK(dump(null_v) == expect);
+        value_free(patch);
+        value_free(null_v);
+    }
+    value_free(ref);
+}
+
+#else
+
+static void fuzz_one(const char *data, size_t size) {
+    Value v;
+    init(v);
+    if (parse(v, data, size) == PARSE_OK) {
+        size_t len;
+        free(stringify(v, len));
+        value_free(v);
+    }
+
+    ParseOptions lenient;
+    lenient.allow_comments = lenient.allow_trailing_commas = true;
+    lenient.allow_single_quotes = lenient.allow_nan_inf = true;
+    lenient.validate_utf8 = true;
+    init(v);
+    if (parse(v, data, size, lenient) == PARSE_OK)
+        value_free(v);
+
+    // 重复键的每种处理方式，同时排序
+    for (int dup = DUPLICATE_KEYS_REJECT; dup <= DUPLICATE_KEYS_LAST; dup++) {
+        lenient.duplicate_keys = (DuplicateKeys) dup;
+        lenient.sort_members = dup != DUPLICATE_KEYS_REJECT;
+        init(v);
+        if (parse(v, data, size, lenient) == PARSE_OK)
+            value_free(v);
+    }
+
+    // 原始字节当作二进制编码解码，格式错误只能返回错误码
+    init(v);
+    if (decode_binary(v, data, size) == PARSE_OK)
+        value_free(v);
+
+    // 按 Reader 的方式逐个拉取，遇到容器就进入，其他值跳过
+    Reader r;
+    reader_init(r, data, size);
+    Type type;
+    bool more;
+    const char *k;
+    size_t klen;
+    int ret = PARSE_OK;
+    for (int steps = 0; ret == PARSE_OK && steps < 4096; steps++) {
+        if ((ret = reader_peek(r, type)) != PARSE_OK) break;
+        if (type == ARRAY) {
+            ret = reader_begin_array(r);
+            if (ret == PARSE_OK) ret = reader_next_element(r, more);
+        } else if (type == OBJECT) {
+            ret = reader_begin_object(r);
+            if (ret == PARSE_OK) ret = reader_next_member(r, more, k, klen);
+        } else {
+            ret = reader_skip(r);
+        }
+    }
+    reader_free(r);
+}
+
+#endif
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size) {
+    fuzz_one((const char *) data, size);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+
+#include <vector>
+
+#ifndef _WINDOWS
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+static void run_file(const std::string &path) {
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        fprintf(stderr, "cannot open %s\n", path.c_str());
+        exit(1);
+    }
+    std::string data;
+    char buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        data.append(buf, n);
+    fclose(fp);
+    // 拷到恰好 size 字节的堆内存里，越界读取才会被 AddressSanitizer 发现
+    std::vector<unsigned char> exact(data.begin(), data.end());
+    LLVMFuzzerTestOneInput(exact.data(), exact.size());
+}
+
+int main(int argc, char **argv) {
+    size_t count = 0;
+    for (int i = 1; i < argc; i++) {
+#ifndef _WINDOWS
+        struct stat st;
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            DIR *dir = opendir(argv[i]);
+            while (struct dirent *e = dir ? readdir(dir) : NULL) {
+                if (e->d_name[0] == '.') continue;
+                run_file(std::string(argv[i]) + "/" + e->d_name);
+                count++;
+            }
+            if (dir) closedir(dir);
+            continue;
+        }
+#endif
+        run_file(argv[i]);
+        count++;
+    }
+    printf("%zu inputs ok\n", count);
+    return 0;
+}
+
+#endif
@@ -1,11 +1,17 @@
 //
 // Created by 晚风吹行舟 on 2023/5/8.
 //
+#include <atomic>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "tiny_json.h"
+#include "tiny_json.hpp"
+#include "tiny_json_bind.hpp"
 
 
 using namespace tiny_json;
@@ -108,6 +114,8 @@ static void test_parse_number() {
         EXPECT_EQ_INT(PARSE_OK, parse(v, json));\
         EXPECT_EQ_INT(STRING, get_type(v));\
         EXPECT_EQ_STRING(expect, get_string(v));\
+        EXPECT_EQ_SIZE_T(sizeof(expect) - 1, get_string_length(v));\
+        EXPECT_EQ_INT(1, string_equal(v, expect, sizeof(expect) - 1));\
         value_free(v);\
     } while(0)
 
@@ -443,6 +451,49 @@ static void test_access_string() {
     value_free(v);
 }
 
+static void test_access_short_string() {
+    Value v;
+    init(v);
+    set_string(v, "ok", 2);
+    EXPECT_EQ_INT(1, get_string(v) == v.short_str);
+    EXPECT_EQ_STRING("ok", get_string(v));
+    set_string(v, "123456789012345", 15);
+    EXPECT_EQ_INT(1, get_string(v) == v.short_str);
+    EXPECT_EQ_SIZE_T(15, get_string_length(v));
+    set_string(v, "1234567890123456", 16);
+    EXPECT_EQ_INT(0, get_string(v) == v.short_str);
+    EXPECT_EQ_STRING("1234567890123456", get_string(v));
+    value_free(v);
+
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "[\"id\",\"a somewhat longer string\"]"));
+    EXPECT_EQ_STRING("id", get_string(*get_array_element(v, 0)));
+    EXPECT_EQ_STRING("a somewhat longer string", get_string(*get_array_element(v, 1)));
+    value_free(v);
+}
+
+static void test_access_string_view() {
+    Value a, b;
+    init(a);
+    init(b);
+    set_string(a, "Hello\0World", 11);
+    set_string(b, "Hello\0Worle", 11);
+    EXPECT_EQ_SIZE_T(11, get_string_view(a).size());
+    EXPECT_EQ_INT(1, get_string_view(a) == std::string_view("Hello\0World", 11));
+    EXPECT_EQ_INT(0, string_equal(a, "Hello", 5));
+    EXPECT_EQ_INT(1, string_compare(a, b) < 0);
+    EXPECT_EQ_INT(1, string_compare(b, a) > 0);
+    set_string(b, "Hello", 5);
+    EXPECT_EQ_INT(1, string_compare(a, b) > 0);
+    set_string(b, "Hello\0World", 11);
+    EXPECT_EQ_INT(0, string_compare(a, b));
+    value_free(a);
+    value_free(b);
+
+    EXPECT_EQ_INT(PARSE_OK, parse(a, "{\"a\\u0000b\":1}"));
+    EXPECT_EQ_INT(1, get_object_key_view(a, 0) == std::string_view("a\0b", 3));
+    value_free(a);
+}
+
 static void test_str() {
     const char *p = "";
     bool x = p[0] == '\0';
@@ -456,6 +507,267 @@ static void test_strtod() {
 }
 
 
+static void test_parse_bounded() {
+    Value v;
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "12345", 2));
+    EXPECT_EQ_DOUBLE(12.0, get_number(v));
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "[1,2]xyz", 5));
+    EXPECT_EQ_SIZE_T(2, get_array_size(v));
+    value_free(v);
+    EXPECT_EQ_INT(PARSE_MISS_QUOTATION_MARK, parse(v, "\"abc\"", 4));
+    EXPECT_EQ_INT(PARSE_INVALID_UNICODE_HEX, parse(v, "\"\\u1234\"", 5));
+    EXPECT_EQ_INT(PARSE_INVALID_VALUE, parse(v, "true", 3));
+    EXPECT_EQ_INT(PARSE_EXPECT_VALUE, parse(v, "null", 0));
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "10"));
+    EXPECT_EQ_DOUBLE(10.0, get_number(v));
+}
+
+struct NdjsonSum {
+    size_t count;
+    size_t last_index;
+    bool in_order;
+    double sum;
+};
+
+static void ndjson_sum(Value &v, size_t index, void *user) {
+    auto *s = (NdjsonSum *) user;
+    if (s->count > 0 && index != s->last_index + 1) s->in_order = false;
+    s->last_index = index;
+    s->count++;
+    s->sum += get_number(*get_object_value(v, 0));
+}
+
+// 无序模式下回调并发执行
+struct NdjsonTotal {
+    std::atomic<size_t> count;
+    std::atomic<long long> sum;
+};
+
+static void ndjson_total(Value &v, size_t, void *user) {
+    auto *t = (NdjsonTotal *) user;
+    t->count++;
+    t->sum += (long long) get_number(*get_object_value(v, 0));
+}
+
+static void test_ndjson() {
+    const char *json = "{\"n\":1}\n"
+                       "\n"
+                       "{\"n\":2, \"s\":\"a\\\"\\n\\\\\"}\r\n"
+                       "  {\"n\":3}";
+    NdjsonSum s{0, 0, true, 0.0};
+    EXPECT_EQ_INT(PARSE_OK, parse_ndjson(json, strlen(json), ndjson_sum, &s));
+    EXPECT_EQ_SIZE_T(3, s.count);
+    EXPECT_EQ_INT(1, s.in_order);
+    EXPECT_EQ_DOUBLE(6.0, s.sum);
+
+    // 原始换行字节不能出现在字符串里，总是作为记录分隔，坏记录不会吞掉后面的行
+    const char *bad = "{\"n\":1}\n{\"n\":\"a\nb\"}\n{\"n\":3}\n";
+    s = NdjsonSum{0, 0, true, 0.0};
+    EXPECT_EQ_INT(PARSE_MISS_QUOTATION_MARK, parse_ndjson(bad, strlen(bad), ndjson_sum, &s));
+    EXPECT_EQ_SIZE_T(1, s.count);
+
+    // 宽松语法中的引号和注释不影响切分
+    const char *lenient[] = {
+            "{'n':1,'s':'x\"y'}\n{'n':2}\n{\"n\":3}\n",
+            "{\"n\":1} // it's \"\n{\"n\":2} /* ' */\n{\"n\":3}\n",
+            "{\"n\":1,\"a\":[\"\\\"\",],}\n{\"n\":2,}\n{\"n\":3}\n",
+            "{\"n\":1,\"x\":NaN}\n{\"n\":2,\"x\":-Infinity}\n{\"n\":3}\n",
+    };
+    for (size_t i = 0; i < sizeof(lenient) / sizeof(lenient[0]); i++) {
+        NdjsonOptions nd;
+        nd.threads = 1;
+        nd.parse.allow_single_quotes = i == 0;
+        nd.parse.allow_comments = i == 1;
+        nd.parse.allow_trailing_commas = i == 2;
+        nd.parse.allow_nan_inf = i == 3;
+        s = NdjsonSum{0, 0, true, 0.0};
+        EXPECT_EQ_INT(PARSE_OK, parse_ndjson(lenient[i], strlen(lenient[i]), ndjson_sum, &s, nd));
+        EXPECT_EQ_SIZE_T(3, s.count);
+        EXPECT_EQ_DOUBLE(6.0, s.sum);
+    }
+
+    std::string many;
+    for (int i = 1; i <= 5000; i++)
+        many += "{\"n\":" + std::to_string(i) + ",\"a\":[1,2,3]}\n";
+    NdjsonOptions opt;
+    opt.threads = 4;
+    s = NdjsonSum{0, 0, true, 0.0};
+    EXPECT_EQ_INT(PARSE_OK, parse_ndjson(many.c_str(), many.size(), ndjson_sum, &s, opt));
+    EXPECT_EQ_SIZE_T(5000, s.count);
+    EXPECT_EQ_INT(1, s.in_order);
+    EXPECT_EQ_DOUBLE(5000.0 * 5001 / 2, s.sum);
+
+    // 解析到每个线程的 arena 里，有序和无序两种模式
+    opt.arena = true;
+    s = NdjsonSum{0, 0, true, 0.0};
+    EXPECT_EQ_INT(PARSE_OK, parse_ndjson(many.c_str(), many.size(), ndjson_sum, &s, opt));
+    EXPECT_EQ_SIZE_T(5000, s.count);
+    EXPECT_EQ_INT(1, s.in_order);
+    EXPECT_EQ_DOUBLE(5000.0 * 5001 / 2, s.sum);
+    opt.ordered = false;
+    NdjsonTotal t{{0}, {0}};
+    EXPECT_EQ_INT(PARSE_OK, parse_ndjson(many.c_str(), many.size(), ndjson_total, &t, opt));
+    EXPECT_EQ_SIZE_T(5000, t.count.load());
+    EXPECT_EQ_INT(1, t.sum.load() == 5000LL * 5001 / 2);
+    bad = "{\"n\":1}\n{\"n\":[1,}\n";
+    EXPECT_EQ_INT(PARSE_INVALID_VALUE, parse_ndjson(bad, strlen(bad), ndjson_total, &t, opt));
+}
+
+static void test_parse_parallel() {
+    std::string json = "[";
+    for (int i = 0; i < 20000; i++) {
+        if (i) json += ", ";
+        json += "{\"i\":" + std::to_string(i) + ",\"s\":\"a,]}\\\"[\",\"a\":[[],{}]}";
+    }
+    json += " ] ";
+
+    Value v;
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse_parallel(v, json.c_str(), json.size(), 4));
+    EXPECT_EQ_INT(ARRAY, get_type(v));
+    EXPECT_EQ_SIZE_T(20000, get_array_size(v));
+    bool ok = true;
+    for (size_t i = 0; i < get_array_size(v); i++) {
+        Value *e = get_array_element(v, i);
+        ok = ok && get_number(*get_object_value(*e, 0)) == (double) i;
+        ok = ok && strcmp(get_string(*get_object_value(*e, 1)), "a,]}\"[") == 0;
+    }
+    EXPECT_EQ_INT(1, ok);
+    value_free(v);
+
+    std::string bad = json;
+    bad.insert(bad.find("\"i\":10000,") + 4, "?");
+    Value expect;
+    init(expect);
+    EXPECT_EQ_INT(parse(expect, bad.c_str(), bad.size()), parse_parallel(v, bad.c_str(), bad.size(), 4));
+    value_free(expect);
+
+    bad = json.substr(0, json.size() - 3) + ",]";
+    EXPECT_EQ_INT(PARSE_INVALID_VALUE, parse_parallel(v, bad.c_str(), bad.size(), 4));
+    EXPECT_EQ_INT(NUL, get_type(v));
+
+    // 选项对每个分块都生效
+    ParseOptions opt;
+    opt.threads = 4;
+    opt.validate_utf8 = true;
+    opt.keys = key_table_create(true);
+    EXPECT_EQ_INT(PARSE_OK, parse_parallel(v, json.c_str(), json.size(), opt));
+    EXPECT_EQ_SIZE_T(3, key_table_size(opt.keys));
+    EXPECT_EQ_INT(1, get_object_key(*get_array_element(v, 19999), 0) == key_table_intern(opt.keys, "i", 1));
+    value_free(v);
+    bad = json;
+    bad.insert(bad.find("\"i\":15000,\"s\":\"") + 15, "\xC0\xAF");
+    EXPECT_EQ_INT(PARSE_INVALID_UTF8, parse_parallel(v, bad.c_str(), bad.size(), opt));
+    EXPECT_EQ_INT(NUL, get_type(v));
+    // parse 按 threads 转给 parse_parallel
+    EXPECT_EQ_INT(PARSE_INVALID_UTF8, parse(v, bad.c_str(), bad.size(), opt));
+    EXPECT_EQ_INT(PARSE_OK, parse(v, json.c_str(), json.size(), opt));
+    EXPECT_EQ_SIZE_T(20000, get_array_size(v));
+    value_free(v);
+    key_table_free(opt.keys);
+
+    // 宽松语法：注释和单引号字符串里的括号、逗号不参与切分，尾随逗号不需要退回串行解析
+    std::string lenient = "[ // head, ]\n";
+    for (int i = 0; i < 2000; i++)
+        lenient += "{'s':'a,]\\'[' /* }, */, \"n\":NaN,}, ";
+    ParseOptions lopt;
+    lopt.threads = 4;
+    lopt.allow_comments = lopt.allow_trailing_commas = lopt.allow_single_quotes = lopt.allow_nan_inf = true;
+    for (const char *tail: {"]", "/**/]", "1 ,]"}) {
+        std::string text = lenient + tail;
+        lopt.threads = 1;
+        init(expect);
+        EXPECT_EQ_INT(PARSE_OK, parse(expect, text.c_str(), text.size(), lopt));
+        lopt.threads = 4;
+        EXPECT_EQ_INT(PARSE_OK, parse_parallel(v, text.c_str(), text.size(), lopt));
+        // NaN 不等于自身，比较生成的文本
+        size_t len1, len2;
+        char *s1 = stringify(expect, len1), *s2 = stringify(v, len2);
+        EXPECT_EQ_STRING(s1, s2);
+        free(s1);
+        free(s2);
+        value_free(v);
+        value_free(expect);
+    }
+    std::string unterminated = lenient + "] /* x";
+    EXPECT_EQ_INT(PARSE_ROOT_NOT_SINGULAR, parse_parallel(v, unterminated.c_str(), unterminated.size(), lopt));
+
+    // 顶层用 '}' 闭合，各个分块本身都是合法的
+    bad = json.substr(0, json.size() - 3) + "}";
+    EXPECT_EQ_INT(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, parse_parallel(v, bad.c_str(), bad.size(), 4));
+    EXPECT_EQ_INT(NUL, get_type(v));
+
+    // 预扫描用各个内核成段跳过字符串和空白：长字符串、转义的反斜杠和大段缩进
+    std::string pretty = "[\n";
+    for (int i = 0; i < 3000; i++)
+        pretty += std::string(i ? ",\n" : "") + "        {\"s\" :  \"" + std::string(40, 'x') + "\\\\\", \"t\": \"],\\\"{\\u00e9\"}";
+    pretty += "\n]\n";
+    init(expect);
+    EXPECT_EQ_INT(PARSE_OK, parse(expect, pretty.c_str(), pretty.size()));
+    bad = pretty;
+    bad[bad.find("\"s\"", pretty.size() / 2) + 10] = '\t';
+    for (Kernel k: {KERNEL_SCALAR, KERNEL_SSE42, KERNEL_AVX2, KERNEL_AVX512}) {
+        if (!set_kernel(k)) continue;
+        EXPECT_EQ_INT(PARSE_OK, parse_parallel(v, pretty.c_str(), pretty.size(), 4));
+        EXPECT_EQ_INT(1, value_equal(expect, v));
+        value_free(v);
+        // 字符串里的控制字符不影响切分，由分块解析报错
+        EXPECT_EQ_INT(PARSE_INVALID_STRING_CHAR, parse_parallel(v, bad.c_str(), bad.size(), 4));
+    }
+    set_kernel(KERNEL_AUTO);
+    value_free(expect);
+}
+
+static void test_parse_file() {
+    const char *path = "tiny_json_test_parse_file.json";
+    FILE *fp = fopen(path, "wb");
+    fputs(" {\"a\" : [1, 2, \"x\"]} ", fp);
+    fclose(fp);
+
+    Value v;
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse_file(v, path));
+    EXPECT_EQ_INT(OBJECT, get_type(v));
+    EXPECT_EQ_SIZE_T(3, get_array_size(*get_object_value(v, 0)));
+    value_free(v);
+
+    fp = fopen(path, "wb");
+    fclose(fp);
+    EXPECT_EQ_INT(PARSE_EXPECT_VALUE, parse_file(v, path));
+    remove(path);
+    EXPECT_EQ_INT(PARSE_FILE_ERROR, parse_file(v, path));
+}
+
+static void test_parser_reuse() {
+    Parser p;
+    parser_init(p);
+    Value v;
+    init(v);
+    std::string big = "[\"" + std::string(1000, 'x') + "\"]";
+    EXPECT_EQ_INT(PARSE_OK, parse(p, v, big.c_str()));
+    value_free(v);
+    size_t size = p.c.size;
+    char *stack = p.c.stack;
+    EXPECT_EQ_INT(1, size > big.size());
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ_INT(PARSE_OK, parse(p, v, "{\"a\":[1,2,\"abc\"]}"));
+        EXPECT_EQ_SIZE_T(1, get_object_size(v));
+        value_free(v);
+    }
+    EXPECT_EQ_INT(1, stack == p.c.stack);
+    EXPECT_EQ_SIZE_T(size, p.c.size);
+    EXPECT_EQ_INT(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, parse(p, v, "[1, 1.5"));
+    EXPECT_EQ_INT(PARSE_OK, parse(p, v, "1", 1));
+    parser_free(p);
+
+    parser_init(p, 16);
+    EXPECT_EQ_INT(PARSE_OK, parse(p, v, big.c_str()));
+    value_free(v);
+    EXPECT_EQ_INT(1, p.c.stack == NULL);
+    parser_free(p);
+}
+
 static void test_parse() {
     test_parse_null();
     test_parse_number();
@@ -475,6 +787,10 @@ static void test_parse() {
     test_parse_miss_key();
     test_parse_miss_colon();
     test_parse_miss_comma_or_curly_bracket();
+    test_parse_bounded();
+    test_parse_parallel();
+    test_parse_file();
+    test_parser_reuse();
 }
 
 static void test_access() {
@@ -483,6 +799,876 @@ static void test_access() {
     test_access_null();
     test_access_number();
     test_access_string();
+    test_access_short_string();
+    test_access_string_view();
+}
+
+#define TEST_BINARY_ROUNDTRIP(json)\
+    do {\
+        Value v, v2;\
+        char *bin, *json2;\
+        size_t bin_len, length;\
+        init(v);\
+        init(v2);\
+        EXPECT_EQ_INT(PARSE_OK, parse(v, json));\
+        bin = encode_binary(v, bin_len);\
+        EXPECT_EQ_INT(PARSE_OK, decode_binary(v2, bin, bin_len));\
+        json2 = stringify(v2, length);\
+        EXPECT_EQ_STRING(json, json2);\
+        value_free(v2);\
+        for (size_t i = 0; i < bin_len; i++)\
+            EXPECT_EQ_INT(PARSE_INVALID_BINARY, decode_binary(v2, bin, i));\
+        value_free(v);\
+        value_free(v2);\
+        free(bin);\
+        free(json2);\
+    } while(0)
+
+static void test_binary() {
+    TEST_BINARY_ROUNDTRIP("null");
+    TEST_BINARY_ROUNDTRIP("false");
+    TEST_BINARY_ROUNDTRIP("true");
+    TEST_BINARY_ROUNDTRIP("-1.7976931348623157e+308");
+    TEST_BINARY_ROUNDTRIP("\"Hello\\u0000World\"");
+    TEST_BINARY_ROUNDTRIP("[]");
+    TEST_BINARY_ROUNDTRIP("{}");
+    TEST_BINARY_ROUNDTRIP(
+            "{\"n\":null,\"f\":false,\"t\":true,\"i\":123,\"s\":\"abc\",\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
+
+    Value v;
+    init(v);
+    EXPECT_EQ_INT(PARSE_INVALID_BINARY, decode_binary(v, "\x09", 1));
+    EXPECT_EQ_INT(PARSE_INVALID_BINARY, decode_binary(v, "\x05\xff\xff\xff\xff\x0f", 6));
+    EXPECT_EQ_INT(PARSE_INVALID_BINARY, decode_binary(v, "\x00\x00", 2));
+    EXPECT_EQ_INT(NUL, get_type(v));
+}
+
+static void test_tape() {
+    const char *json = "{\"n\":null,\"t\":true,\"s\":\"abc\",\"a\":[[1,2],{\"x\":\"y\"},3],\"i\":123}";
+    Tape t;
+    EXPECT_EQ_INT(PARSE_OK, parse_tape(t, json, strlen(json)));
+
+    // 拷贝到别的地址后依然可以访问
+    Tape copy;
+    copy.size = t.size;
+    copy.data = (char *) malloc(t.size);
+    memcpy(copy.data, t.data, t.size);
+    tape_free(t);
+
+    EXPECT_EQ_INT(OBJECT, get_type(copy, 0));
+    EXPECT_EQ_SIZE_T(5, get_object_size(copy, 0));
+    EXPECT_EQ_STRING("n", get_object_key(copy, 0, 0));
+    EXPECT_EQ_INT(NUL, get_type(copy, get_object_value(copy, 0, 0)));
+    EXPECT_EQ_INT(TRUE, get_boolean(copy, get_object_value(copy, 0, 1)));
+    EXPECT_EQ_STRING("abc", get_string(copy, get_object_value(copy, 0, 2)));
+    EXPECT_EQ_SIZE_T(3, get_string_length(copy, get_object_value(copy, 0, 2)));
+    size_t a = get_object_value(copy, 0, 3);
+    EXPECT_EQ_SIZE_T(3, get_array_size(copy, a));
+    EXPECT_EQ_SIZE_T(2, get_array_size(copy, get_array_element(copy, a, 0)));
+    EXPECT_EQ_DOUBLE(2.0, get_number(copy, get_array_element(copy, get_array_element(copy, a, 0), 1)));
+    size_t o = get_array_element(copy, a, 1);
+    EXPECT_EQ_STRING("x", get_object_key(copy, o, 0));
+    EXPECT_EQ_STRING("y", get_string(copy, get_object_value(copy, o, 0)));
+    EXPECT_EQ_DOUBLE(3.0, get_number(copy, get_array_element(copy, a, 2)));
+    EXPECT_EQ_STRING("i", get_object_key(copy, 0, 4));
+    EXPECT_EQ_SIZE_T(1, get_object_key_length(copy, 0, 4));
+    EXPECT_EQ_DOUBLE(123.0, get_number(copy, get_object_value(copy, 0, 4)));
+    tape_free(copy);
+
+    EXPECT_EQ_INT(PARSE_MISS_COLON, parse_tape(t, "{\"a\"}", 5));
+}
+
+struct CountingHeap {
+    size_t calls;
+    size_t live;
+};
+
+static void *counting_malloc(void *user, size_t size) {
+    auto *h = (CountingHeap *) user;
+    h->calls++;
+    h->live += size;
+    return malloc(size);
+}
+
+static void *counting_realloc(void *user, void *p, size_t old_size, size_t new_size) {
+    auto *h = (CountingHeap *) user;
+    h->calls++;
+    h->live += new_size - old_size;
+    return realloc(p, new_size);
+}
+
+static void counting_free(void *user, void *p, size_t size) {
+    ((CountingHeap *) user)->live -= size;
+    free(p);
+}
+
+static void test_allocator() {
+    CountingHeap heap{0, 0};
+    Allocator alloc{counting_malloc, counting_realloc, counting_free, &heap};
+    const char *json = "{\"n\":null,\"s\":\"abc\",\"a\":[1,2,{\"x\":[]}],\"o\":{\"k\":\"v\"}}";
+
+    Value v;
+    ParseOptions opt;
+    opt.alloc = &alloc;
+    EXPECT_EQ_INT(PARSE_OK, parse(v, json, strlen(json), opt));
+    EXPECT_EQ_INT(1, heap.calls > 0);
+    size_t len;
+    char *out = stringify(v, len, &alloc);
+    EXPECT_EQ_STRING(json, out);
+    alloc.free_fn(alloc.user, out, len + 1);
+    char *bin = encode_binary(v, len, &alloc);
+    value_free(v, &alloc);
+    EXPECT_EQ_INT(PARSE_OK, decode_binary(v, bin, len, &alloc));
+    alloc.free_fn(alloc.user, bin, len);
+    set_string(*get_object_value(v, 1), "abcdef", 6, &alloc);
+    set_number(*get_object_value(v, 2), 1.0, &alloc);
+    value_free(v, &alloc);
+    EXPECT_EQ_SIZE_T(0, heap.live);
+
+    // 出错路径上释放的大小也要和申请时一致
+    EXPECT_EQ_INT(PARSE_MISS_COMMA_OR_CURLY_BRACKET, parse(v, "{\"a\":[\"x\"],\"b\":1 2}", 18, opt));
+    EXPECT_EQ_SIZE_T(0, heap.live);
+
+    Parser p;
+    parser_init(p);
+    p.opt.alloc = &alloc;
+    EXPECT_EQ_INT(PARSE_OK, parse(p, v, json));
+    value_free(v, &alloc);
+    parser_free(p);
+    EXPECT_EQ_SIZE_T(0, heap.live);
+
+    // NDJSON 的 arena 只向分配器申请大块，结束时全部归还
+    std::string lines;
+    for (int i = 0; i < 2000; i++)
+        lines += "{\"n\":1,\"s\":\"abc\",\"a\":[1,2,{\"x\":[]}],\"o\":{\"k\":\"v\"}}\n";
+    heap.calls = 0;
+    NdjsonOptions nd;
+    nd.threads = 1;
+    nd.arena = true;
+    nd.parse.alloc = &alloc;
+    NdjsonSum s{0, 0, true, 0.0};
+    EXPECT_EQ_INT(PARSE_OK, parse_ndjson(lines.c_str(), lines.size(), ndjson_sum, &s, nd));
+    EXPECT_EQ_SIZE_T(2000, s.count);
+    EXPECT_EQ_DOUBLE(2000.0, s.sum);
+    EXPECT_EQ_INT(1, heap.calls < 100);
+    EXPECT_EQ_SIZE_T(0, heap.live);
+}
+
+static void test_key_table() {
+    KeyTable *keys = key_table_create();
+    ParseOptions opt;
+    opt.keys = keys;
+    const char *json = "{\"id\":1,\"name\":\"a\",\"tags\":{\"id\":2}}";
+    Value a, b;
+    EXPECT_EQ_INT(PARSE_OK, parse(a, json, strlen(json), opt));
+    EXPECT_EQ_INT(PARSE_OK, parse(b, json, strlen(json), opt));
+    EXPECT_EQ_SIZE_T(3, key_table_size(keys));
+    EXPECT_EQ_INT(1, get_object_key(a, 0) == get_object_key(b, 0));
+    EXPECT_EQ_INT(1, get_object_key(a, 0) == get_object_key(*get_object_value(a, 2), 0));
+
+    const char *name = key_table_intern(keys, "name", 4);
+    EXPECT_EQ_SIZE_T(1, find_interned_object_index(b, name));
+    EXPECT_EQ_SIZE_T(2, find_object_index(b, "tags", 4));
+    EXPECT_EQ_SIZE_T(KEY_NOT_EXIST, find_object_index(b, "tag", 3));
+    EXPECT_EQ_DOUBLE(1.0, get_number(*find_object_value(b, "id", 2)));
+    EXPECT_EQ_INT(1, find_object_value(b, "x", 1) == NULL);
+    value_free(b);
+
+    EXPECT_EQ_INT(PARSE_MISS_COLON, parse(b, "{\"id\":1,\"x\"}", 13, opt));
+    value_free(a);
+
+    // 空键在栈还没分配时就被驻留，第二次遇到要命中同一项
+    EXPECT_EQ_INT(PARSE_OK, parse(a, "{\"\":1,\"\":2}", 11, opt));
+    EXPECT_EQ_INT(1, get_object_key(a, 0) == get_object_key(a, 1));
+    EXPECT_EQ_SIZE_T(5, key_table_size(keys));
+    value_free(a);
+    key_table_free(keys);
+
+    // 多个线程共用一个键表
+    keys = key_table_create(true);
+    std::string many;
+    for (int i = 0; i < 5000; i++)
+        many += "{\"k" + std::to_string(i % 100) + "\":1}\n";
+    NdjsonOptions nd;
+    nd.threads = 4;
+    nd.parse.keys = keys;
+    NdjsonSum sum{0, 0, true, 0.0};
+    EXPECT_EQ_INT(PARSE_OK, parse_ndjson(many.c_str(), many.size(), ndjson_sum, &sum, nd));
+    EXPECT_EQ_SIZE_T(100, key_table_size(keys));
+    key_table_free(keys);
+}
+
+static void test_cxx_wrapper() {
+    Json j;
+    EXPECT_EQ_INT(PARSE_OK, j.parse("{\"a\":[1,2,3],\"s\":\"abc\",\"o\":{\"t\":true},\"n\":null}"));
+    EXPECT_EQ_INT(OBJECT, j.type());
+    EXPECT_EQ_SIZE_T(4, j.size());
+
+    double sum = 0;
+    for (JsonView e: j["a"].elements())
+        sum += e.number();
+    EXPECT_EQ_DOUBLE(6.0, sum);
+    EXPECT_EQ_DOUBLE(2.0, j["a"][1].number());
+    EXPECT_EQ_INT(1, j["s"].str() == "abc");
+    EXPECT_EQ_INT(1, j["o"]["t"].boolean());
+    EXPECT_EQ_INT(1, j["n"].is_null());
+    EXPECT_EQ_INT(0, (bool) j["missing"]);
+
+    std::string keys;
+    for (MemberView m: j.members())
+        keys += m.key;
+    EXPECT_EQ_STRING("ason", keys.c_str());
+
+    Json moved(std::move(j));
+    EXPECT_EQ_INT(NUL, j.type());
+    EXPECT_EQ_INT(OBJECT, moved.type());
+    j = std::move(moved);
+    EXPECT_EQ_STRING("{\"a\":[1,2,3],\"s\":\"abc\",\"o\":{\"t\":true},\"n\":null}", j.dump().c_str());
+
+    EXPECT_EQ_INT(PARSE_MISS_COLON, j.parse("{\"a\"}"));
+    EXPECT_EQ_INT(NUL, j.type());
+
+    Json s("text");
+    EXPECT_EQ_INT(STRING, s.type());
+    EXPECT_EQ_INT(1, s.view().str() == "text");
+    EXPECT_EQ_DOUBLE(1.5, Json(1.5).view().number());
+
+    Value raw = s.release();
+    Json adopted = Json::adopt(raw);
+    EXPECT_EQ_INT(NUL, raw.type);
+    EXPECT_EQ_INT(1, adopted.view().str() == "text");
+}
+
+static void test_reader() {
+    const char json[] = " {\"n\":[1, 2.5, -3], \"s\":\"a\\tb\", \"skip\":{\"x\":[true,null]}, \"b\":false} ";
+    Reader r;
+    reader_init(r, json, sizeof(json) - 1);
+    EXPECT_EQ_INT(PARSE_OK, reader_begin_object(r));
+    bool more;
+    const char *k;
+    size_t klen;
+    double sum = 0.0;
+    std::string s;
+    bool b = true;
+    while (reader_next_member(r, more, k, klen) == PARSE_OK && more) {
+        std::string key(k, klen);
+        if (key == "n") {
+            double d;
+            EXPECT_EQ_INT(PARSE_OK, reader_begin_array(r));
+            while (reader_next_element(r, more) == PARSE_OK && more) {
+                EXPECT_EQ_INT(PARSE_OK, reader_number(r, d));
+                sum += d;
+            }
+        } else if (key == "s") {
+            const char *str;
+            size_t len;
+            EXPECT_EQ_INT(PARSE_OK, reader_string(r, str, len));
+            s.assign(str, len);
+        } else if (key == "b") {
+            EXPECT_EQ_INT(PARSE_OK, reader_bool(r, b));
+        } else {
+            EXPECT_EQ_INT(PARSE_OK, reader_skip(r));
+        }
+    }
+    EXPECT_EQ_INT(PARSE_OK, reader_end(r));
+    EXPECT_EQ_DOUBLE(0.5, sum);
+    EXPECT_EQ_STRING("a\tb", s.c_str());
+    EXPECT_EQ_INT(0, b);
+    reader_free(r);
+
+    reader_init(r, "[1,\"x\"]", 7);
+    double d;
+    EXPECT_EQ_INT(PARSE_OK, reader_begin_array(r));
+    EXPECT_EQ_INT(PARSE_OK, reader_next_element(r, more));
+    EXPECT_EQ_INT(PARSE_OK, reader_number(r, d));
+    EXPECT_EQ_INT(PARSE_OK, reader_next_element(r, more));
+    EXPECT_EQ_INT(PARSE_TYPE_MISMATCH, reader_number(r, d));
+    reader_free(r);
+
+    // 跳过的子树不建值树也不复制字符串，一次分配都没有
+    std::string big = "[";
+    for (int i = 0; i < 1000; i++)
+        big += "{\"key\\u00e9\":[\"a long string value\\n\",1.5e3,true,null,{}],\"k\":\"\\ud83d\\ude00\"},";
+    big += "[]] 7";
+    CountingHeap heap{0, 0};
+    Allocator alloc{counting_malloc, counting_realloc, counting_free, &heap};
+    reader_init(r, big.data(), big.size(), &alloc);
+    EXPECT_EQ_INT(PARSE_OK, reader_skip(r));
+    EXPECT_EQ_SIZE_T(0, heap.calls);
+    EXPECT_EQ_INT(PARSE_OK, reader_number(r, d));
+    EXPECT_EQ_DOUBLE(7.0, d);
+    reader_free(r);
+
+    // 数字紧贴输入末尾或后面跟着 x 时，reader_number 要在栈上补 '\0'，跳过时不需要
+    const char *numbers[] = {"123", "0x", "-1.5e3", "[1,2.5]"};
+    heap.calls = 0;
+    for (const char *json : numbers) {
+        reader_init(r, json, strlen(json), &alloc);
+        EXPECT_EQ_INT(PARSE_OK, reader_skip(r));
+        EXPECT_EQ_SIZE_T(0, heap.calls);
+        reader_free(r);
+    }
+
+    // 出错时和 reader_value 给出同样的错误码
+    const char *bad[] = {"[1,]", "{\"a\" 1}", "{1:2}", "[1 2]", "{\"a\":1 \"b\":2}", "\"\\x\"", "\"\\ud800\"",
+                         "\"\\u12\"", "\"a", "\"\x01\"", "[tru]", "[01]", "'a'", "", "-", "1.", "1e+", "-x"};
+    for (const char *json : bad) {
+        Value v;
+        reader_init(r, json, strlen(json));
+        int expect = reader_value(r, v);
+        value_free(v);
+        reader_free(r);
+        reader_init(r, json, strlen(json));
+        EXPECT_EQ_INT(expect, reader_skip(r));
+        reader_free(r);
+    }
+}
+
+namespace bind_test {
+    struct Inner {
+        int id;
+        std::optional<std::string> tag;
+    };
+    TINY_JSON_BIND(Inner, id, tag)
+
+    struct Outer {
+        std::string name;
+        double score;
+        bool ok;
+        std::vector<Inner> items;
+        std::vector<std::vector<int>> grid;
+    };
+    TINY_JSON_BIND(Outer, name, score, ok, items, grid)
+}
+
+static void test_bind() {
+    using bind_test::Outer;
+    Outer o{};
+    const char json[] = "{\"name\":\"n\\\"1\",\"extra\":{\"deep\":[1,{}]},\"score\":2.5,\"ok\":true,"
+                        "\"items\":[{\"id\":7,\"tag\":\"t\"},{\"id\":8,\"tag\":null}],\"grid\":[[1,2],[],[3]]}";
+    EXPECT_EQ_INT(PARSE_OK, from_json(o, json));
+    EXPECT_EQ_STRING("n\"1", o.name.c_str());
+    EXPECT_EQ_DOUBLE(2.5, o.score);
+    EXPECT_EQ_INT(1, o.ok);
+    EXPECT_EQ_SIZE_T(2, o.items.size());
+    EXPECT_EQ_INT(7, o.items[0].id);
+    EXPECT_EQ_STRING("t", o.items[0].tag->c_str());
+    EXPECT_EQ_INT(0, o.items[1].tag.has_value());
+    EXPECT_EQ_SIZE_T(3, o.grid.size());
+    EXPECT_EQ_INT(3, o.grid[2][0]);
+
+    std::string out = to_json(o);
+    EXPECT_EQ_STRING("{\"name\":\"n\\\"1\",\"score\":2.5,\"ok\":true,"
+                     "\"items\":[{\"id\":7,\"tag\":\"t\"},{\"id\":8,\"tag\":null}],\"grid\":[[1,2],[],[3]]}",
+                     out.c_str());
+    Outer back{};
+    EXPECT_EQ_INT(PARSE_OK, from_json(back, out));
+    EXPECT_EQ_STRING(out.c_str(), to_json(back).c_str());
+
+    EXPECT_EQ_INT(PARSE_TYPE_MISMATCH, from_json(back, "{\"score\":\"x\"}"));
+    EXPECT_EQ_INT(PARSE_TYPE_MISMATCH, from_json(back, "[]"));
+    EXPECT_EQ_INT(PARSE_ROOT_NOT_SINGULAR, from_json(back, "{} x"));
+    EXPECT_EQ_INT(PARSE_MISS_COLON, from_json(back, "{\"name\" 1}"));
+
+    // 超出范围或不是整数的数字不能读进整数字段
+    unsigned char u8 = 7;
+    EXPECT_EQ_INT(PARSE_OK, from_json(u8, "255"));
+    EXPECT_EQ_INT(255, u8);
+    EXPECT_EQ_INT(PARSE_TYPE_MISMATCH, from_json(u8, "256"));
+    EXPECT_EQ_INT(PARSE_TYPE_MISMATCH, from_json(u8, "-1"));
+    EXPECT_EQ_INT(PARSE_TYPE_MISMATCH, from_json(u8, "1.5"));
+    EXPECT_EQ_INT(PARSE_TYPE_MISMATCH, from_json(u8, "1e300"));
+    EXPECT_EQ_INT(255, u8);
+    long long i64 = 0;
+    EXPECT_EQ_INT(PARSE_OK, from_json(i64, "-9223372036854775808"));
+    EXPECT_EQ_INT(1, i64 == std::numeric_limits<long long>::min());
+    EXPECT_EQ_INT(PARSE_TYPE_MISMATCH, from_json(i64, "9223372036854775808"));
+    EXPECT_EQ_INT(PARSE_OK, from_json(i64, "-0"));
+    EXPECT_EQ_INT(1, i64 == 0);
+    float f = 0;
+    EXPECT_EQ_INT(PARSE_TYPE_MISMATCH, from_json(f, "1e300"));
+    EXPECT_EQ_INT(PARSE_OK, from_json(f, "0.5"));
+    EXPECT_EQ_DOUBLE(0.5, (double) f);
+    EXPECT_EQ_INT(PARSE_TYPE_MISMATCH, from_json(back, "{\"items\":[{\"id\":2.5}]}"));
+}
+
+static void test_writer() {
+    Writer w;
+    writer_init(w);
+    writer_start_object(w);
+    writer_key(w, "n", 1);
+    writer_number(w, 1.5);
+    writer_key(w, "s\n", 2);
+    writer_string(w, "a\"\x01", 3);
+    writer_key(w, "a", 1);
+    writer_start_array(w);
+    writer_null(w);
+    writer_bool(w, true);
+    writer_bool(w, false);
+    writer_start_object(w);
+    writer_end_object(w);
+    writer_start_array(w);
+    writer_end_array(w);
+    writer_end_array(w);
+    writer_key(w, "", 0);
+    Value v;
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "{\"x\":[1,\"y\"]}"));
+    writer_value(w, v);
+    value_free(v);
+    writer_end_object(w);
+    size_t len;
+    char *json = writer_finish(w, len);
+    EXPECT_EQ_STRING("{\"n\":1.5,\"s\\n\":\"a\\\"\\u0001\",\"a\":[null,true,false,{},[]],\"\":{\"x\":[1,\"y\"]}}", json);
+    EXPECT_EQ_SIZE_T(strlen(json), len);
+    free(json);
+
+    // finish 之后和 clear 之后都可以继续使用
+    writer_number(w, -0.0);
+    const char *data = writer_data(w, len);
+    EXPECT_EQ_STRING("-0", std::string(data, len).c_str());
+    writer_clear(w);
+    writer_start_array(w);
+    writer_string(w, "x", 1);
+    writer_end_array(w);
+    data = writer_data(w, len);
+    EXPECT_EQ_STRING("[\"x\"]", std::string(data, len).c_str());
+    writer_free(w);
+
+    StringifyOptions opt;
+    opt.ascii = true;
+    writer_init(w, opt);
+    writer_string(w, "\xc3\xa9", 2);
+    json = writer_finish(w, len);
+    EXPECT_EQ_STRING("\"\\u00E9\"", json);
+    free(json);
+    writer_free(w);
+}
+
+static int schema_check(const Schema *s, const char *json) {
+    Value v;
+    init(v);
+    int ret = parse(v, json);
+    if (ret == PARSE_OK) ret = schema_validate(s, v);
+    value_free(v);
+    return ret;
+}
+
+// 值树校验和流式校验必须给出相同的结果
+#define TEST_SCHEMA(expect, s, json) \
+    do {\
+        EXPECT_EQ_INT(expect, schema_check(s, json));\
+        EXPECT_EQ_INT(expect, schema_validate(s, json, strlen(json)));\
+    } while(0)
+
+static void test_schema() {
+    const char doc[] =
+            "{\"type\":\"object\",\"required\":[\"id\",\"name\"],\"additionalProperties\":false,"
+            "\"properties\":{"
+            "\"id\":{\"type\":\"integer\",\"minimum\":1},"
+            "\"name\":{\"type\":\"string\",\"minLength\":1,\"maxLength\":4},"
+            "\"score\":{\"type\":[\"number\",\"null\"],\"exclusiveMaximum\":100},"
+            "\"level\":{\"enum\":[\"low\",\"high\",[1,{\"a\":null}]]},"
+            "\"tags\":{\"type\":\"array\",\"maxItems\":2,\"items\":{\"type\":\"string\"}},"
+            "\"meta\":{}}}";
+    Value v;
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, doc));
+    Schema *s;
+    EXPECT_EQ_INT(PARSE_OK, schema_compile(s, v));
+    value_free(v);
+
+    TEST_SCHEMA(PARSE_OK, s, "{\"id\":1,\"name\":\"ab\"}");
+    TEST_SCHEMA(PARSE_OK, s, "{\"name\":\"\xE4\xB8\xAD\xE6\x96\x87\xE5\xAD\x97\xE7\xAC\xA6\",\"id\":2.0,\"score\":null,"
+                             "\"level\":[1,{\"a\":null}],\"tags\":[\"x\",\"y\"],\"meta\":{\"any\":[true]}}");
+    TEST_SCHEMA(SCHEMA_TYPE, s, "[]");
+    TEST_SCHEMA(SCHEMA_TYPE, s, "{\"id\":1.5,\"name\":\"a\"}");
+    TEST_SCHEMA(SCHEMA_TYPE, s, "{\"id\":1,\"name\":\"a\",\"tags\":[1]}");
+    TEST_SCHEMA(SCHEMA_REQUIRED, s, "{\"id\":1}");
+    TEST_SCHEMA(SCHEMA_REQUIRED, s, "{\"id\":1,\"id\":2}");
+    TEST_SCHEMA(SCHEMA_ADDITIONAL, s, "{\"id\":1,\"name\":\"a\",\"x\":0}");
+    TEST_SCHEMA(SCHEMA_RANGE, s, "{\"id\":0,\"name\":\"a\"}");
+    TEST_SCHEMA(SCHEMA_RANGE, s, "{\"id\":1,\"name\":\"a\",\"score\":100}");
+    TEST_SCHEMA(SCHEMA_LENGTH, s, "{\"id\":1,\"name\":\"\"}");
+    TEST_SCHEMA(SCHEMA_LENGTH, s, "{\"id\":1,\"name\":\"abcde\"}");
+    TEST_SCHEMA(SCHEMA_LENGTH, s, "{\"id\":1,\"name\":\"a\",\"tags\":[\"a\",\"b\",\"c\"]}");
+    TEST_SCHEMA(SCHEMA_ENUM, s, "{\"id\":1,\"name\":\"a\",\"level\":\"mid\"}");
+    TEST_SCHEMA(SCHEMA_ENUM, s, "{\"id\":1,\"name\":\"a\",\"level\":[1,{}]}");
+
+    // 流式校验在第一个不满足的约束处停下，后面的输入不合法也不影响结果
+    const char early[] = "{\"id\":\"x\", ???";
+    EXPECT_EQ_INT(SCHEMA_TYPE, schema_validate(s, early, sizeof(early) - 1));
+    const char bad[] = "{\"id\":1,\"name\":\"a\" ???";
+    EXPECT_EQ_INT(PARSE_MISS_COMMA_OR_CURLY_BRACKET, schema_validate(s, bad, sizeof(bad) - 1));
+    EXPECT_EQ_INT(PARSE_INVALID_VALUE, schema_validate(s, "{\"id\":?}", 8));
+    EXPECT_EQ_INT(PARSE_ROOT_NOT_SINGULAR, schema_validate(s, "{\"id\":1,\"name\":\"a\"} 1", 22));
+    // 不受约束的子树按词法跳过，语法错误照样报告
+    const char skipped[] = "{\"id\":1,\"name\":\"a\",\"meta\":{\"x\":[1,{\"y\" 2}]}}";
+    EXPECT_EQ_INT(PARSE_MISS_COLON, schema_validate(s, skipped, sizeof(skipped) - 1));
+    schema_free(s);
+
+    // 包含和排除的上下界分别检查，const 和 enum 同时出现时都要满足；超出 size_t 的长度等同于不限制
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "{\"exclusiveMinimum\":0,\"minimum\":-5,\"maximum\":10,\"exclusiveMaximum\":20,"
+                                     "\"const\":\"a\",\"enum\":[\"a\",\"b\",1,10,0],"
+                                     "\"maxLength\":1e30}"));
+    EXPECT_EQ_INT(PARSE_OK, schema_compile(s, v));
+    value_free(v);
+    TEST_SCHEMA(PARSE_OK, s, "\"a\"");
+    TEST_SCHEMA(SCHEMA_ENUM, s, "\"b\"");
+    TEST_SCHEMA(SCHEMA_ENUM, s, "1");
+    schema_free(s);
+
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "{\"exclusiveMinimum\":0,\"minimum\":-5,\"maximum\":10,\"exclusiveMaximum\":20,"
+                                     "\"maxItems\":1e300}"));
+    EXPECT_EQ_INT(PARSE_OK, schema_compile(s, v));
+    value_free(v);
+    TEST_SCHEMA(PARSE_OK, s, "10");
+    TEST_SCHEMA(PARSE_OK, s, "0.5");
+    TEST_SCHEMA(SCHEMA_RANGE, s, "0");
+    TEST_SCHEMA(SCHEMA_RANGE, s, "-1");
+    TEST_SCHEMA(SCHEMA_RANGE, s, "11");
+    TEST_SCHEMA(PARSE_OK, s, "[1,2,3]");
+    schema_free(s);
+
+    // 空模式接受任何值，false 拒绝任何值
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "{\"items\":false,\"minItems\":1}"));
+    EXPECT_EQ_INT(PARSE_OK, schema_compile(s, v));
+    value_free(v);
+    TEST_SCHEMA(PARSE_OK, s, "\"any\"");
+    TEST_SCHEMA(SCHEMA_LENGTH, s, "[]");
+    TEST_SCHEMA(SCHEMA_TYPE, s, "[null]");
+    schema_free(s);
+
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "{}"));
+    EXPECT_EQ_INT(PARSE_OK, schema_compile(s, v));
+    value_free(v);
+    TEST_SCHEMA(PARSE_OK, s, "[1,{\"a\":\"b\"}]");
+    schema_free(s);
+
+    const char *invalid[] = {"1", "{\"type\":\"float\"}", "{\"minLength\":-1}", "{\"required\":[1]}",
+                             "{\"properties\":{\"a\":1}}", "{\"enum\":1}", "{\"items\":{\"maximum\":\"1\"}}"};
+    for (const char *json: invalid) {
+        init(v);
+        EXPECT_EQ_INT(PARSE_OK, parse(v, json));
+        EXPECT_EQ_INT(SCHEMA_INVALID, schema_compile(s, v));
+        EXPECT_EQ_INT(1, s == NULL);
+        value_free(v);
+    }
+}
+
+static void test_mutation() {
+    Value v, c;
+    init(v);
+    init(c);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "{\"a\":[1,2],\"b~/c\":{\"d\":\"x\"}}"));
+    EXPECT_EQ_DOUBLE(2.0, get_number(*find_pointer(v, "/a/1", 4)));
+    EXPECT_EQ_STRING("x", get_string(*find_pointer(v, "/b~0~1c/d", 9)));
+    EXPECT_EQ_INT(1, find_pointer(v, "", 0) == &v);
+    EXPECT_EQ_INT(1, find_pointer(v, "/a/01", 5) == NULL);
+    EXPECT_EQ_INT(1, find_pointer(v, "/a/2", 4) == NULL);
+    EXPECT_EQ_INT(1, find_pointer(v, "a", 1) == NULL);
+
+    value_copy(c, v);
+    EXPECT_EQ_INT(1, value_equal(c, v));
+    Value *a = find_object_value(c, "a", 1);
+    set_number(*array_insert(*a, 0), 0.0);
+    set_string(*array_insert(*a, 3), "end", 3);
+    array_erase(*a, 1);
+    EXPECT_EQ_INT(0, value_equal(c, v));
+    set_boolean(*object_set(c, "e", 1), true);
+    EXPECT_EQ_INT(1, object_remove(c, "b~/c", 4));
+    EXPECT_EQ_INT(0, object_remove(c, "b~/c", 4));
+    size_t len;
+    char *json = stringify(c, len);
+    EXPECT_EQ_STRING("{\"a\":[0,2,\"end\"],\"e\":true}", json);
+    free(json);
+    // object_set 可能让成员块搬迁，之前取得的指针失效
+    a = find_object_value(c, "a", 1);
+    array_erase(*a, 0);
+    array_erase(*a, 0);
+    array_erase(*a, 0);
+    EXPECT_EQ_SIZE_T(0, get_array_size(*a));
+    value_free(c);
+
+    init(c);
+    EXPECT_EQ_INT(PARSE_OK, parse(c, "{\"b~/c\":{\"d\":\"x\"},\"a\":[1,2]}"));
+    EXPECT_EQ_INT(1, value_equal(c, v));
+    value_free(c);
+    value_free(v);
+
+    // 重复的键按位置对应，空键在第一个成员时也要能解析
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "{\"\":1,\"k\":1,\"k\":2}"));
+    EXPECT_EQ_INT(PARSE_OK, parse(c, "{\"\":1,\"k\":1,\"k\":2}"));
+    EXPECT_EQ_INT(1, value_equal(c, v));
+    value_free(c);
+    value_free(v);
+}
+
+#define TEST_PATCH(expect, json, patch, result)\
+    do {\
+        Value v, p;\
+        char* json2;\
+        size_t length;\
+        init(v);\
+        init(p);\
+        EXPECT_EQ_INT(PARSE_OK, parse(v, json));\
+        EXPECT_EQ_INT(PARSE_OK, parse(p, patch));\
+        EXPECT_EQ_INT(expect, apply_patch(v, p));\
+        json2 = stringify(v, length);\
+        EXPECT_EQ_STRING(result, json2);\
+        value_free(v);\
+        value_free(p);\
+        free(json2);\
+    } while(0)
+
+#define TEST_MERGE_PATCH(json, patch, result)\
+    do {\
+        Value v, p;\
+        char* json2;\
+        size_t length;\
+        init(v);\
+        init(p);\
+        EXPECT_EQ_INT(PARSE_OK, parse(v, json));\
+        EXPECT_EQ_INT(PARSE_OK, parse(p, patch));\
+        apply_merge_patch(v, p);\
+        json2 = stringify(v, length);\
+        EXPECT_EQ_STRING(result, json2);\
+        value_free(v);\
+        value_free(p);\
+        free(json2);\
+    } while(0)
+
+static void test_patch() {
+    // RFC 6902 附录 A 中的例子
+    TEST_PATCH(PARSE_OK, "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]",
+               "{\"foo\":\"bar\",\"baz\":\"qux\"}");
+    TEST_PATCH(PARSE_OK, "{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]",
+               "{\"foo\":[\"bar\",\"qux\",\"baz\"]}");
+    TEST_PATCH(PARSE_OK, "{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"remove\",\"path\":\"/baz\"}]",
+               "{\"foo\":\"bar\"}");
+    TEST_PATCH(PARSE_OK, "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]",
+               "{\"foo\":[\"bar\",\"baz\"]}");
+    TEST_PATCH(PARSE_OK, "{\"baz\":\"qux\",\"foo\":\"bar\"}",
+               "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]", "{\"baz\":\"boo\",\"foo\":\"bar\"}");
+    TEST_PATCH(PARSE_OK, "{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}",
+               "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]",
+               "{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}");
+    TEST_PATCH(PARSE_OK, "{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}",
+               "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]",
+               "{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}");
+    TEST_PATCH(PARSE_OK, "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}",
+               "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"},{\"op\":\"test\",\"path\":\"/foo/1\",\"value\":2}]",
+               "{\"baz\":\"qux\",\"foo\":[\"a\",2,\"c\"]}");
+    TEST_PATCH(PATCH_TEST, "{\"baz\":\"qux\"}", "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]",
+               "{\"baz\":\"qux\"}");
+    TEST_PATCH(PARSE_OK, "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/child\",\"value\":{\"grandchild\":{}}}]",
+               "{\"foo\":\"bar\",\"child\":{\"grandchild\":{}}}");
+    TEST_PATCH(PATCH_PATH, "{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]",
+               "{\"foo\":\"bar\"}");
+    TEST_PATCH(PARSE_OK, "{\"/\":9,\"~1\":10}", "[{\"op\":\"test\",\"path\":\"/~01\",\"value\":10}]",
+               "{\"/\":9,\"~1\":10}");
+    TEST_PATCH(PARSE_OK, "{\"foo\":[\"bar\"]}", "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":[\"abc\",\"def\"]}]",
+               "{\"foo\":[\"bar\",[\"abc\",\"def\"]]}");
+    TEST_PATCH(PARSE_OK, "{\"a\":{\"b\":[1]}}", "[{\"op\":\"copy\",\"from\":\"/a/b\",\"path\":\"/a/c\"},"
+                                               "{\"op\":\"add\",\"path\":\"/a/c/-\",\"value\":2}]",
+               "{\"a\":{\"b\":[1],\"c\":[1,2]}}");
+    TEST_PATCH(PARSE_OK, "1", "[{\"op\":\"replace\",\"path\":\"\",\"value\":[true]}]", "[true]");
+    TEST_PATCH(PARSE_OK, "[1,2]", "[{\"op\":\"add\",\"path\":\"\",\"value\":null}]", "null");
+
+    TEST_PATCH(PATCH_INVALID, "{}", "{}", "{}");
+    TEST_PATCH(PATCH_INVALID, "{}", "[{\"op\":\"frob\",\"path\":\"\"}]", "{}");
+    TEST_PATCH(PATCH_INVALID, "{}", "[{\"op\":\"add\",\"path\":\"a\",\"value\":1}]", "{}");
+    TEST_PATCH(PATCH_INVALID, "{}", "[{\"op\":\"add\",\"path\":\"/a\"}]", "{}");
+    TEST_PATCH(PATCH_INVALID, "{\"a\":{}}", "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/b\"}]", "{\"a\":{}}");
+    // 不合法的 ~ 转义
+    TEST_PATCH(PATCH_INVALID, "{}", "[{\"op\":\"add\",\"path\":\"/~~~\",\"value\":1}]", "{}");
+    TEST_PATCH(PATCH_INVALID, "{}", "[{\"op\":\"add\",\"path\":\"/~2\",\"value\":1}]", "{}");
+    TEST_PATCH(PATCH_INVALID, "{}", "[{\"op\":\"add\",\"path\":\"/a~\",\"value\":1}]", "{}");
+    TEST_PATCH(PATCH_INVALID, "{\"a\":1}", "[{\"op\":\"test\",\"path\":\"/~\",\"value\":1}]", "{\"a\":1}");
+    TEST_PATCH(PATCH_INVALID, "{\"a\":1}", "[{\"op\":\"copy\",\"from\":\"/~x\",\"path\":\"/b\"}]", "{\"a\":1}");
+    TEST_PATCH(PARSE_OK, "{}", "[{\"op\":\"add\",\"path\":\"/~0~1\",\"value\":1}]", "{\"~/\":1}");
+    TEST_PATCH(PATCH_PATH, "[1]", "[{\"op\":\"remove\",\"path\":\"/1\"}]", "[1]");
+    TEST_PATCH(PATCH_PATH, "[1]", "[{\"op\":\"add\",\"path\":\"/2\",\"value\":0}]", "[1]");
+    TEST_PATCH(PATCH_PATH, "[1]", "[{\"op\":\"replace\",\"path\":\"/-\",\"value\":0}]", "[1]");
+
+    // 失败时之前的所有操作都被撤销，成员顺序也恢复原样
+    TEST_PATCH(PATCH_TEST,
+               "{\"a\":[1,2,3],\"b\":{\"x\":1,\"y\":2},\"c\":\"s\"}",
+               "[{\"op\":\"remove\",\"path\":\"/a/0\"},"
+               "{\"op\":\"add\",\"path\":\"/a/0\",\"value\":{\"n\":[9]}},"
+               "{\"op\":\"move\",\"from\":\"/b/x\",\"path\":\"/a/0/n/0\"},"
+               "{\"op\":\"move\",\"from\":\"/c\",\"path\":\"/b/y\"},"
+               "{\"op\":\"replace\",\"path\":\"/a/1\",\"value\":\"r\"},"
+               "{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/d\"},"
+               "{\"op\":\"remove\",\"path\":\"/b\"},"
+               "{\"op\":\"replace\",\"path\":\"\",\"value\":[]},"
+               "{\"op\":\"test\",\"path\":\"\",\"value\":{}}]",
+               "{\"a\":[1,2,3],\"b\":{\"x\":1,\"y\":2},\"c\":\"s\"}");
+    TEST_PATCH(PATCH_PATH, "{\"a\":[1],\"b\":{}}",
+               "[{\"op\":\"add\",\"path\":\"/b/k\",\"value\":1},{\"op\":\"move\",\"from\":\"/a/0\",\"path\":\"/z/0\"}]",
+               "{\"a\":[1],\"b\":{}}");
+
+    // RFC 7396 附录 A 中的例子
+    TEST_MERGE_PATCH("{\"a\":\"b\"}", "{\"a\":\"c\"}", "{\"a\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":\"b\"}", "{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":\"b\"}", "{\"a\":null}", "{}");
+    TEST_MERGE_PATCH("{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}", "{\"b\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":\"c\"}");
+    TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":[\"b\"]}");
+    TEST_MERGE_PATCH("{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}", "{\"a\":{\"b\":\"d\"}}");
+    TEST_MERGE_PATCH("{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}", "{\"a\":[1]}");
+    TEST_MERGE_PATCH("[\"a\",\"b\"]", "[\"c\",\"d\"]", "[\"c\",\"d\"]");
+    TEST_MERGE_PATCH("{\"a\":\"b\"}", "[\"c\"]", "[\"c\"]");
+    TEST_MERGE_PATCH("{\"a\":\"foo\"}", "null", "null");
+    TEST_MERGE_PATCH("{\"e\":null}", "{\"a\":1}", "{\"e\":null,\"a\":1}");
+    TEST_MERGE_PATCH("[1,2]", "{\"a\":\"b\",\"c\":null}", "{\"a\":\"b\"}");
+    TEST_MERGE_PATCH("{}", "{\"a\":{\"bb\":{\"ccc\":null}}}", "{\"a\":{\"bb\":{}}}");
+}
+
+// diff 的结果应用到 a 上必须得到 b，返回补丁的文本
+static std::string diff_roundtrip(const char *a_json, const char *b_json) {
+    Value a, b, p;
+    size_t length;
+    init(a);
+    init(b);
+    init(p);
+    EXPECT_EQ_INT(PARSE_OK, parse(a, a_json));
+    EXPECT_EQ_INT(PARSE_OK, parse(b, b_json));
+    diff(p, a, b);
+    char *json = stringify(p, length);
+    std::string ret(json, length);
+    free(json);
+    EXPECT_EQ_INT(PARSE_OK, apply_patch(a, p));
+    EXPECT_EQ_INT(1, value_equal(a, b));
+    value_free(a);
+    value_free(b);
+    value_free(p);
+    return ret;
+}
+
+#define TEST_DIFF(a, b, expect) EXPECT_EQ_STRING(expect, diff_roundtrip(a, b).c_str())
+
+static void test_diff() {
+    TEST_DIFF("{\"a\":[1,{\"b\":\"c\"}],\"d\":null}", "{\"d\":null,\"a\":[1,{\"b\":\"c\"}]}", "[]");
+    TEST_DIFF("{\"a\":1,\"b\":2}", "{\"b\":2,\"a\":3}", "[{\"op\":\"replace\",\"path\":\"/a\",\"value\":3}]");
+    TEST_DIFF("{\"a\":1,\"b\":2}", "{\"b\":2,\"c\":[true]}",
+              "[{\"op\":\"remove\",\"path\":\"/a\"},{\"op\":\"add\",\"path\":\"/c\",\"value\":[true]}]");
+    TEST_DIFF("{\"a/b~\":{\"x\":1}}", "{\"a/b~\":{\"x\":2}}",
+              "[{\"op\":\"replace\",\"path\":\"/a~1b~0/x\",\"value\":2}]");
+    TEST_DIFF("[1,2,3]", "[1,9,2,3]", "[{\"op\":\"add\",\"path\":\"/1\",\"value\":9}]");
+    TEST_DIFF("[1,2,3,4]", "[1,4]", "[{\"op\":\"remove\",\"path\":\"/1\"},{\"op\":\"remove\",\"path\":\"/1\"}]");
+    TEST_DIFF("[{\"id\":1,\"v\":\"a\"},{\"id\":2,\"v\":\"b\"}]", "[{\"id\":1,\"v\":\"a\"},{\"id\":2,\"v\":\"B\"}]",
+              "[{\"op\":\"replace\",\"path\":\"/1/v\",\"value\":\"B\"}]");
+    // 中间部分 2x2，LCS 表有 9 个格子，后面的编辑脚本和嵌套数组的哈希仍要对齐
+    TEST_DIFF("[0,[1,2,3],4,5]", "[0,[1,3,3],6,5]",
+              "[{\"op\":\"replace\",\"path\":\"/1/1\",\"value\":3},{\"op\":\"replace\",\"path\":\"/2\",\"value\":6}]");
+    TEST_DIFF("[0,2,[7,8,9],5]", "[0,[7,8,9],[7,0,9],5]",
+              "[{\"op\":\"remove\",\"path\":\"/1\"},{\"op\":\"add\",\"path\":\"/2\",\"value\":[7,0,9]}]");
+    TEST_DIFF("1", "\"x\"", "[{\"op\":\"replace\",\"path\":\"\",\"value\":\"x\"}]");
+    TEST_DIFF("true", "false", "[{\"op\":\"replace\",\"path\":\"\",\"value\":false}]");
+    TEST_DIFF("[]", "[[],{}]", "[{\"op\":\"add\",\"path\":\"/0\",\"value\":[]},{\"op\":\"add\",\"path\":\"/1\",\"value\":{}}]");
+    diff_roundtrip("[1,2,3,4,5]", "[5,4,3,2,1]");
+    diff_roundtrip("[\"a\",\"b\",\"c\",\"d\",\"e\",\"f\"]", "[\"x\",\"b\",\"d\",\"y\",\"z\",\"f\",\"g\"]");
+    diff_roundtrip("{\"k\":[[1,2],[3,{\"m\":[4]}]],\"s\":\"short\",\"l\":\"a string longer than sixteen\"}",
+                   "{\"k\":[[1],[3,{\"m\":[4,5]}],[]],\"s\":\"a string longer than sixteen\",\"l\":\"short\"}");
+
+    // 大数组中间改动一处，补丁只包含这一处
+    std::string before = "[", after = "[";
+    for (int i = 0; i < 2000; i++) {
+        std::string e = "{\"i\":" + std::to_string(i) + "}";
+        before += (i ? "," : "") + e;
+        after += (i ? "," : "") + (i == 1000 ? std::string("{\"i\":-1}") : e);
+    }
+    before += "]";
+    after += "]";
+    TEST_DIFF(before.c_str(), after.c_str(), "[{\"op\":\"replace\",\"path\":\"/1000/i\",\"value\":-1}]");
+}
+
+static void test_stats() {
+    Value v;
+    init(v);
+    reset_thread_stats();
+    const char json[] = "{\"a\":[1,2,[true,null]],\"s\":\"x\\ny\\t\",\"o\":{}}";
+    EXPECT_EQ_INT(PARSE_OK, parse(v, json));
+    Stats call = last_call_stats();
+    size_t len;
+    char *out = stringify(v, len);
+    free(out);
+    Stats total = thread_stats();
+    value_free(v);
+#ifdef TINY_JSON_STATS
+    EXPECT_EQ_SIZE_T(1, call.calls);
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, call.bytes_parsed);
+    EXPECT_EQ_SIZE_T(0, call.bytes_stringified);
+    EXPECT_EQ_SIZE_T(1, call.nodes[NUL]);
+    EXPECT_EQ_SIZE_T(1, call.nodes[TRUE]);
+    EXPECT_EQ_SIZE_T(2, call.nodes[NUMBER]);
+    EXPECT_EQ_SIZE_T(1, call.nodes[STRING]);
+    EXPECT_EQ_SIZE_T(2, call.nodes[ARRAY]);
+    EXPECT_EQ_SIZE_T(2, call.nodes[OBJECT]);
+    EXPECT_EQ_SIZE_T(2, call.escapes);
+    EXPECT_EQ_SIZE_T(3, call.max_depth);
+    EXPECT_EQ_INT(1, call.alloc_calls > 0);
+    EXPECT_EQ_INT(1, call.stack_peak > 0);
+    EXPECT_EQ_SIZE_T(2, total.calls);
+    EXPECT_EQ_SIZE_T(sizeof(json) - 1, total.bytes_parsed);
+    EXPECT_EQ_SIZE_T(len, total.bytes_stringified);
+    EXPECT_EQ_SIZE_T(4, total.nodes[ARRAY]);
+    EXPECT_EQ_SIZE_T(3, total.max_depth);
+
+    // 嵌套的调用只算一次，栈扩容被计入
+    std::string deep(1000, '[');
+    deep += std::string(1000, ']');
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, deep.c_str()));
+    call = last_call_stats();
+    EXPECT_EQ_SIZE_T(1000, call.max_depth);
+    EXPECT_EQ_SIZE_T(3, thread_stats().calls);
+    value_free(v);
+    reset_thread_stats();
+    EXPECT_EQ_SIZE_T(0, thread_stats().calls);
+
+    // 工作线程上的分块和记录合并进调用线程的这一次调用
+    std::string big = "[";
+    for (int i = 0; i < 20000; i++)
+        big += std::string(i ? "," : "") + "{\"i\":" + std::to_string(i) + ",\"a\":[[\"\\n\"]]}";
+    big += "]";
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, big.c_str(), big.size()));
+    Stats serial = last_call_stats();
+    value_free(v);
+    EXPECT_EQ_INT(PARSE_OK, parse_parallel(v, big.c_str(), big.size(), 4));
+    call = last_call_stats();
+    value_free(v);
+    EXPECT_EQ_SIZE_T(1, call.calls);
+    EXPECT_EQ_SIZE_T(big.size(), call.bytes_parsed);
+    EXPECT_EQ_SIZE_T(serial.nodes[ARRAY], call.nodes[ARRAY]);
+    EXPECT_EQ_SIZE_T(serial.nodes[OBJECT], call.nodes[OBJECT]);
+    EXPECT_EQ_SIZE_T(serial.nodes[NUMBER], call.nodes[NUMBER]);
+    EXPECT_EQ_SIZE_T(serial.escapes, call.escapes);
+    EXPECT_EQ_SIZE_T(serial.max_depth, call.max_depth);
+
+    std::string lines;
+    for (int i = 0; i < 5000; i++)
+        lines += "{\"n\":" + std::to_string(i) + ",\"a\":[1,2,3]}\n";
+    NdjsonOptions nd;
+    nd.threads = 4;
+    nd.ordered = false;
+    NdjsonTotal t{{0}, {0}};
+    EXPECT_EQ_INT(PARSE_OK, parse_ndjson(lines.c_str(), lines.size(), ndjson_total, &t, nd));
+    call = last_call_stats();
+    EXPECT_EQ_SIZE_T(1, call.calls);
+    EXPECT_EQ_SIZE_T(5000, call.nodes[OBJECT]);
+    EXPECT_EQ_SIZE_T(5000 * 4, call.nodes[NUMBER]);
+    EXPECT_EQ_SIZE_T(2, call.max_depth);
+    EXPECT_EQ_SIZE_T(3, thread_stats().calls);
+#else
+    EXPECT_EQ_SIZE_T(0, call.calls);
+    EXPECT_EQ_SIZE_T(0, total.bytes_parsed);
+#endif
 }
 
 static void test_stringify() {
@@ -495,14 +1681,426 @@ static void test_stringify() {
     test_stringify_object();
 }
 
+static void test_kernels() {
+    EXPECT_EQ_INT(1, kernel_supported(KERNEL_SCALAR));
+    EXPECT_EQ_INT(0, set_kernel((Kernel) 100));
+    for (int k = KERNEL_SCALAR; k <= KERNEL_AVX512; k++) {
+        if (!set_kernel((Kernel) k)) continue;
+        EXPECT_EQ_INT(k, active_kernel());
+        // 特殊字节落在一个块内的每个位置，以及不足一块的尾部
+        for (size_t n = 0; n < 80; n++) {
+            Value v;
+            init(v);
+            std::string ws(n, ' '), plain;
+            if (n) ws[n / 2] = '\n';
+            for (size_t i = 0; i < n; i++)
+                plain += "x\xC3\xA9";
+
+            std::string json = ws + "[" + ws + "1" + ws + "]" + ws;
+            EXPECT_EQ_INT(PARSE_OK, parse(v, json.data(), json.size()));
+            EXPECT_EQ_SIZE_T(1, get_array_size(v));
+            value_free(v);
+            json = "1" + ws + '\0' + ws;
+            EXPECT_EQ_INT(PARSE_ROOT_NOT_SINGULAR, parse(v, json.data(), json.size()));
+
+            json = "\"" + plain + "\\t" + plain + "\"";
+            EXPECT_EQ_INT(PARSE_OK, parse(v, json.data(), json.size()));
+            EXPECT_EQ_SIZE_T(6 * n + 1, get_string_length(v));
+            size_t len;
+            char *out = stringify(v, len);
+            EXPECT_EQ_STRING(json.c_str(), out);
+            free(out);
+            value_free(v);
+            json = "\"" + plain + "\x01\"";
+            EXPECT_EQ_INT(PARSE_INVALID_STRING_CHAR, parse(v, json.data(), json.size()));
+            json = "\"" + plain;
+            EXPECT_EQ_INT(PARSE_MISS_QUOTATION_MARK, parse(v, json.data(), json.size()));
+        }
+    }
+    EXPECT_EQ_INT(1, set_kernel(KERNEL_AUTO));
+}
+
+static int parse_utf8(const std::string &s) {
+    ParseOptions opt;
+    opt.validate_utf8 = true;
+    Value v;
+    init(v);
+    std::string json = "\"" + s + "\"";
+    int ret = parse(v, json.data(), json.size(), opt);
+    if (ret == PARSE_OK) {
+        if (s.find('\\') == std::string::npos)
+            EXPECT_EQ_SIZE_T(s.size(), get_string_length(v));
+        value_free(v);
+    }
+    return ret;
+}
+
+static void test_utf8() {
+    const char *valid[] = {"\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\xEF\xBF\xBF", "\xED\x9F\xBF",
+                           "\xEE\x80\x80", "\xF4\x8F\xBF\xBF", "\xC2\x80\xDF\xBF"};
+    const char *invalid[] = {"\x80", "\xBF", "\xC0\x80", "\xC1\xBF", "\xE0\x80\x80", "\xE0\x9F\xBF",
+                             "\xED\xA0\x80", "\xED\xBF\xBF", "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF",
+                             "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xF8\x88\x80\x80\x80", "\xFF",
+                             "\xC3", "\xE2\x82", "\xF0\x9F\x98", "\xC3\xC3\xA9", "\xE2\x82" "a", "\xC3\xA9\x80"};
+    for (int k = KERNEL_SCALAR; k <= KERNEL_AVX512; k++) {
+        if (!set_kernel((Kernel) k)) continue;
+        // 序列落在块内的每个位置、跨越块边界以及紧挨着结尾的引号
+        for (size_t pos = 0; pos < 70; pos++) {
+            for (size_t after: {0, 40}) {
+                std::string before(pos, 'a'), tail(after, 'b');
+                for (const char *s: valid)
+                    EXPECT_EQ_INT(PARSE_OK, parse_utf8(before + s + tail));
+                for (const char *s: invalid)
+                    EXPECT_EQ_INT(PARSE_INVALID_UTF8, parse_utf8(before + s + tail));
+            }
+        }
+        std::string mixed;
+        for (int i = 0; i < 40; i++)
+            mixed += "\xE4\xB8\xAD\xF0\x9F\x98\x80x\xC3\xA9";
+        EXPECT_EQ_INT(PARSE_OK, parse_utf8(mixed));
+        EXPECT_EQ_INT(PARSE_INVALID_UTF8, parse_utf8(mixed + "\xED\xA0\x80" + mixed));
+    }
+    set_kernel(KERNEL_AUTO);
+
+    // 转义和原始字节分段校验，转义两侧的序列互不影响
+    EXPECT_EQ_INT(PARSE_OK, parse_utf8("\xC3\xA9\\n\xC3\xA9\\u00E9"));
+    EXPECT_EQ_INT(PARSE_INVALID_UTF8, parse_utf8("\xC3\\n\xA9"));
+    EXPECT_EQ_INT(PARSE_OK, parse_utf8("\\uD834\\uDD1E"));
+    EXPECT_EQ_INT(PARSE_INVALID_UNICODE_SURROGATE, parse_utf8("\\uDC00"));
+
+    // 默认不检查
+    Value v;
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "\"\xC0\x80\\uDC00\""));
+    value_free(v);
+
+    Parser p;
+    parser_init(p);
+    p.opt.validate_utf8 = true;
+    EXPECT_EQ_INT(PARSE_INVALID_UTF8, parse(p, v, "{\"\xFF\":1}"));
+    EXPECT_EQ_INT(PARSE_INVALID_UTF8, parse(p, v, "[\"ok\",\"\xE2\x82\"]"));
+    EXPECT_EQ_INT(PARSE_OK, parse(p, v, "{\"\xE2\x82\xAC\":\"\xF0\x9F\x98\x80\"}"));
+    value_free(v);
+    parser_free(p);
+}
+
+static std::string stringify_ascii(const Value &v) {
+    StringifyOptions opt;
+    opt.ascii = true;
+    size_t len;
+    char *json = stringify(v, len, opt);
+    std::string ret(json, len);
+    free(json);
+    return ret;
+}
+
+#define TEST_STRINGIFY_ASCII(expect, str)\
+    do {\
+        Value v;\
+        init(v);\
+        set_string(v, str, sizeof(str) - 1);\
+        EXPECT_EQ_STRING(expect, stringify_ascii(v).c_str());\
+        value_free(v);\
+    } while(0)
+
+static void test_stringify_ascii() {
+    for (int k = KERNEL_SCALAR; k <= KERNEL_AVX512; k++) {
+        if (!set_kernel((Kernel) k)) continue;
+        TEST_STRINGIFY_ASCII("\"\"", "");
+        TEST_STRINGIFY_ASCII("\"caf\\u00E9\"", "caf\xC3\xA9");
+        TEST_STRINGIFY_ASCII("\"\\u20AC\\u4E2D\"", "\xE2\x82\xAC\xE4\xB8\xAD");
+        TEST_STRINGIFY_ASCII("\"\\uD834\\uDD1E\\uDBFF\\uDFFF\"", "\xF0\x9D\x84\x9E\xF4\x8F\xBF\xBF");
+        TEST_STRINGIFY_ASCII("\"\\\"\\\\\\n\\u0001\\u001F\"", "\"\\\n\x01\x1F");
+        // 无法解码时每个最长的合法前缀写成一个 U+FFFD
+        TEST_STRINGIFY_ASCII("\"\\uFFFDa\\uFFFD\\uFFFD\\uFFFD\\uFFFD\\uFFFDb\\uFFFD\"", "\xFF" "a\xC0\x80\xED\xA0\xE2\x82" "b\xF0\x9F\x98");
+
+        // 非 ASCII 字符落在块内的每个位置，输出解析回来与原值相同
+        for (size_t pos = 0; pos < 70; pos++) {
+            Value v, v2;
+            init(v);
+            init(v2);
+            std::string s = std::string(pos, 'a') + "\xC3\xA9" + std::string(pos, 'b') + "\xF0\x9F\x98\x80\\t";
+            EXPECT_EQ_INT(PARSE_OK, parse(v, ("{\"" + s + "\":[\"" + s + "\"]}").c_str()));
+            std::string json = stringify_ascii(v);
+            size_t high = 0;
+            for (char ch: json)
+                high += (unsigned char) ch >= 0x80;
+            EXPECT_EQ_SIZE_T(0, high);
+            EXPECT_EQ_INT(PARSE_OK, parse(v2, json.c_str()));
+            EXPECT_EQ_INT(1, value_equal(v, v2));
+            value_free(v);
+            value_free(v2);
+        }
+    }
+    set_kernel(KERNEL_AUTO);
+
+    // 默认原样输出
+    Value v;
+    init(v);
+    set_string(v, "caf\xC3\xA9", 5);
+    size_t len;
+    char *json = stringify(v, len);
+    EXPECT_EQ_STRING("\"caf\xC3\xA9\"", json);
+    free(json);
+    value_free(v);
+}
+
+// 用全部宽松选项解析，成功时比较生成的标准 JSON
+static std::string parse_lenient(int expect, const char *json) {
+    ParseOptions opt;
+    opt.allow_comments = opt.allow_trailing_commas = opt.allow_single_quotes = opt.allow_nan_inf = true;
+    Value v;
+    init(v);
+    EXPECT_EQ_INT(expect, parse(v, json, strlen(json), opt));
+    if (expect != PARSE_OK) return std::string();
+    size_t len;
+    char *out = stringify(v, len);
+    std::string ret(out, len);
+    free(out);
+    value_free(v);
+    return ret;
+}
+
+#define TEST_LENIENT(expect, json) EXPECT_EQ_STRING(expect, parse_lenient(PARSE_OK, json).c_str())
+
+static void test_lenient() {
+    TEST_LENIENT("[1,2]", "// head\n[1, /* one */ 2 // tail\n] /**/");
+    TEST_LENIENT("{\"a\":1}", "{/*x*/\"a\"/*y*/:/*z*/1/***/}//");
+    TEST_LENIENT("[1,{\"a\":[]}]", "[1,{\"a\":[],},]");
+    TEST_LENIENT("[]", "[ ]");
+    TEST_LENIENT("{\"k\":\"say \\\"hi\\\" it's\"}", "{'k':'say \"hi\" it\\'s'}");
+    TEST_LENIENT("[\"\",\"'\"]", "['', \"'\"]");
+    TEST_LENIENT("[NaN,Infinity,-Infinity,-1.5]", "[NaN, Infinity, -Infinity, -1.5]");
+    parse_lenient(PARSE_INVALID_VALUE, "[,]");
+    parse_lenient(PARSE_INVALID_VALUE, "[1,,]");
+    parse_lenient(PARSE_MISS_KEY, "{,}");
+    parse_lenient(PARSE_ROOT_NOT_SINGULAR, "[1] /* open");
+    parse_lenient(PARSE_INVALID_VALUE, "/ 1");
+    parse_lenient(PARSE_INVALID_VALUE, "Inf");
+    parse_lenient(PARSE_INVALID_VALUE, "nan");
+    parse_lenient(PARSE_MISS_QUOTATION_MARK, "'abc\"");
+
+    // 默认仍然是标准语法
+    TEST_ERROR(PARSE_INVALID_VALUE, "[1,]");
+    TEST_ERROR(PARSE_MISS_KEY, "{\"a\":1,}");
+    TEST_ERROR(PARSE_INVALID_VALUE, "// c\n1");
+    TEST_ERROR(PARSE_ROOT_NOT_SINGULAR, "1 /* c */");
+    TEST_ERROR(PARSE_INVALID_VALUE, "'a'");
+    TEST_ERROR(PARSE_MISS_KEY, "{'a':1}");
+    TEST_ERROR(PARSE_INVALID_STRING_ESCAPE, "\"\\'\"");
+    TEST_ERROR(PARSE_INVALID_VALUE, "NaN");
+    TEST_ERROR(PARSE_INVALID_VALUE, "-Infinity");
+
+    // 每个选项单独生效
+    ParseOptions opt;
+    opt.allow_trailing_commas = true;
+    Value v;
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, "[1,]", 4, opt));
+    value_free(v);
+    EXPECT_EQ_INT(PARSE_INVALID_VALUE, parse(v, "[1,/**/]", 8, opt));
+}
+
+static int parse_members(Value &v, const char *json, DuplicateKeys dup, bool sorted) {
+    ParseOptions opt;
+    opt.duplicate_keys = dup;
+    opt.sort_members = sorted;
+    init(v);
+    return parse(v, json, strlen(json), opt);
+}
+
+#define TEST_MEMBERS(expect, json, dup, sorted)\
+    do {\
+        Value v;\
+        size_t len;\
+        EXPECT_EQ_INT(PARSE_OK, parse_members(v, json, dup, sorted));\
+        char *json2 = stringify(v, len);\
+        EXPECT_EQ_STRING(expect, json2);\
+        free(json2);\
+        value_free(v);\
+    } while(0)
+
+static void test_duplicate_keys() {
+    const char *dup = "{\"a\":1,\"b\":2,\"a\":3,\"c\":{\"x\":[],\"x\":{}},\"a\":4}";
+    TEST_MEMBERS("{\"a\":1,\"b\":2,\"a\":3,\"c\":{\"x\":[],\"x\":{}},\"a\":4}", dup, DUPLICATE_KEYS_ALLOW, false);
+    TEST_MEMBERS("{\"a\":1,\"b\":2,\"c\":{\"x\":[]}}", dup, DUPLICATE_KEYS_FIRST, false);
+    TEST_MEMBERS("{\"a\":4,\"b\":2,\"c\":{\"x\":{}}}", dup, DUPLICATE_KEYS_LAST, false);
+    TEST_MEMBERS("{\"b\":2,\"a\":1,\"\":0}", "{\"b\":2,\"a\":1,\"\":0}", DUPLICATE_KEYS_REJECT, false);
+
+    Value v;
+    EXPECT_EQ_INT(PARSE_DUPLICATE_KEY, parse_members(v, dup, DUPLICATE_KEYS_REJECT, false));
+    EXPECT_EQ_INT(NUL, v.type);
+    EXPECT_EQ_INT(PARSE_DUPLICATE_KEY, parse_members(v, "[{\"a\":{\"k\":1,\"k\":\"s\"}}]", DUPLICATE_KEYS_REJECT, false));
+    EXPECT_EQ_INT(PARSE_DUPLICATE_KEY, parse_members(v, "{\"\":1,\"\":2}", DUPLICATE_KEYS_REJECT, false));
+
+    // 排序：按字节序，短的前缀在前，重复的键保持输入顺序
+    TEST_MEMBERS("{\"\":0,\"a\":1,\"ab\":{\"x\":1,\"y\":2},\"b\":[{\"c\":3,\"d\":4}],\"\xc3\xa9\":5}",
+                 "{\"\xc3\xa9\":5,\"b\":[{\"d\":4,\"c\":3}],\"ab\":{\"y\":2,\"x\":1},\"a\":1,\"\":0}",
+                 DUPLICATE_KEYS_ALLOW, true);
+    TEST_MEMBERS("{\"a\":1,\"a\":3,\"a\":4,\"b\":2,\"c\":{\"x\":[],\"x\":{}}}", dup, DUPLICATE_KEYS_ALLOW, true);
+    TEST_MEMBERS("{\"a\":4,\"b\":2,\"c\":{\"x\":{}}}", dup, DUPLICATE_KEYS_LAST, true);
+
+    // 大对象走哈希查重，排序后二分查找
+    std::string big = "{";
+    for (int i = 99; i >= 0; i--)
+        big += "\"k" + std::to_string(i % 50) + "\":" + std::to_string(i) + ",";
+    big.back() = '}';
+    EXPECT_EQ_INT(PARSE_OK, parse_members(v, big.c_str(), DUPLICATE_KEYS_FIRST, true));
+    EXPECT_EQ_SIZE_T(50, get_object_size(v));
+    for (int i = 0; i < 50; i++) {
+        std::string k = "k" + std::to_string(i);
+        size_t index = find_sorted_object_index(v, k.c_str(), k.size());
+        EXPECT_EQ_INT(1, index != KEY_NOT_EXIST && index == find_object_index(v, k.c_str(), k.size()));
+        EXPECT_EQ_DOUBLE(i + 50.0, get_number(*get_object_value(v, index)));
+    }
+    EXPECT_EQ_SIZE_T(KEY_NOT_EXIST, find_sorted_object_index(v, "k50", 3));
+    EXPECT_EQ_SIZE_T(KEY_NOT_EXIST, find_sorted_object_index(v, "", 0));
+    EXPECT_EQ_SIZE_T(KEY_NOT_EXIST, find_sorted_object_index(v, "z", 1));
+    value_free(v);
+    EXPECT_EQ_INT(PARSE_DUPLICATE_KEY, parse_members(v, big.c_str(), DUPLICATE_KEYS_REJECT, false));
+
+    // 乱序且有重复键的大对象：排序稳定，临时空间经由分配器申请
+    CountingHeap heap{0, 0};
+    Allocator alloc{counting_malloc, counting_realloc, counting_free, &heap};
+    big = "{";
+    for (int i = 0; i < 1000; i++)
+        big += "\"k" + std::to_string(i * 7919 % 300) + "\":" + std::to_string(i) + ",";
+    big.back() = '}';
+    ParseOptions sorted;
+    sorted.sort_members = true;
+    sorted.alloc = &alloc;
+    EXPECT_EQ_INT(PARSE_OK, parse(v, big.c_str(), big.size(), sorted));
+    Value copy;
+    init(copy);
+    EXPECT_EQ_INT(PARSE_OK, parse(copy, big.c_str(), big.size()));
+    sort_members(copy, &alloc);
+    bool ordered = get_object_size(v) == 1000;
+    for (size_t i = 1; ordered && i < get_object_size(v); i++) {
+        std::string_view a = get_object_key_view(v, i - 1), b = get_object_key_view(v, i);
+        ordered = a < b || (a == b && get_number(*get_object_value(v, i - 1)) < get_number(*get_object_value(v, i)));
+        ordered = ordered && get_object_key_view(copy, i) == b &&
+                  get_number(*get_object_value(copy, i)) == get_number(*get_object_value(v, i));
+    }
+    EXPECT_EQ_INT(1, ordered);
+    value_free(v, &alloc);
+    value_free(copy);
+    EXPECT_EQ_SIZE_T(0, heap.live);
+
+    // 多线程解析同样按选项处理每个对象
+    std::string arr = "[";
+    for (int i = 0; i < 5000; i++)
+        arr += "{\"b\":" + std::to_string(i) + ",\"a\":" + std::to_string(i) + "},";
+    arr.back() = ']';
+    ParseOptions parallel;
+    parallel.threads = 4;
+    parallel.sort_members = true;
+    parallel.duplicate_keys = DUPLICATE_KEYS_REJECT;
+    EXPECT_EQ_INT(PARSE_OK, parse_parallel(v, arr.c_str(), arr.size(), parallel));
+    EXPECT_EQ_INT(1, get_object_key_view(*get_array_element(v, 4999), 0) == "a");
+    value_free(v);
+    arr.insert(arr.find("{\"b\":3000,") + 1, "\"a\":0,");
+    EXPECT_EQ_INT(PARSE_DUPLICATE_KEY, parse_parallel(v, arr.c_str(), arr.size(), parallel));
+
+    // 修改过的树可以再排序，得到与成员顺序无关的输出
+    EXPECT_EQ_INT(PARSE_OK, parse_members(v, "{\"z\":[{\"b\":1,\"a\":2}],\"y\":null}", DUPLICATE_KEYS_ALLOW, false));
+    object_set(v, "x", 1, NULL);
+    sort_members(v);
+    size_t len;
+    char *json = stringify(v, len);
+    EXPECT_EQ_STRING("{\"x\":null,\"y\":null,\"z\":[{\"a\":2,\"b\":1}]}", json);
+    free(json);
+    value_free(v);
+}
+
+static void test_document() {
+    // 大对象走索引，小对象走线性查找，重复的键都返回第一个
+    std::string json = "{\"small\":{\"a\":1,\"a\":2},\"big\":{";
+    for (int i = 0; i < 100; i++)
+        json += "\"k" + std::to_string(i) + "\":" + std::to_string(i) + ",";
+    json += "\"k7\":-1},\"list\":[{\"x\":true}]}";
+    Value v;
+    init(v);
+    EXPECT_EQ_INT(PARSE_OK, parse(v, json.c_str(), json.size()));
+    Document *doc = document_create(v);
+    EXPECT_EQ_INT(NUL, v.type);
+    const Value &root = document_root(doc);
+    const Value *big = document_find(doc, root, "big", 3);
+    EXPECT_EQ_SIZE_T(101, get_object_size(*big));
+    EXPECT_EQ_DOUBLE(7.0, get_number(*document_find(doc, *big, "k7", 2)));
+    EXPECT_EQ_DOUBLE(99.0, get_number(*document_find(doc, *big, "k99", 3)));
+    EXPECT_EQ_INT(1, document_find(doc, *big, "k100", 4) == NULL);
+    EXPECT_EQ_INT(1, document_find(doc, *big, "", 0) == NULL);
+    EXPECT_EQ_DOUBLE(1.0, get_number(*document_find(doc, *document_find(doc, root, "small", 5), "a", 1)));
+
+    // 多个线程同时触发索引的建立
+    Document *shared = document_retain(doc);
+    document_release(doc);
+    std::vector<std::thread> threads;
+    std::vector<int> errors(8, 0);
+    for (int t = 0; t < 8; t++)
+        threads.emplace_back([shared, t, &errors] {
+            Document *d = document_retain(shared);
+            const Value *obj = document_find(d, document_root(d), "big", 3);
+            for (int i = 0; i < 1000; i++) {
+                std::string k = "k" + std::to_string((i * 7 + t) % 100);
+                const Value *found = document_find(d, *obj, k.c_str(), k.size());
+                if (!found || get_number(*found) != (i * 7 + t) % 100) errors[t]++;
+            }
+            document_release(d);
+        });
+    for (std::thread &th: threads)
+        th.join();
+    for (int t = 0; t < 8; t++)
+        EXPECT_EQ_INT(0, errors[t]);
+    document_release(shared);
+
+    // SharedJson 的拷贝共享同一棵树
+    Json j;
+    EXPECT_EQ_INT(PARSE_OK, j.parse(json));
+    SharedJson snapshot(std::move(j));
+    EXPECT_EQ_INT(NUL, j.type());
+    SharedJson copy = snapshot;
+    SharedJson big_copy = copy["big"];
+    EXPECT_EQ_INT(1, big_copy.view().get() == snapshot["big"].view().get());
+    snapshot = SharedJson();
+    copy = SharedJson();
+    EXPECT_EQ_DOUBLE(42.0, big_copy["k42"].view().number());
+    EXPECT_EQ_INT(0, (bool) big_copy["missing"]);
+    EXPECT_EQ_INT(1, (bool) SharedJson(big_copy)["k0"]);
+}
+
 int main() {
 
+#ifdef _WINDOWS
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
+#endif
     test_parse();
     test_access();
     test_stringify();
+    test_ndjson();
+    test_binary();
+    test_tape();
+    test_allocator();
+    test_key_table();
+    test_cxx_wrapper();
+    test_reader();
+    test_bind();
+    test_writer();
+    test_schema();
+    test_mutation();
+    test_patch();
+    test_diff();
+    test_stats();
+    test_kernels();
+    test_utf8();
+    test_stringify_ascii();
+    test_lenient();
+    test_duplicate_keys();
+    test_document();
 
     printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count, test_pass * 100.0 / test_count);
+#ifdef _WINDOWS
     _CrtDumpMemoryLeaks();
+#endif
     return main_ret;
 }
\ No newline at end of file
@@ -9,30 +9,657 @@
 
 #endif
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
+#include <atomic>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+#ifndef _WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if !defined(TINY_JSON_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define TINY_JSON_X86_KERNELS
+#include <immintrin.h>
+#endif
 
 #include "tiny_json.h"
 
 namespace tiny_json {
 
-    struct Context {
-        const char *json;
-        char *stack;
-        size_t size, top;
+    // 字符串的实际长度，短字符串存放在 short_len 中
+    static inline size_t string_length(const Value &v) {
+        assert(v.type == STRING);
+        return v.short_len ? v.short_len - 1 : v.len;
+    }
+
+    // 统计计数。每个线程有一份当前调用的计数和一份累计值，
+    // 嵌套的调用（例如 parse_file 里的 parse）只算最外层的一次。
+    // 工作线程的计数由 STATS_WORKER 收集，join 之后用 STATS_MERGE 合并进调用线程当前的调用。
+#ifdef TINY_JSON_STATS
+    static thread_local Stats stats_call, stats_total;
+    static thread_local unsigned stats_level;
+    static thread_local size_t stats_depth;
+
+#define STATS_ADD(field, n) (stats_call.field += (n))
+#define STATS_MAX(field, n) do { if ((n) > stats_call.field) stats_call.field = (n); } while (0)
+#define STATS_NODE(type) (stats_call.nodes[type]++)
+
+    // 计数相加，峰值取最大；calls 只在最外层的调用结束时设置，这里也一并相加
+    static void stats_merge(Stats &t, const Stats &s) {
+        t.calls += s.calls;
+        t.bytes_parsed += s.bytes_parsed;
+        t.bytes_stringified += s.bytes_stringified;
+        for (int i = 0; i <= OBJECT; i++)
+            t.nodes[i] += s.nodes[i];
+        t.escapes += s.escapes;
+        t.stack_reallocs += s.stack_reallocs;
+        t.alloc_calls += s.alloc_calls;
+        t.alloc_bytes += s.alloc_bytes;
+        if (s.stack_peak > t.stack_peak) t.stack_peak = s.stack_peak;
+        if (s.max_depth > t.max_depth) t.max_depth = s.max_depth;
+    }
+
+    struct StatsScope {
+        StatsScope() {
+            if (stats_level++ == 0) {
+                stats_call = Stats();
+                stats_depth = 0;
+            }
+        }
+
+        ~StatsScope() {
+            if (--stats_level) return;
+            stats_call.calls = 1;
+            stats_merge(stats_total, stats_call);
+        }
+    };
+
+    // 工作线程的整个线程体算作一次嵌套的调用，从 depth 层开始计深度，结束时把计数交给 out
+    struct StatsWorker {
+        Stats &out;
+        StatsScope scope;
+
+        StatsWorker(Stats &out, size_t depth) : out(out) { stats_depth = depth; }
+
+        ~StatsWorker() { out = stats_call; }
+    };
+
+    // 进入一层数组或对象，离开作用域时退出
+    struct StatsDepth {
+        StatsDepth() {
+            ++stats_depth;
+            STATS_MAX(max_depth, stats_depth);
+        }
+
+        ~StatsDepth() { --stats_depth; }
+    };
+
+#define STATS_SCOPE() StatsScope stats_scope
+#define STATS_DEPTH() StatsDepth stats_depth_guard
+#define STATS_WORKER(out, depth) StatsWorker stats_worker(out, depth)
+#define STATS_MERGE(s) stats_merge(stats_call, s)
+
+    Stats last_call_stats() {
+        return stats_call;
+    }
+
+    Stats thread_stats() {
+        return stats_total;
+    }
+
+    void reset_thread_stats() {
+        stats_total = Stats();
+    }
+#else
+#define STATS_ADD(field, n) ((void) 0)
+#define STATS_MAX(field, n) ((void) 0)
+#define STATS_NODE(type) ((void) 0)
+#define STATS_SCOPE() ((void) 0)
+#define STATS_DEPTH() ((void) 0)
+#define STATS_WORKER(out, depth) ((void) (out))
+#define STATS_MERGE(s) ((void) (s))
+
+    Stats last_call_stats() {
+        return Stats();
+    }
+
+    Stats thread_stats() {
+        return Stats();
+    }
+
+    void reset_thread_stats() {
+    }
+#endif
+
+    // 越界时返回 '\0'，语法上与以 '\0' 结尾的字符串等价
+    static inline char peek(const Context &c, const char *p) {
+        return p < c.end ? *p : '\0';
+    }
+
+    // 扫描内核：都只读取 [p, end)，返回第一个不满足条件的位置，全部满足时返回 end。
+    // skip_whitespace 跳过空白；scan_string 跳过字符串中可以原样复制的字节，
+    // 即停在 '"'、'\\' 和控制字符上，解析和生成需要特殊处理的正好是这些字节；
+    // scan_string_ascii 另外还停在非 ASCII 字节上，供只输出 ASCII 的生成使用。
+    // validate_utf8 检查 scan_string 找出的一段是否是合法的 UTF-8：多字节序列里不会出现 ASCII 字节，
+    // 所以每一段都必须独立合法，校验紧跟在扫描之后，数据还在缓存里。
+    // 向量版本按块处理，不足一块的尾部交给标量版本，因此不会读到 end 之后。
+    struct Kernels {
+        Kernel kind;
+        const char *(*skip_whitespace)(const char *p, const char *end);
+        const char *(*scan_string)(const char *p, const char *end);
+        const char *(*scan_string_ascii)(const char *p, const char *end);
+        bool (*validate_utf8)(const char *p, const char *end);
+    };
+
+    static inline bool is_whitespace(char ch) {
+        return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+    }
+
+    static inline bool is_plain_string_char(char ch) {
+        return (unsigned char) ch >= 0x20 && ch != '"' && ch != '\\';
+    }
+
+    static const char *skip_whitespace_scalar(const char *p, const char *end) {
+        while (p != end && is_whitespace(*p))
+            p++;
+        return p;
+    }
+
+    static const char *scan_string_scalar(const char *p, const char *end) {
+        while (p != end && is_plain_string_char(*p))
+            p++;
+        return p;
+    }
+
+    static const char *scan_string_ascii_scalar(const char *p, const char *end) {
+        while (p != end && is_plain_string_char(*p) && (unsigned char) *p < 0x80)
+            p++;
+        return p;
+    }
+
+    // 按 RFC 3629 的表格逐个检查序列：第二个字节的范围取决于首字节，以排除过长编码、
+    // 代理项（U+D800~U+DFFF）和超过 U+10FFFF 的码点
+    static bool validate_utf8_scalar(const char *p, const char *end) {
+        while (p != end) {
+            // 一次检查 8 个字节是否都是 ASCII
+            uint64_t w;
+            if (end - p >= 8 && (memcpy(&w, p, 8), (w & 0x8080808080808080ull) == 0)) {
+                p += 8;
+                continue;
+            }
+            unsigned char ch = (unsigned char) *p;
+            if (ch < 0x80) {
+                p++;
+                continue;
+            }
+            size_t n;
+            unsigned char lo = 0x80, hi = 0xBF;
+            if (ch >= 0xC2 && ch <= 0xDF) {
+                n = 1;
+            } else if (ch >= 0xE0 && ch <= 0xEF) {
+                n = 2;
+                if (ch == 0xE0) lo = 0xA0;
+                else if (ch == 0xED) hi = 0x9F;
+            } else if (ch >= 0xF0 && ch <= 0xF4) {
+                n = 3;
+                if (ch == 0xF0) lo = 0x90;
+                else if (ch == 0xF4) hi = 0x8F;
+            } else {
+                return false;
+            }
+            if ((size_t) (end - p) <= n) return false;
+            unsigned char ch1 = (unsigned char) p[1];
+            if (ch1 < lo || ch1 > hi) return false;
+            for (size_t i = 2; i <= n; i++)
+                if (((unsigned char) p[i] & 0xC0) != 0x80) return false;
+            p += n + 1;
+        }
+        return true;
+    }
+
+#ifdef TINY_JSON_X86_KERNELS
+    // PCMPISTRI 以隐式长度比较，输入中的 '\0' 之后都算作不匹配，正好是第一个非空白字符
+    __attribute__((target("sse4.2")))
+    static const char *skip_whitespace_sse42(const char *p, const char *end) {
+        const __m128i ws = _mm_setr_epi8(' ', '\t', '\n', '\r', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        for (; end - p >= 16; p += 16) {
+            __m128i s = _mm_loadu_si128((const __m128i *) p);
+            int r = _mm_cmpistri(ws, s, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT |
+                                        _SIDD_NEGATIVE_POLARITY);
+            if (r != 16) return p + r;
+        }
+        return skip_whitespace_scalar(p, end);
+    }
+
+    // 字符串里可能有 '\0'，用显式长度的 PCMPESTRI 按区间匹配 [0x00, 0x1F]、'"'、'\\'
+    __attribute__((target("sse4.2")))
+    static const char *scan_string_sse42(const char *p, const char *end) {
+        const __m128i special = _mm_setr_epi8(0, 0x1F, '"', '"', '\\', '\\', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        for (; end - p >= 16; p += 16) {
+            __m128i s = _mm_loadu_si128((const __m128i *) p);
+            int r = _mm_cmpestri(special, 6, s, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+            if (r != 16) return p + r;
+        }
+        return scan_string_scalar(p, end);
+    }
+
+    __attribute__((target("sse4.2")))
+    static const char *scan_string_ascii_sse42(const char *p, const char *end) {
+        const __m128i special = _mm_setr_epi8(0, 0x1F, '"', '"', '\\', '\\', (char) 0x80, (char) 0xFF,
+                                              0, 0, 0, 0, 0, 0, 0, 0);
+        for (; end - p >= 16; p += 16) {
+            __m128i s = _mm_loadu_si128((const __m128i *) p);
+            int r = _mm_cmpestri(special, 8, s, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+            if (r != 16) return p + r;
+        }
+        return scan_string_ascii_scalar(p, end);
+    }
+
+    __attribute__((target("avx2")))
+    static const char *skip_whitespace_avx2(const char *p, const char *end) {
+        const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+        const __m256i lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+        for (; end - p >= 32; p += 32) {
+            __m256i s = _mm256_loadu_si256((const __m256i *) p);
+            __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(s, space), _mm256_cmpeq_epi8(s, tab)),
+                                         _mm256_or_si256(_mm256_cmpeq_epi8(s, lf), _mm256_cmpeq_epi8(s, cr)));
+            unsigned mask = ~(unsigned) _mm256_movemask_epi8(ws);
+            if (mask) return p + __builtin_ctz(mask);
+        }
+        return skip_whitespace_scalar(p, end);
+    }
+
+    // ascii 为 true 时非 ASCII 字节也算作特殊字节，它们的最高位为 1，直接并入 movemask
+    template<bool ascii>
+    __attribute__((target("avx2")))
+    static inline const char *scan_string_avx2_impl(const char *p, const char *end) {
+        const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+        const __m256i ctrl = _mm256_set1_epi8(0x1F);
+        for (; end - p >= 32; p += 32) {
+            __m256i s = _mm256_loadu_si256((const __m256i *) p);
+            // 无符号的 min(s, 0x1F) == s 即 s <= 0x1F
+            __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(s, ctrl), s),
+                                              _mm256_or_si256(_mm256_cmpeq_epi8(s, quote),
+                                                              _mm256_cmpeq_epi8(s, backslash)));
+            if (ascii) special = _mm256_or_si256(special, s);
+            unsigned mask = (unsigned) _mm256_movemask_epi8(special);
+            if (mask) return p + __builtin_ctz(mask);
+        }
+        return ascii ? scan_string_ascii_scalar(p, end) : scan_string_scalar(p, end);
+    }
+
+    __attribute__((target("avx2")))
+    static const char *scan_string_avx2(const char *p, const char *end) {
+        return scan_string_avx2_impl<false>(p, end);
+    }
+
+    __attribute__((target("avx2")))
+    static const char *scan_string_ascii_avx2(const char *p, const char *end) {
+        return scan_string_avx2_impl<true>(p, end);
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    static const char *skip_whitespace_avx512(const char *p, const char *end) {
+        const __m512i space = _mm512_set1_epi8(' '), tab = _mm512_set1_epi8('\t');
+        const __m512i lf = _mm512_set1_epi8('\n'), cr = _mm512_set1_epi8('\r');
+        for (; end - p >= 64; p += 64) {
+            __m512i s = _mm512_loadu_si512((const void *) p);
+            __mmask64 ws = _mm512_cmpeq_epi8_mask(s, space) | _mm512_cmpeq_epi8_mask(s, tab) |
+                           _mm512_cmpeq_epi8_mask(s, lf) | _mm512_cmpeq_epi8_mask(s, cr);
+            unsigned long long mask = ~(unsigned long long) ws;
+            if (mask) return p + __builtin_ctzll(mask);
+        }
+        return skip_whitespace_scalar(p, end);
+    }
+
+    template<bool ascii>
+    __attribute__((target("avx512f,avx512bw")))
+    static inline const char *scan_string_avx512_impl(const char *p, const char *end) {
+        const __m512i quote = _mm512_set1_epi8('"'), backslash = _mm512_set1_epi8('\\');
+        const __m512i ctrl = _mm512_set1_epi8(0x1F);
+        for (; end - p >= 64; p += 64) {
+            __m512i s = _mm512_loadu_si512((const void *) p);
+            unsigned long long mask = _mm512_cmple_epu8_mask(s, ctrl) | _mm512_cmpeq_epi8_mask(s, quote) |
+                                      _mm512_cmpeq_epi8_mask(s, backslash);
+            if (ascii) mask |= _mm512_movepi8_mask(s);
+            if (mask) return p + __builtin_ctzll(mask);
+        }
+        return ascii ? scan_string_ascii_scalar(p, end) : scan_string_scalar(p, end);
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    static const char *scan_string_avx512(const char *p, const char *end) {
+        return scan_string_avx512_impl<false>(p, end);
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    static const char *scan_string_ascii_avx512(const char *p, const char *end) {
+        return scan_string_avx512_impl<true>(p, end);
+    }
+#endif
+
+    // UTF-8 的向量校验（Keiser & Lemire 的查表法）。每个字节和它前面的一个字节组成一对，
+    // 用前一字节的高低半字节和本字节的高半字节查三张表，三者按位与不为 0 即是某种错误；
+    // 再由前两个、三个字节判断本字节是否必须是第三、四个字节，与查表结果异或检查后续字节的个数。
+    enum {
+        UTF8_TOO_SHORT = 1 << 0,      // 11______ 0_______ 或 11______ 11______
+        UTF8_TOO_LONG = 1 << 1,       // 0_______ 10______
+        UTF8_OVERLONG_3 = 1 << 2,     // 11100000 100_____
+        UTF8_TOO_LARGE = 1 << 3,      // 11110100 1001____ 等
+        UTF8_SURROGATE = 1 << 4,      // 11101101 101_____
+        UTF8_OVERLONG_2 = 1 << 5,     // 1100000_ 10______
+        UTF8_TOO_LARGE_1000 = 1 << 6, // 11110101 1000____ 等
+        UTF8_OVERLONG_4 = 1 << 6,     // 11110000 1000____
+        UTF8_TWO_CONTS = 1 << 7,      // 10______ 10______
+        UTF8_CARRY = UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS,
+    };
+
+    static const char utf8_byte_1_high[16] = {
+            // 0_______：ASCII
+            UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+            UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+            // 10______：后续字节
+            (char) UTF8_TWO_CONTS, (char) UTF8_TWO_CONTS, (char) UTF8_TWO_CONTS, (char) UTF8_TWO_CONTS,
+            // 1100____、1101____：两字节序列的首字节
+            UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+            UTF8_TOO_SHORT,
+            // 1110____：三字节序列的首字节
+            UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+            // 1111____：四字节序列的首字节
+            UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+    };
+
+    static const char utf8_byte_1_low[16] = {
+            (char) (UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),  // ____0000
+            (char) (UTF8_CARRY | UTF8_OVERLONG_2),                                      // ____0001
+            (char) UTF8_CARRY,
+            (char) UTF8_CARRY,
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE),                                       // ____0100
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE), // ____1101
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+            (char) (UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000),
+    };
+
+    static const char utf8_byte_2_high[16] = {
+            // ________ 0_______：ASCII
+            UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+            UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+            // ________ 1000____
+            (char) (UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 |
+                    UTF8_OVERLONG_4),
+            // ________ 1001____
+            (char) (UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE),
+            // ________ 101_____
+            (char) (UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+            (char) (UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE),
+            // ________ 11______
+            UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+    };
+
+#ifdef TINY_JSON_X86_KERNELS
+    // 块的最后三个字节不小于这些值时，序列延续到下一块
+    static const unsigned char utf8_incomplete_max[32] = {
+            255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+            255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1,
+    };
+
+    // 检查一个 16 字节的块，prev 是上一块，返回的非零位表示错误
+    __attribute__((target("sse4.2")))
+    static inline __m128i utf8_check_sse42(__m128i input, __m128i prev) {
+        const __m128i low_nibble = _mm_set1_epi8(0x0F);
+        const __m128i byte_1_high = _mm_loadu_si128((const __m128i *) utf8_byte_1_high);
+        const __m128i byte_1_low = _mm_loadu_si128((const __m128i *) utf8_byte_1_low);
+        const __m128i byte_2_high = _mm_loadu_si128((const __m128i *) utf8_byte_2_high);
+        __m128i prev1 = _mm_alignr_epi8(input, prev, 16 - 1);
+        __m128i special = _mm_and_si128(
+                _mm_and_si128(_mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble)),
+                              _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, low_nibble))),
+                _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble)));
+        __m128i prev2 = _mm_alignr_epi8(input, prev, 16 - 2);
+        __m128i prev3 = _mm_alignr_epi8(input, prev, 16 - 3);
+        // 饱和减法后最高位为 1 即 prev2 >= 0xE0 或 prev3 >= 0xF0，本字节必须是后续字节
+        __m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char) (0xE0 - 0x80))),
+                                      _mm_subs_epu8(prev3, _mm_set1_epi8((char) (0xF0 - 0x80))));
+        return _mm_xor_si128(_mm_and_si128(must23, _mm_set1_epi8((char) 0x80)), special);
+    }
+
+    __attribute__((target("sse4.2")))
+    static bool validate_utf8_sse42(const char *p, const char *end) {
+        if (end - p < 16) return validate_utf8_scalar(p, end);
+        const __m128i incomplete_max = _mm_loadu_si128((const __m128i *) (utf8_incomplete_max + 16));
+        __m128i prev = _mm_setzero_si128(), error = _mm_setzero_si128(), incomplete = _mm_setzero_si128();
+        char tail[16];
+        while (p != end) {
+            __m128i input;
+            if (end - p >= 16) {
+                input = _mm_loadu_si128((const __m128i *) p);
+                p += 16;
+            } else {
+                // 尾部补 0，未完成的序列遇到 0 会被判为过短
+                memset(tail, 0, sizeof(tail));
+                memcpy(tail, p, end - p);
+                input = _mm_loadu_si128((const __m128i *) tail);
+                p = end;
+            }
+            if (_mm_movemask_epi8(input) == 0) {
+                // 全是 ASCII，只需确认上一块没有未完成的序列
+                error = _mm_or_si128(error, incomplete);
+                incomplete = _mm_setzero_si128();
+            } else {
+                error = _mm_or_si128(error, utf8_check_sse42(input, prev));
+                incomplete = _mm_subs_epu8(input, incomplete_max);
+            }
+            prev = input;
+        }
+        error = _mm_or_si128(error, incomplete);
+        return _mm_testz_si128(error, error);
+    }
+
+    __attribute__((target("avx2")))
+    static inline __m256i utf8_check_avx2(__m256i input, __m256i prev) {
+        const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+        const __m256i byte_1_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) utf8_byte_1_high));
+        const __m256i byte_1_low = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) utf8_byte_1_low));
+        const __m256i byte_2_high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) utf8_byte_2_high));
+        // 跨 128 位通道取前 N 个字节：把上一块的高半和本块的低半拼起来再 alignr
+        __m256i shifted = _mm256_permute2x128_si256(prev, input, 0x21);
+        __m256i prev1 = _mm256_alignr_epi8(input, shifted, 16 - 1);
+        __m256i special = _mm256_and_si256(
+                _mm256_and_si256(
+                        _mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble)),
+                        _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, low_nibble))),
+                _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble)));
+        __m256i prev2 = _mm256_alignr_epi8(input, shifted, 16 - 2);
+        __m256i prev3 = _mm256_alignr_epi8(input, shifted, 16 - 3);
+        __m256i must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char) (0xE0 - 0x80))),
+                                         _mm256_subs_epu8(prev3, _mm256_set1_epi8((char) (0xF0 - 0x80))));
+        return _mm256_xor_si256(_mm256_and_si256(must23, _mm256_set1_epi8((char) 0x80)), special);
+    }
+
+    // 不足一块的短字符串交给 SSE4.2 版本。AVX-512 的内核也使用这个版本，支持 AVX-512BW 的 CPU 都支持 AVX2
+    __attribute__((target("avx2")))
+    static bool validate_utf8_avx2(const char *p, const char *end) {
+        if (end - p < 32) return validate_utf8_sse42(p, end);
+        const __m256i incomplete_max = _mm256_loadu_si256((const __m256i *) utf8_incomplete_max);
+        __m256i prev = _mm256_setzero_si256(), error = _mm256_setzero_si256(), incomplete = _mm256_setzero_si256();
+        char tail[32];
+        while (p != end) {
+            __m256i input;
+            if (end - p >= 32) {
+                input = _mm256_loadu_si256((const __m256i *) p);
+                p += 32;
+            } else {
+                memset(tail, 0, sizeof(tail));
+                memcpy(tail, p, end - p);
+                input = _mm256_loadu_si256((const __m256i *) tail);
+                p = end;
+            }
+            if (_mm256_movemask_epi8(input) == 0) {
+                error = _mm256_or_si256(error, incomplete);
+                incomplete = _mm256_setzero_si256();
+            } else {
+                error = _mm256_or_si256(error, utf8_check_avx2(input, prev));
+                incomplete = _mm256_subs_epu8(input, incomplete_max);
+            }
+            prev = input;
+        }
+        error = _mm256_or_si256(error, incomplete);
+        return _mm256_testz_si256(error, error);
+    }
+#endif
+
+    // 按 Kernel 的顺序排列，下标为 Kernel - 1
+    static const Kernels kernel_table[] = {
+            {KERNEL_SCALAR, skip_whitespace_scalar, scan_string_scalar, scan_string_ascii_scalar, validate_utf8_scalar},
+#ifdef TINY_JSON_X86_KERNELS
+            {KERNEL_SSE42,  skip_whitespace_sse42,  scan_string_sse42,  scan_string_ascii_sse42,  validate_utf8_sse42},
+            {KERNEL_AVX2,   skip_whitespace_avx2,   scan_string_avx2,   scan_string_ascii_avx2,   validate_utf8_avx2},
+            {KERNEL_AVX512, skip_whitespace_avx512, scan_string_avx512, scan_string_ascii_avx512, validate_utf8_avx2},
+#endif
+    };
+
+    // 静态初始化之前就能使用标量版本，启动时再换成 CPU 支持的最快实现。
+    // 表项本身不变，切换只替换指针，relaxed 读取即可。
+    static std::atomic<const Kernels *> kernels{&kernel_table[0]};
+
+    static inline const Kernels &current_kernels() {
+        return *kernels.load(std::memory_order_relaxed);
+    }
+
+    bool kernel_supported(Kernel k) {
+        if (k == KERNEL_AUTO || k == KERNEL_SCALAR) return true;
+        if (k < KERNEL_AUTO || (size_t) k > sizeof(kernel_table) / sizeof(kernel_table[0])) return false;
+#ifdef TINY_JSON_X86_KERNELS
+        __builtin_cpu_init();
+        switch (k) {
+            case KERNEL_SSE42:
+                return __builtin_cpu_supports("sse4.2");
+            case KERNEL_AVX2:
+                return __builtin_cpu_supports("avx2");
+            case KERNEL_AVX512:
+                return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+            default:
+                break;
+        }
+#endif
+        return false;
+    }
+
+    bool set_kernel(Kernel k) {
+        if (k == KERNEL_AUTO) {
+            k = KERNEL_SCALAR;
+            for (int i = KERNEL_AVX512; i > KERNEL_SCALAR; i--) {
+                if (kernel_supported((Kernel) i)) {
+                    k = (Kernel) i;
+                    break;
+                }
+            }
+        }
+        if (!kernel_supported(k)) return false;
+        kernels.store(&kernel_table[k - 1], std::memory_order_relaxed);
+        return true;
+    }
+
+    Kernel active_kernel() {
+        return current_kernels().kind;
+    }
+
+    const char *kernel_name(Kernel k) {
+        switch (k) {
+            case KERNEL_AUTO:
+                return "auto";
+            case KERNEL_SCALAR:
+                return "scalar";
+            case KERNEL_SSE42:
+                return "sse4.2";
+            case KERNEL_AVX2:
+                return "avx2";
+            case KERNEL_AVX512:
+                return "avx512";
+        }
+        return "unknown";
+    }
+
+    static const bool kernels_selected = set_kernel(KERNEL_AUTO);
+
+
+    // Context::flags 的取值
+    enum {
+        CONTEXT_VALIDATE_UTF8 = 1 << 0,
+        CONTEXT_ASCII = 1 << 1,             // 生成时只输出 ASCII
+        CONTEXT_COMMENTS = 1 << 2,          // 以下是宽松语法，见 ParseOptions
+        CONTEXT_TRAILING_COMMAS = 1 << 3,
+        CONTEXT_SINGLE_QUOTES = 1 << 4,
+        CONTEXT_NAN_INF = 1 << 5,
+        CONTEXT_DUPLICATE_REJECT = 1 << 6,  // 重复键的处理，见 DuplicateKeys
+        CONTEXT_DUPLICATE_FIRST = 1 << 7,
+        CONTEXT_DUPLICATE_LAST = 1 << 8,
+        CONTEXT_SORT_MEMBERS = 1 << 9,
     };
 
+    static const unsigned CONTEXT_DUPLICATE_MASK =
+            CONTEXT_DUPLICATE_REJECT | CONTEXT_DUPLICATE_FIRST | CONTEXT_DUPLICATE_LAST;
+
+    // 跳过空白和注释。没有结束的块注释不跳过，由后面的语法报错
+    static void skip_whitespace_and_comments(Context &c) {
+        const char *p = c.json;
+        while (true) {
+            p = current_kernels().skip_whitespace(p, c.end);
+            if (peek(c, p) != '/') break;
+            if (peek(c, p + 1) == '/') {
+                p += 2;
+                while (p != c.end && *p != '\n')
+                    p++;
+            } else if (peek(c, p + 1) == '*') {
+                const char *q = p + 2;
+                while (q + 1 < c.end && !(q[0] == '*' && q[1] == '/'))
+                    q++;
+                if (q + 1 >= c.end) break;
+                p = q + 2;
+            } else {
+                break;
+            }
+        }
+        c.json = p;
+    }
 
     // 所谓空白，是由零或多个空格符（space U+0020）、
     // 制表符（tab U+0009）、换行符（LF U+000A）、回车符（CR U+000D）所组成。
     // ws = *(%x20 / %x09 / %x0A / %x0D)
     static void parse_whitespace(Context &c) {
         const char *p = c.json;
-        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
-            p++;
+        // 大多数位置没有空白或只有一个空格，先逐个判断，剩下的长串空白（缩进）交给扫描内核。
+        // 注释只可能出现在空白结束的地方，不允许注释时只多一次比较
+        if (p == c.end || !is_whitespace(*p)) {
+            if (p != c.end && *p == '/' && (c.flags & CONTEXT_COMMENTS)) skip_whitespace_and_comments(c);
+            return;
+        }
+        if (++p != c.end && is_whitespace(*p))
+            p = current_kernels().skip_whitespace(p, c.end);
         c.json = p;
+        if (p != c.end && *p == '/' && (c.flags & CONTEXT_COMMENTS)) skip_whitespace_and_comments(c);
     }
 
     // null = "null"
@@ -51,10 +678,11 @@ namespace tiny_json {
 
     static int parse_literal(Context &c, Value &v, const char *literal, Type type) {
         while (*literal != '\0') {
-            if (*c.json != *literal) return PARSE_INVALID_VALUE;
+            if (peek(c, c.json) != *literal) return PARSE_INVALID_VALUE;
             ++literal, ++c.json;
         }
         v.type = type;
+        STATS_NODE(type);
         return PARSE_OK;
     }
 
@@ -85,60 +713,189 @@ namespace tiny_json {
 //        }
 //    }
 
+    static void *std_malloc(void *, size_t size) {
+        return malloc(size);
+    }
+
+    static void *std_realloc(void *, void *p, size_t, size_t new_size) {
+        return realloc(p, new_size);
+    }
+
+    static void std_free(void *, void *p, size_t) {
+        free(p);
+    }
+
+    static const Allocator std_allocator = {std_malloc, std_realloc, std_free, NULL};
+
+    const Allocator *default_allocator() {
+        return &std_allocator;
+    }
+
+    static inline const Allocator *allocator_or_default(const Allocator *a) {
+        return a ? a : &std_allocator;
+    }
+
+    static inline void *mem_alloc(const Allocator *a, size_t size) {
+        STATS_ADD(alloc_calls, 1);
+        STATS_ADD(alloc_bytes, size);
+        return a->malloc_fn(a->user, size);
+    }
+
+    static inline void *mem_realloc(const Allocator *a, void *p, size_t old_size, size_t new_size) {
+        STATS_ADD(alloc_calls, 1);
+        STATS_ADD(alloc_bytes, new_size);
+        return a->realloc_fn(a->user, p, old_size, new_size);
+    }
+
+    static inline void mem_free(const Allocator *a, void *p, size_t size) {
+        if (p) a->free_fn(a->user, p, size);
+    }
+
+    static void context_init(Context &c, const char *json, size_t len, const Allocator *alloc) {
+        c.json = json;
+        c.end = json + len;
+        c.stack = NULL;
+        c.size = c.top = 0;
+        c.alloc = allocator_or_default(alloc);
+        c.keys = NULL;
+        c.flags = 0;
+    }
+
+    static unsigned context_flags(const ParseOptions &opt) {
+        return (opt.validate_utf8 ? CONTEXT_VALIDATE_UTF8 : 0) |
+               (opt.allow_comments ? CONTEXT_COMMENTS : 0) |
+               (opt.allow_trailing_commas ? CONTEXT_TRAILING_COMMAS : 0) |
+               (opt.allow_single_quotes ? CONTEXT_SINGLE_QUOTES : 0) |
+               (opt.allow_nan_inf ? CONTEXT_NAN_INF : 0) |
+               (opt.duplicate_keys == DUPLICATE_KEYS_REJECT ? CONTEXT_DUPLICATE_REJECT : 0) |
+               (opt.duplicate_keys == DUPLICATE_KEYS_FIRST ? CONTEXT_DUPLICATE_FIRST : 0) |
+               (opt.duplicate_keys == DUPLICATE_KEYS_LAST ? CONTEXT_DUPLICATE_LAST : 0) |
+               (opt.sort_members ? CONTEXT_SORT_MEMBERS : 0);
+    }
+
+    static void context_free(Context &c) {
+        mem_free(c.alloc, c.stack, c.size);
+        c.stack = NULL;
+        c.size = c.top = 0;
+    }
+
+#ifndef PARSE_STACK_INIT_SIZE
+#define PARSE_STACK_INIT_SIZE 256
+#endif
+
+    static void *context_push(Context &c, size_t size) {
+        void *ret;
+        assert(size > 0);
+        if (c.top + size >= c.size) {
+            size_t old_size = c.size;
+            if (c.size == 0)
+                c.size = PARSE_STACK_INIT_SIZE;
+            while (c.top + size >= c.size) c.size += c.size >> 1;
+            c.stack = (char *) mem_realloc(c.alloc, c.stack, old_size, c.size);
+            STATS_ADD(stack_reallocs, 1);
+        }
+        ret = c.stack + c.top;
+        c.top += size;
+        STATS_MAX(stack_peak, c.top);
+        return ret;
+    }
+
+    static void *context_pop(Context &c, size_t size) {
+        assert(c.top >= size);
+        c.top -= size;
+        return c.stack + c.top;
+    }
+
 #define IS_DIGIT_1_9(ch) (ch <= '9' && ch > '0')
 #define IS_DIGIT(ch) (ch <= '9' && ch >= '0')
 
-    static int parse_number(Context &c, Value &v) {
+    // 宽松语法：NaN、Infinity、-Infinity，p 指向可能的负号之后
+    static int parse_nan_inf(Context &c, Value &v, const char *p) {
+        bool nan = peek(c, p) == 'N', negative = *c.json == '-';
+        for (const char *literal = nan ? "NaN" : "Infinity"; *literal != '\0'; literal++, p++)
+            if (peek(c, p) != *literal) return PARSE_INVALID_VALUE;
+        v.num = nan ? (negative ? -NAN : NAN) : (negative ? -HUGE_VAL : HUGE_VAL);
+        c.json = p;
+        v.type = NUMBER;
+        STATS_NODE(NUMBER);
+        return PARSE_OK;
+    }
 
-        const char *p = c.json;
-        if (*p == '-') ++p;
-        if (*p == '0') {
+    // number = [ "-" ] int [ frac ] [ exp ]，只检查语法不做转换。
+    // 返回数字之后的位置，不合法时返回 NULL
+    static const char *scan_number(const Context &c, const char *p) {
+        if (peek(c, p) == '-') ++p;
+        if (peek(c, p) == '0') {
             ++p;
-            if (IS_DIGIT(*p)) return PARSE_INVALID_VALUE;
+            if (IS_DIGIT(peek(c, p))) return NULL;
         } else {
-            if (!IS_DIGIT_1_9(*p)) return PARSE_INVALID_VALUE;
-            while (IS_DIGIT_1_9(*p)) ++p;
+            if (!IS_DIGIT_1_9(peek(c, p))) return NULL;
+            ++p;
+            while (IS_DIGIT(peek(c, p))) ++p;
         }
-        if (*p == '.') {
+        if (peek(c, p) == '.') {
             p++;
-            if (!IS_DIGIT(*p)) return PARSE_INVALID_VALUE;
-            while (IS_DIGIT(*p)) ++p;
+            if (!IS_DIGIT(peek(c, p))) return NULL;
+            while (IS_DIGIT(peek(c, p))) ++p;
         }
-        if (*p == 'E' || *p == 'e') {
+        if (peek(c, p) == 'E' || peek(c, p) == 'e') {
             p++;
-            if (*p == '+' || *p == '-') p++;
-            if (!IS_DIGIT(*p)) return PARSE_INVALID_VALUE;
-            while (IS_DIGIT(*p)) ++p;
+            if (peek(c, p) == '+' || peek(c, p) == '-') p++;
+            if (!IS_DIGIT(peek(c, p))) return NULL;
+            while (IS_DIGIT(peek(c, p))) ++p;
+        }
+        return p;
+    }
+
+    static int parse_number(Context &c, Value &v) {
+        const char *p = scan_number(c, c.json);
+        if (!p) {
+            // 宽松语法：整数部分不是数字时可能是 NaN、Infinity
+            const char *q = c.json + (*c.json == '-');
+            if ((c.flags & CONTEXT_NAN_INF) && !IS_DIGIT(peek(c, q))) return parse_nan_inf(c, v, q);
+            return PARSE_INVALID_VALUE;
         }
-//        if (*p != '\0') return PARSE_INVALID_VALUE;
 
-        v.num = strtod(c.json, NULL);
+        // strtod 会一直读到非数字字符为止：数字紧贴输入末尾，或后面跟着 "0x" 这种
+        // strtod 认识而语法不认识的字符时，先拷贝到栈上补 '\0' 再转换
+        if (p == c.end || *p == 'x' || *p == 'X') {
+            size_t n = p - c.json;
+            char *tmp = (char *) context_push(c, n + 1);
+            memcpy(tmp, c.json, n);
+            tmp[n] = '\0';
+            v.num = strtod(tmp, NULL);
+            context_pop(c, n + 1);
+        } else {
+            v.num = strtod(c.json, NULL);
+        }
         c.json = p;
         v.type = NUMBER;
+        STATS_NODE(NUMBER);
         return PARSE_OK;
     }
 
-    void value_free(Value &v) {
+    void value_free(Value &v, const Allocator *alloc) {
 //        if (v.type == STRING)
 //            free(v.str);
 //          这种写法嵌套的对象无法释放
 //        if (v.type == ARRAY)
 //            free(v.arr);
+        alloc = allocator_or_default(alloc);
         switch (v.type) {
             case STRING:
-                free(v.str);
+                if (!v.short_len) mem_free(alloc, v.str, v.len + 1);
                 break;
             case ARRAY:
                 for (size_t i = 0; i < v.a_size; i++)
-                    value_free(v.arr[i]);
-                free(v.arr);
+                    value_free(v.arr[i], alloc);
+                mem_free(alloc, v.arr, v.a_size * sizeof(Value));
                 break;
             case OBJECT:
                 for (size_t i = 0; i < v.m_size; i++) {
-                    free(v.m[i].k);
-                    value_free(v.m[i].v);
+                    if (!v.m[i].k_interned) mem_free(alloc, v.m[i].k, v.m[i].k_len + 1);
+                    value_free(v.m[i].v, alloc);
                 }
-                free(v.m);
+                mem_free(alloc, v.m, v.m_size * sizeof(member));
                 break;
             default:
                 break;
@@ -146,34 +903,10 @@ namespace tiny_json {
         v.type = NUL;
     }
 
-#ifndef PARSE_STACK_INIT_SIZE
-#define PARSE_STACK_INIT_SIZE 256
-#endif
-
-    static void *context_push(Context &c, size_t size) {
-        void *ret;
-        assert(size > 0);
-        if (c.top + size >= c.size) {
-            if (c.size == 0)
-                c.size = PARSE_STACK_INIT_SIZE;
-            while (c.top + size >= c.size) c.size += c.size >> 1;
-            c.stack = (char *) realloc(c.stack, c.size);
-        }
-        ret = c.stack + c.top;
-        c.top += size;
-        return ret;
-    }
-
-    static void *context_pop(Context &c, size_t size) {
-        assert(c.top >= size);
-        c.top -= size;
-        return c.stack + c.top;
-    }
-
-    static const char *parse_hex4(const char *p, unsigned int &u) {
+    static const char *parse_hex4(const Context &c, const char *p, unsigned int &u) {
         u = 0;
         for (int i = 0; i < 4; i++) {
-            char ch = *p++;
+            char ch = peek(c, p++);
             u = u << 4;
             if (ch >= '0' && ch <= '9') u |= ch - '0';
             else if (ch >= 'A' && ch <= 'F') u |= ch - 'A' + 10;
@@ -201,16 +934,40 @@ namespace tiny_json {
         }
     }
 
+    // 宽松语法中单引号字符串的扫描：'"' 是普通字符，遇到 '\'' 停下
+    static const char *scan_single_quoted(const char *p, const char *end) {
+        while (p != end && (unsigned char) *p >= 0x20 && *p != '\'' && *p != '\\')
+            p++;
+        return p;
+    }
+
+    // 字符串以 c.json 处的引号开始，只有宽松语法允许单引号
     static int parse_string_raw(Context &c, size_t &len) {
         size_t start = c.top;
         const char *p;
-        assert(*c.json == '"');
+        char quote = *c.json;
+        assert(quote == '"' || (quote == '\'' && (c.flags & CONTEXT_SINGLE_QUOTES)));
         p = ++c.json;
         unsigned int u, u2;
+        const Kernels &k = current_kernels();
+        const char *(*scan)(const char *, const char *) = quote == '"' ? k.scan_string : scan_single_quoted;
+        bool validate = (c.flags & CONTEXT_VALIDATE_UTF8) != 0;
         while (true) {
-            char ch = *(p++);
+            // 不需要处理的字节整段复制
+            const char *q = scan(p, c.end);
+            if (q != p) {
+                if (validate && !k.validate_utf8(p, q)) {
+                    c.top = start;
+                    return PARSE_INVALID_UTF8;
+                }
+                memcpy(context_push(c, q - p), p, q - p);
+                p = q;
+            }
+            char ch = peek(c, p++);
             switch (ch) {
+                // 双引号字符串的扫描不会停在 '\'' 上，单引号字符串的扫描不会停在 '"' 上，遇到的总是结束的引号
                 case '\"':
+                case '\'':
                     len = c.top - start;
                     c.json = p;
                     return PARSE_OK;
@@ -218,10 +975,18 @@ namespace tiny_json {
                     c.top = start;
                     return PARSE_MISS_QUOTATION_MARK;
                 case '\\':
-                    switch (*p++) {
+                    STATS_ADD(escapes, 1);
+                    switch (peek(c, p++)) {
                         case '\"':
                             *(char *) context_push(c, sizeof(char)) = '\"';
                             break;
+                        case '\'':
+                            if (!(c.flags & CONTEXT_SINGLE_QUOTES)) {
+                                c.top = start;
+                                return PARSE_INVALID_STRING_ESCAPE;
+                            }
+                            *(char *) context_push(c, sizeof(char)) = '\'';
+                            break;
                         case '\\':
                             *(char *) context_push(c, sizeof(char)) = '\\';
                             break;
@@ -244,20 +1009,20 @@ namespace tiny_json {
                             *(char *) context_push(c, sizeof(char)) = '\t';
                             break;
                         case 'u':
-                            if (!(p = parse_hex4(p, u))) {
+                            if (!(p = parse_hex4(c, p, u))) {
                                 c.top = start;
                                 return PARSE_INVALID_UNICODE_HEX;
                             }
                             if (u >= 0xD800 && u <= 0xDBFF) {    // surrogate pair
-                                if (*p++ != '\\') {
+                                if (peek(c, p++) != '\\') {
                                     c.top = start;
                                     return PARSE_INVALID_UNICODE_SURROGATE;
                                 }
-                                if (*p++ != 'u') {
+                                if (peek(c, p++) != 'u') {
                                     c.top = start;
                                     return PARSE_INVALID_UNICODE_SURROGATE;
                                 }
-                                if (!(p = parse_hex4(p, u2))) {
+                                if (!(p = parse_hex4(c, p, u2))) {
                                     c.top = start;
                                     return PARSE_INVALID_UNICODE_SURROGATE;
                                 }
@@ -266,6 +1031,10 @@ namespace tiny_json {
                                     return PARSE_INVALID_UNICODE_SURROGATE;
                                 }
                                 u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
+                            } else if (validate && u >= 0xDC00 && u <= 0xDFFF) {
+                                // 孤立的低代理项编码出来不是合法的 UTF-8
+                                c.top = start;
+                                return PARSE_INVALID_UNICODE_SURROGATE;
                             }
                             encode_utf8(c, u);
                             break;
@@ -290,18 +1059,91 @@ namespace tiny_json {
     static int parse_string(Context &c, Value &v) {
         size_t len = 0;
         int ret = parse_string_raw(c, len);
-        if (ret == PARSE_OK)
-            set_string(v, (const char *) context_pop(c, len), len);
+        if (ret == PARSE_OK) {
+            set_string(v, (const char *) context_pop(c, len), len, c.alloc);
+            STATS_NODE(STRING);
+        }
         return ret;
     }
 
     static int parse_value(Context &c, Value &v);
 
+    static size_t hash_bytes(const char *s, size_t len);
+
+    static bool member_less(const member &a, const member &b) {
+        size_t n = a.k_len < b.k_len ? a.k_len : b.k_len;
+        int r = n ? memcmp(a.k, b.k, n) : 0;
+        return r < 0 || (r == 0 && a.k_len < b.k_len);
+    }
+
+    // 稳定的归并排序，tmp 至少能放 n / 2 个成员。
+    // 不用 std::stable_sort，它的临时缓冲区经由 operator new 申请，绕过了 Allocator
+    static void member_sort(member *ms, size_t n, member *tmp) {
+        if (n <= 16) {
+            for (size_t i = 1; i < n; i++) {
+                member m = ms[i];
+                size_t j = i;
+                for (; j && member_less(m, ms[j - 1]); j--)
+                    ms[j] = ms[j - 1];
+                ms[j] = m;
+            }
+            return;
+        }
+        size_t h = n / 2;
+        member_sort(ms, h, tmp);
+        member_sort(ms + h, n - h, tmp);
+        if (!member_less(ms[h], ms[h - 1])) return;
+        // 左半边移到 tmp，写回的位置总在右半边未读的元素之前
+        memcpy(tmp, ms, h * sizeof(member));
+        size_t i = 0, j = h, k = 0;
+        while (i < h && j < n)
+            ms[k++] = member_less(ms[j], tmp[i]) ? ms[j++] : tmp[i++];
+        while (i < h)
+            ms[k++] = tmp[i++];
+    }
+
+    // 按 CONTEXT_DUPLICATE_* 处理栈上刚解析完的 size 个成员，去重后的成员依次前移，size 随之减少。
+    // 临时的开放寻址表存每个键第一次出现（前移后）的下标加 1，0 表示空
+    static int object_dedup(Context &c, member *ms, size_t &size) {
+        size_t capacity = 2;
+        while (capacity < size * 2) capacity *= 2;
+        auto *idx = (size_t *) mem_alloc(c.alloc, capacity * sizeof(size_t));
+        memset(idx, 0, capacity * sizeof(size_t));
+        size_t n = 0;
+        int ret = PARSE_OK;
+        for (size_t i = 0; i < size; i++) {
+            member m = ms[i];
+            size_t j = hash_bytes(m.k, m.k_len) & (capacity - 1);
+            for (; idx[j]; j = (j + 1) & (capacity - 1)) {
+                const member &e = ms[idx[j] - 1];
+                if (e.k_len == m.k_len && memcmp(e.k, m.k, m.k_len) == 0) break;
+            }
+            if (!idx[j]) {
+                ms[n] = m;
+                idx[j] = ++n;
+                continue;
+            }
+            // 拒绝时在第一个重复之前没有前移过，栈上的成员保持原样，由调用者释放
+            if (c.flags & CONTEXT_DUPLICATE_REJECT) {
+                ret = PARSE_DUPLICATE_KEY;
+                break;
+            }
+            if (c.flags & CONTEXT_DUPLICATE_LAST) std::swap(ms[idx[j] - 1].v, m.v);
+            if (!m.k_interned) mem_free(c.alloc, m.k, m.k_len + 1);
+            value_free(m.v, c.alloc);
+        }
+        mem_free(c.alloc, idx, capacity * sizeof(size_t));
+        if (ret == PARSE_OK) size = n;
+        return ret;
+    }
+
     static int parse_array(Context &c, Value &v) {
         assert(*c.json == '[');
+        STATS_DEPTH();
+        STATS_NODE(ARRAY);
         ++c.json;
         parse_whitespace(c);
-        if (*c.json == ']') {
+        if (peek(c, c.json) == ']') {
             ++c.json;
             v.type = ARRAY;
             v.a_size = 0;
@@ -326,13 +1168,19 @@ namespace tiny_json {
             size++;
 
             parse_whitespace(c);
-            if (*c.json == ',') c.json++;
-            else if (*c.json == ']') {
+            if (peek(c, c.json) == ',') {
+                c.json++;
+                // 宽松语法允许最后一个元素后面有逗号
+                if (!(c.flags & CONTEXT_TRAILING_COMMAS)) continue;
+                parse_whitespace(c);
+                if (peek(c, c.json) != ']') continue;
+            }
+            if (peek(c, c.json) == ']') {
                 ++c.json;
                 v.a_size = size;
                 v.type = ARRAY;
                 size *= sizeof(Value);
-                v.arr = (Value *) malloc(size);
+                v.arr = (Value *) mem_alloc(c.alloc, size);
                 memcpy(v.arr, context_pop(c, size), size);
                 return PARSE_OK;
             } else {
@@ -346,15 +1194,17 @@ namespace tiny_json {
             }
         }
         for (int i = 0; i < size; i++)
-            value_free(*(Value *) context_pop(c, sizeof(Value)));
+            value_free(*(Value *) context_pop(c, sizeof(Value)), c.alloc);
         return ret;
     }
 
     static int parse_object(Context &c, Value &v) {
         assert(*c.json == '{');
+        STATS_DEPTH();
+        STATS_NODE(OBJECT);
         ++c.json;
         parse_whitespace(c);
-        if (*c.json == '}') {
+        if (peek(c, c.json) == '}') {
             ++c.json;
             v.type = OBJECT;
             v.m_size = 0;
@@ -366,25 +1216,33 @@ namespace tiny_json {
         member m{};
         int ret = 0;
         while (true) {
-            Value tmp;
-            init(tmp);
+            size_t k_len;
             init(m.v);
 
             // parse key
             parse_whitespace(c);
-            if (*c.json != '"') {
+            if (peek(c, c.json) != '"' && !(peek(c, c.json) == '\'' && (c.flags & CONTEXT_SINGLE_QUOTES))) {
                 ret = PARSE_MISS_KEY;
                 break;
             }
-            ret = parse_string(c, tmp);
+            ret = parse_string_raw(c, k_len);
             if (ret != PARSE_OK) break;
-            assert(tmp.type == STRING);
-            m.k_len = tmp.len;
-            m.k = tmp.str;
+            // 键总是放在堆上（或键表里），短字符串优化只用于 Value
+            m.k_len = k_len;
+            if (c.keys) {
+                m.k = (char *) key_table_intern(c.keys, (const char *) context_pop(c, k_len), k_len);
+                m.k_interned = 1;
+            } else {
+                m.k = (char *) mem_alloc(c.alloc, k_len + 1);
+                // 空键可能出现在栈还没有分配的时候，此时 context_pop 返回 NULL
+                if (k_len) memcpy(m.k, context_pop(c, k_len), k_len);
+                m.k[k_len] = '\0';
+                m.k_interned = 0;
+            }
 
             // parse ws colon ws
             parse_whitespace(c);
-            if (*c.json != ':') {
+            if (peek(c, c.json) != ':') {
                 ret = PARSE_MISS_COLON;
                 break;
             }
@@ -400,32 +1258,49 @@ namespace tiny_json {
 
             // parse ws [comma | right-curly-brace] ws
             parse_whitespace(c);
-            if (*c.json == ',') ++c.json;
-            else if (*c.json == '}') {
+            if (peek(c, c.json) == ',') {
+                ++c.json;
+                if (!(c.flags & CONTEXT_TRAILING_COMMAS)) continue;
+                parse_whitespace(c);
+                if (peek(c, c.json) != '}') continue;
+            }
+            if (peek(c, c.json) == '}') {
                 ++c.json;
-                v.m_size = size;
+                auto *ms = (member *) (c.stack + c.top - size * sizeof(member));
+                size_t n = size;
+                if ((c.flags & CONTEXT_DUPLICATE_MASK) && size > 1 && (ret = object_dedup(c, ms, n)) != PARSE_OK)
+                    break;
+                if (c.flags & CONTEXT_SORT_MEMBERS) {
+                    // 归并用的临时空间也放在栈上，压栈可能让栈搬迁，之后重新取 ms
+                    size_t offset = (char *) ms - c.stack, half = n / 2 * sizeof(member);
+                    member *tmp = half ? (member *) context_push(c, half) : NULL;
+                    ms = (member *) (c.stack + offset);
+                    member_sort(ms, n, tmp);
+                    if (half) context_pop(c, half);
+                }
+                context_pop(c, size * sizeof(member));
+                v.m_size = n;
                 v.type = OBJECT;
-                size = size * sizeof(member);
-                v.m = (member *) malloc(size);
-                memcpy(v.m, context_pop(c, size), size);
+                v.m = (member *) mem_alloc(c.alloc, n * sizeof(member));
+                memcpy(v.m, ms, n * sizeof(member));
                 return PARSE_OK;
             } else {
                 ret = PARSE_MISS_COMMA_OR_CURLY_BRACKET;
                 break;
             }
         }
-        free(m.k);
+        if (m.k && !m.k_interned) mem_free(c.alloc, m.k, m.k_len + 1);
         for (int i = 0; i < size; i++) {
             auto *tmp = (member *) context_pop(c, sizeof(member));
-            free(tmp->k);
-            value_free(tmp->v);
+            if (!tmp->k_interned) mem_free(c.alloc, tmp->k, tmp->k_len + 1);
+            value_free(tmp->v, c.alloc);
         }
         v.type = NUL;
         return ret;
     }
 
     static int parse_value(Context &c, Value &v) {
-        switch (*(c.json)) {
+        switch (peek(c, c.json)) {
             case 'n':
                 return parse_literal(c, v, "null", NUL);
             case 'f':
@@ -434,6 +1309,9 @@ namespace tiny_json {
                 return parse_literal(c, v, "true", TRUE);
             case '"':
                 return parse_string(c, v);
+            case '\'':
+                if (!(c.flags & CONTEXT_SINGLE_QUOTES)) return PARSE_INVALID_VALUE;
+                return parse_string(c, v);
             case '[':
                 return parse_array(c, v);
             case '{':
@@ -446,211 +1324,3161 @@ namespace tiny_json {
     }
 
     // JSON-text = ws value ws
-    int parse(Value &v, const char *json) {
-        Context c;
-        c.json = json;
-        c.stack = NULL;
-        c.size = c.top = 0;
+    static int parse_root(Context &c, Value &v) {
+        STATS_SCOPE();
+        STATS_ADD(bytes_parsed, c.end - c.json);
         init(v);
         parse_whitespace(c);
         int ret = parse_value(c, v);
         if (ret == PARSE_OK) {
             parse_whitespace(c);
-            if (*c.json != '\0') return PARSE_ROOT_NOT_SINGULAR;
+            if (c.json != c.end) {
+                value_free(v, c.alloc);
+                ret = PARSE_ROOT_NOT_SINGULAR;
+            }
         }
         assert(c.top == 0);
-        free(c.stack);
         return ret;
     }
 
+    int parse(Value &v, const char *json) {
+        return parse(v, json, strlen(json));
+    }
 
-    Type get_type(const Value &v) {
-        return v.type;
+    int parse(Value &v, const char *json, size_t len) {
+        return parse(v, json, len, ParseOptions());
     }
 
-    int get_boolean(const Value &v) {
-        assert(v.type == FALSE || v.type == TRUE);
-        return v.type;
+    int parse(Value &v, const char *json, size_t len, const ParseOptions &opt) {
+        // parse_parallel 不适用时以 threads = 1 回到这里
+        if (opt.threads != 1) return parse_parallel(v, json, len, opt);
+        Context c;
+        context_init(c, json, len, opt.alloc);
+        c.keys = opt.keys;
+        c.flags = context_flags(opt);
+        int ret = parse_root(c, v);
+        context_free(c);
+        return ret;
     }
 
-    void set_boolean(Value &v, bool flag) {
-        value_free(v);
-        v.type = flag ? TRUE : FALSE;
+    void parser_init(Parser &p, size_t retain) {
+        context_init(p.c, NULL, 0, NULL);
+        p.retain = retain;
     }
 
-    double get_number(const Value &v) {
-        assert(v.type == NUMBER);
-        return v.num;
+    void parser_free(Parser &p) {
+        context_free(p.c);
     }
 
-    void set_number(Value &v, double num) {
-        value_free(v);
-        v.type = NUMBER;
-        v.num = num;
+    int parse(Parser &p, Value &v, const char *json) {
+        return parse(p, v, json, strlen(json));
     }
 
-    const char *get_string(const Value &v) {
-        assert(v.type == STRING);
-        return v.str;
+    int parse(Parser &p, Value &v, const char *json, size_t len) {
+        Context &c = p.c;
+        const Allocator *alloc = allocator_or_default(p.opt.alloc);
+        if (c.alloc != alloc) {
+            // 栈必须用申请它的分配器归还
+            context_free(c);
+            c.alloc = alloc;
+        }
+        c.json = json;
+        c.end = json + len;
+        c.top = 0;
+        c.keys = p.opt.keys;
+        c.flags = context_flags(p.opt);
+        int ret = parse_root(c, v);
+        // 超过保留上限的栈交还给系统，避免一次大文档让解析器一直占着内存
+        if (c.size > p.retain)
+            parser_free(p);
+        return ret;
     }
 
-    size_t get_string_length(Value &v) {
-        assert(v.type == STRING);
-        return strlen(v.str);
+    void reader_init(Reader &r, const char *json, size_t len, const Allocator *alloc) {
+        context_init(r.c, json, len, alloc);
+        r.first = false;
     }
 
-    void set_string(Value &v, const char *s, size_t len) {
-        assert(s != NULL || len == 0);
-        value_free(v);
-        v.str = (char *) malloc(len + 1);
-        memcpy(v.str, s, len);
-        v.str[len] = '\0';
-        v.len = len;
-        v.type = STRING;
+    void reader_free(Reader &r) {
+        context_free(r.c);
     }
 
-    size_t get_array_size(const Value &v) {
-        assert(v.type == ARRAY);
-        return v.a_size;
+    // 每次读取前清空栈，上一次 reader_string 返回的内容随之失效
+    static inline Context &reader_begin(Reader &r) {
+        r.c.top = 0;
+        parse_whitespace(r.c);
+        return r.c;
     }
 
-    Value *get_array_element(const Value &v, size_t index) {
-        assert(v.type == ARRAY);
-        assert(v.a_size > index);
-        return &v.arr[index];
+    int reader_peek(Reader &r, Type &type) {
+        Context &c = reader_begin(r);
+        switch (peek(c, c.json)) {
+            case 'n':
+                type = NUL;
+                return PARSE_OK;
+            case 'f':
+                type = FALSE;
+                return PARSE_OK;
+            case 't':
+                type = TRUE;
+                return PARSE_OK;
+            case '"':
+                type = STRING;
+                return PARSE_OK;
+            case '[':
+                type = ARRAY;
+                return PARSE_OK;
+            case '{':
+                type = OBJECT;
+                return PARSE_OK;
+            case '\0':
+                return PARSE_EXPECT_VALUE;
+            default:
+                type = NUMBER;
+                return PARSE_OK;
+        }
     }
 
-    size_t get_object_size(const Value &v) {
-        assert(v.type == OBJECT);
-        return v.m_size;
+    int reader_null(Reader &r) {
+        Value v;
+        Context &c = reader_begin(r);
+        if (peek(c, c.json) != 'n') return PARSE_TYPE_MISMATCH;
+        return parse_literal(c, v, "null", NUL);
     }
 
-    const char *get_object_key(const Value &v, size_t index) {
-        assert(v.type == OBJECT);
-        assert(v.m_size > index);
-        return v.m[index].k;
+    int reader_bool(Reader &r, bool &b) {
+        Value v;
+        Context &c = reader_begin(r);
+        switch (peek(c, c.json)) {
+            case 't':
+                b = true;
+                return parse_literal(c, v, "true", TRUE);
+            case 'f':
+                b = false;
+                return parse_literal(c, v, "false", FALSE);
+            default:
+                return PARSE_TYPE_MISMATCH;
+        }
     }
 
-    size_t get_object_key_length(const Value &v, size_t index) {
-        assert(v.type == OBJECT);
-        assert(v.m_size > index);
-        return v.m[index].k_len;
+    int reader_number(Reader &r, double &d) {
+        Value v;
+        Context &c = reader_begin(r);
+        char ch = peek(c, c.json);
+        if (ch != '-' && !IS_DIGIT(ch)) return PARSE_TYPE_MISMATCH;
+        int ret = parse_number(c, v);
+        if (ret == PARSE_OK) d = v.num;
+        return ret;
     }
 
-    Value *get_object_value(const Value &v, size_t index) {
-        assert(v.type == OBJECT);
-        assert(v.m_size > index);
-        return &v.m[index].v;
+    int reader_string(Reader &r, const char *&s, size_t &len) {
+        Context &c = reader_begin(r);
+        if (peek(c, c.json) != '"') return PARSE_TYPE_MISMATCH;
+        int ret = parse_string_raw(c, len);
+        // 内容留在栈底，直到下一次读取
+        s = c.stack;
+        return ret;
     }
 
-    static void stringify_string(Context &c, const char *str, size_t len) {
-        *(char *) context_push(c, 1) = '"';
-        for (size_t i = 0; i < len; i++) {
-            unsigned char ch = (unsigned char) str[i];
+    int reader_value(Reader &r, Value &v) {
+        Context &c = reader_begin(r);
+        init(v);
+        return parse_value(c, v);
+    }
+
+    // 跳过一个值：语法检查和错误码与 parse_value 相同，但不构建值树，也不往栈上复制字符串
+    static int skip_string(Context &c) {
+        char quote = *c.json;
+        const Kernels &k = current_kernels();
+        const char *(*scan)(const char *, const char *) = quote == '"' ? k.scan_string : scan_single_quoted;
+        bool validate = (c.flags & CONTEXT_VALIDATE_UTF8) != 0;
+        const char *p = ++c.json;
+        unsigned u;
+        while (true) {
+            const char *q = scan(p, c.end);
+            if (validate && q != p && !k.validate_utf8(p, q)) return PARSE_INVALID_UTF8;
+            p = q;
+            char ch = peek(c, p++);
             switch (ch) {
+                case '\"':
+                case '\'':
+                    c.json = p;
+                    return PARSE_OK;
+                case '\0':
+                    return PARSE_MISS_QUOTATION_MARK;
                 case '\\':
-                    memcpy((char *) context_push(c, 2), "\\\\", 2);
-                    break;
-                case '\"' :
-                    memcpy((char *) context_push(c, 2), "\\\"", 2);
-                    break;
-                case '\b':
-                    memcpy((char *) context_push(c, 2), "\\b", 2);
-                    break;
-                case '\f':
-                    memcpy((char *) context_push(c, 2), "\\f", 2);
-                    break;
-                case '\r':
-                    memcpy((char *) context_push(c, 2), "\\r", 2);
-                    break;
-                case '\n':
-                    memcpy((char *) context_push(c, 2), "\\n", 2);
-                    break;
-                case '\t':
-                    memcpy((char *) context_push(c, 2), "\\t", 2);
+                    switch (peek(c, p++)) {
+                        case '\'':
+                            if (!(c.flags & CONTEXT_SINGLE_QUOTES)) return PARSE_INVALID_STRING_ESCAPE;
+                            break;
+                        case '\"':
+                        case '\\':
+                        case '/':
+                        case 'b':
+                        case 'f':
+                        case 'n':
+                        case 'r':
+                        case 't':
+                            break;
+                        case 'u':
+                            if (!(p = parse_hex4(c, p, u))) return PARSE_INVALID_UNICODE_HEX;
+                            if (u >= 0xD800 && u <= 0xDBFF) {
+                                if (peek(c, p++) != '\\' || peek(c, p++) != 'u' || !(p = parse_hex4(c, p, u)) ||
+                                    u < 0xDC00 || u > 0xDFFF)
+                                    return PARSE_INVALID_UNICODE_SURROGATE;
+                            } else if (validate && u >= 0xDC00 && u <= 0xDFFF) {
+                                return PARSE_INVALID_UNICODE_SURROGATE;
+                            }
+                            break;
+                        default:
+                            return PARSE_INVALID_STRING_ESCAPE;
+                    }
                     break;
                 default:
-                    if (ch < 0x20) {
-                        char buffer[7];
-                        sprintf(buffer, "\\u%04X", ch);
-                        memcpy((char *) context_push(c, 6), buffer, 6);
-                    } else {
-                        *(char *) context_push(c, 1) = str[i];
-                    }
+                    if ((unsigned char) ch < 0x20) return PARSE_INVALID_STRING_CHAR;
             }
-
         }
-        *(char *) context_push(c, 1) = '"';
     }
 
-    static int stringify_value(Context &c, const Value &v);
+    static int skip_value(Context &c);
 
-    static void stringify_array(Context &c, const Value &v) {
-        *(char *) context_push(c, 1) = '[';
-        for (size_t i = 0; i < v.a_size; i++) {
-            stringify_value(c, v.arr[i]);
-            if (i != v.a_size - 1)
-                *(char *) context_push(c, 1) = ',';
+    // 数组和对象共用：open 之后是逗号分隔的元素，对象的元素是 key ':' value
+    static int skip_container(Context &c, bool object) {
+        char close = object ? '}' : ']';
+        ++c.json;
+        parse_whitespace(c);
+        if (peek(c, c.json) == close) {
+            ++c.json;
+            return PARSE_OK;
+        }
+        int ret;
+        while (true) {
+            parse_whitespace(c);
+            if (object) {
+                char ch = peek(c, c.json);
+                if (ch != '"' && !(ch == '\'' && (c.flags & CONTEXT_SINGLE_QUOTES))) return PARSE_MISS_KEY;
+                if ((ret = skip_string(c)) != PARSE_OK) return ret;
+                parse_whitespace(c);
+                if (peek(c, c.json) != ':') return PARSE_MISS_COLON;
+                ++c.json;
+                parse_whitespace(c);
+            }
+            if ((ret = skip_value(c)) != PARSE_OK) return ret;
+            parse_whitespace(c);
+            if (peek(c, c.json) == ',') {
+                ++c.json;
+                if (!(c.flags & CONTEXT_TRAILING_COMMAS)) continue;
+                parse_whitespace(c);
+                if (peek(c, c.json) != close) continue;
+            }
+            if (peek(c, c.json) != close)
+                return object ? PARSE_MISS_COMMA_OR_CURLY_BRACKET : PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+            ++c.json;
+            return PARSE_OK;
         }
-        *(char *) context_push(c, 1) = ']';
     }
 
-    static void stringify_object(Context &c, const Value &v) {
-        *(char *) context_push(c, 1) = '{';
-        for (size_t i = 0; i < v.m_size; i++) {
-            stringify_string(c, v.m[i].k, v.m[i].k_len);
-            *(char *) context_push(c, 1) = ':';
-            stringify_value(c, v.m[i].v);
-            if (i != v.m_size - 1)
-                *(char *) context_push(c, 1) = ',';
+    static int skip_value(Context &c) {
+        switch (peek(c, c.json)) {
+            case '\'':
+                if (!(c.flags & CONTEXT_SINGLE_QUOTES)) return PARSE_INVALID_VALUE;
+                return skip_string(c);
+            case '"':
+                return skip_string(c);
+            case '[':
+                return skip_container(c, false);
+            case '{':
+                return skip_container(c, true);
+            case 'n':
+            case 'f':
+            case 't':
+            case '\0': {
+                // 字面量只比较字节，不分配内存
+                Value v;
+                init(v);
+                return parse_value(c, v);
+            }
+            default: {
+                // 数字只检查语法，不调用 strtod，也就不需要在栈上补 '\0'
+                const char *p = scan_number(c, c.json);
+                if (p) {
+                    c.json = p;
+                    return PARSE_OK;
+                }
+                // 不合法的数字或宽松语法的 NaN、Infinity，都不会分配内存
+                Value v;
+                init(v);
+                return parse_number(c, v);
+            }
         }
-        *(char *) context_push(c, 1) = '}';
     }
 
-    static int stringify_value(Context &c, const Value &v) {
-        size_t i;
-        int ret;
-        switch (v.type) {
-            case NUL:
-                memcpy(context_push(c, 4), "null", 4);
-                break;
-            case FALSE:
-                memcpy(context_push(c, 5), "false", 5);
-                break;
-            case TRUE:
-                memcpy(context_push(c, 4), "true", 4);
-                break;
-            case STRING:
-                stringify_string(c, v.str, v.len);
-                break;
-            case NUMBER:
-                c.top -= 32 - sprintf((char *) context_push(c, 32), "%.17g", v.num);
-                break;
-            case ARRAY:
-                stringify_array(c, v);
-                break;
-            case OBJECT:
-                stringify_object(c, v);
-                break;
-            default:
-                break;
+    int reader_skip(Reader &r) {
+        return skip_value(reader_begin(r));
+    }
+
+    int reader_begin_array(Reader &r) {
+        Context &c = reader_begin(r);
+        if (peek(c, c.json) != '[') return PARSE_TYPE_MISMATCH;
+        ++c.json;
+        r.first = true;
+        return PARSE_OK;
+    }
+
+    // 嵌套的容器总是在外层继续之前读完，所以一个 first 标记就够了
+    int reader_next_element(Reader &r, bool &more) {
+        Context &c = reader_begin(r);
+        char ch = peek(c, c.json);
+        if (ch == ']') {
+            ++c.json;
+            more = false;
+        } else if (r.first) {
+            more = true;
+        } else if (ch == ',') {
+            ++c.json;
+            more = true;
+        } else {
+            return PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
         }
-        return STRINGIFY_OK;
+        r.first = false;
+        return PARSE_OK;
     }
 
-#define PARSE_STRINGIFY_INIT_SIZE 256
+    int reader_begin_object(Reader &r) {
+        Context &c = reader_begin(r);
+        if (peek(c, c.json) != '{') return PARSE_TYPE_MISMATCH;
+        ++c.json;
+        r.first = true;
+        return PARSE_OK;
+    }
 
-    char *stringify(const Value &v, size_t &len) {
-        Context c;
-        int ret;
-        c.stack = (char *) malloc(PARSE_STRINGIFY_INIT_SIZE);
-        c.size = PARSE_STRINGIFY_INIT_SIZE;
-        c.top = 0;
-        ret = stringify_value(c, v);
-        assert(ret == STRINGIFY_OK);
-        len = c.top;
-        *(char *) context_push(c, 1) = '\0';
-        return c.stack;
+    int reader_next_member(Reader &r, bool &more, const char *&k, size_t &klen) {
+        Context &c = reader_begin(r);
+        char ch = peek(c, c.json);
+        more = false;
+        if (ch == '}') {
+            ++c.json;
+            r.first = false;
+            return PARSE_OK;
+        }
+        if (!r.first) {
+            if (ch != ',') return PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+            ++c.json;
+            parse_whitespace(c);
+        }
+        r.first = false;
+        if (peek(c, c.json) != '"') return PARSE_MISS_KEY;
+        int ret = parse_string_raw(c, klen);
+        if (ret != PARSE_OK) return ret;
+        k = c.stack;
+        parse_whitespace(c);
+        if (peek(c, c.json) != ':') return PARSE_MISS_COLON;
+        ++c.json;
+        more = true;
+        return PARSE_OK;
+    }
+
+    int reader_end(Reader &r) {
+        Context &c = reader_begin(r);
+        return c.json == c.end ? PARSE_OK : PARSE_ROOT_NOT_SINGULAR;
+    }
+
+    struct MappedFile {
+        const char *data;
+        size_t size;
+    };
+
+    static bool map_file(const char *path, MappedFile &f) {
+        f.data = NULL;
+        f.size = 0;
+#ifdef _WINDOWS
+        FILE *fp = fopen(path, "rb");
+        if (!fp) return false;
+        fseek(fp, 0, SEEK_END);
+        long n = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        if (n > 0) {
+            char *buf = (char *) malloc(n);
+            if (fread(buf, 1, n, fp) != (size_t) n) {
+                free(buf);
+                fclose(fp);
+                return false;
+            }
+            f.data = buf;
+            f.size = n;
+        }
+        fclose(fp);
+        return true;
+#else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return false;
+        }
+        if (st.st_size > 0) {
+            void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                return false;
+            }
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            f.data = (const char *) p;
+            f.size = st.st_size;
+        }
+        close(fd);
+        return true;
+#endif
+    }
+
+    static void unmap_file(MappedFile &f) {
+#ifdef _WINDOWS
+        free((void *) f.data);
+#else
+        if (f.data) munmap((void *) f.data, f.size);
+#endif
+        f.data = NULL;
+        f.size = 0;
+    }
+
+    int parse_file(Value &v, const char *path, const ParseOptions &opt) {
+        MappedFile f;
+        init(v);
+        if (!map_file(path, f)) return PARSE_FILE_ERROR;
+        // 直接在映射的页面上做有界解析，不需要拷贝一份补 '\0'
+        int ret = parse(v, f.data, f.size, opt);
+        unmap_file(f);
+        return ret;
+    }
+
+    struct Record {
+        const char *begin, *end;
+    };
+
+    // 按换行切分记录。合法的字符串（包括宽松语法的单引号字符串）里不会出现原始的换行字节，
+    // 所以不需要跟踪引号和注释，直接用 memchr 找换行；一条记录出错也不会吞掉后面的行。
+    // 只含空白的行直接跳过。
+    static void ndjson_split(const char *p, const char *end, std::vector<Record> &records) {
+        while (p != end) {
+            auto *nl = (const char *) memchr(p, '\n', end - p);
+            const char *line_end = nl ? nl : end;
+            const char *q = p;
+            while (q != line_end && (*q == ' ' || *q == '\t' || *q == '\r')) q++;
+            if (q != line_end) records.push_back({p, line_end});
+            p = nl ? nl + 1 : end;
+        }
+    }
+
+#ifndef NDJSON_BATCH_SIZE
+#define NDJSON_BATCH_SIZE 256
+#endif
+
+#ifndef NDJSON_ARENA_BLOCK_SIZE
+#define NDJSON_ARENA_BLOCK_SIZE (1 << 16)
+#endif
+
+    // 工作线程的 arena：记录的值按顺序从块里切出，单独释放只在刚好是最后一块时回退，
+    // 其余等整批记录回调完后由 arena_reset 一起归还
+    struct alignas(std::max_align_t) ArenaBlock {
+        ArenaBlock *next;
+        size_t size, used;
+    };
+
+    struct Arena {
+        ArenaBlock *blocks;
+        const Allocator *parent;
+        Allocator alloc;
+    };
+
+    static inline size_t arena_round(size_t size) {
+        return (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    }
+
+    // p 是否是最近一次从当前块切出的 size 字节
+    static inline bool arena_is_last(const ArenaBlock *b, const void *p, size_t size) {
+        return b && (const char *) p + arena_round(size) == (const char *) (b + 1) + b->used;
+    }
+
+    static void *arena_malloc(void *user, size_t size) {
+        auto *a = (Arena *) user;
+        size = arena_round(size);
+        ArenaBlock *b = a->blocks;
+        if (!b || b->size - b->used < size) {
+            size_t block = size > NDJSON_ARENA_BLOCK_SIZE ? size : NDJSON_ARENA_BLOCK_SIZE;
+            b = (ArenaBlock *) mem_alloc(a->parent, sizeof(ArenaBlock) + block);
+            b->size = block;
+            b->used = 0;
+            b->next = a->blocks;
+            a->blocks = b;
+        }
+        void *p = (char *) (b + 1) + b->used;
+        b->used += size;
+        return p;
+    }
+
+    static void *arena_realloc(void *user, void *p, size_t old_size, size_t new_size) {
+        auto *a = (Arena *) user;
+        ArenaBlock *b = a->blocks;
+        // 解析栈总是最近一次分配，通常可以原地增长
+        if (p && arena_is_last(b, p, old_size) &&
+            b->size - b->used + arena_round(old_size) >= arena_round(new_size)) {
+            b->used += arena_round(new_size) - arena_round(old_size);
+            return p;
+        }
+        void *q = arena_malloc(user, new_size);
+        if (p) memcpy(q, p, old_size < new_size ? old_size : new_size);
+        return q;
+    }
+
+    static void arena_free(void *user, void *p, size_t size) {
+        ArenaBlock *b = ((Arena *) user)->blocks;
+        if (arena_is_last(b, p, size)) b->used -= arena_round(size);
+    }
+
+    static void arena_init(Arena &a, const Allocator *parent) {
+        a.blocks = NULL;
+        a.parent = allocator_or_default(parent);
+        a.alloc = {arena_malloc, arena_realloc, arena_free, &a};
+    }
+
+    // 保留最近的一块（通常也是最大的）供下一批使用，其余归还
+    static void arena_reset(Arena &a) {
+        ArenaBlock *b = a.blocks;
+        if (!b) return;
+        for (ArenaBlock *next = b->next; next;) {
+            ArenaBlock *tmp = next->next;
+            mem_free(a.parent, next, sizeof(ArenaBlock) + next->size);
+            next = tmp;
+        }
+        b->next = NULL;
+        b->used = 0;
+    }
+
+    static void arena_destroy(Arena &a) {
+        arena_reset(a);
+        if (a.blocks) mem_free(a.parent, a.blocks, sizeof(ArenaBlock) + a.blocks->size);
+        a.blocks = NULL;
+    }
+
+    int parse_ndjson(const char *json, size_t len, ndjson_callback cb, void *user, const NdjsonOptions &opt) {
+        // 整个 NDJSON 算一次调用，工作线程上每条记录的计数都合并到这里
+        STATS_SCOPE();
+        std::vector<Record> records;
+        ndjson_split(json, json + len, records);
+        size_t n = records.size();
+
+        unsigned threads = opt.threads ? opt.threads : std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        size_t batches = (n + NDJSON_BATCH_SIZE - 1) / NDJSON_BATCH_SIZE;
+        if (threads > batches) threads = batches ? (unsigned) batches : 1;
+
+        // 有序模式下一次解析一个窗口的记录，再由调用线程按顺序回调；
+        // 无序模式下工作线程解析完立刻回调，窗口就是全部记录
+        size_t window = opt.ordered ? (size_t) threads * NDJSON_BATCH_SIZE * 4 : n;
+        std::vector<Value> values(opt.ordered ? window : 0);
+        std::atomic<size_t> error_index(n);
+        // 每个工作线程一个 arena，跨窗口复用；vector 不再改变大小，arena 的地址不变
+        std::vector<Arena> arenas(opt.arena ? threads : 0);
+        for (auto &a: arenas)
+            arena_init(a, opt.parse.alloc);
+
+        for (size_t base = 0; base < n && error_index.load() == n; base += window) {
+            size_t limit = base + window < n ? base + window : n;
+            std::atomic<size_t> next(base);
+            for (size_t i = base; opt.ordered && i < limit; i++)
+                init(values[i - base]);
+
+            auto worker = [&](unsigned t) {
+                // 每个工作线程持有自己的 Context，解析栈在记录之间复用；
+                // 使用 arena 时栈和值都从这个线程的 arena 里分配
+                Arena *arena = opt.arena ? &arenas[t] : NULL;
+                Context c;
+                context_init(c, NULL, 0, arena ? &arena->alloc : opt.parse.alloc);
+                c.keys = opt.parse.keys;
+                c.flags = context_flags(opt.parse);
+                size_t i;
+                while ((i = next.fetch_add(NDJSON_BATCH_SIZE)) < limit) {
+                    size_t last = i + NDJSON_BATCH_SIZE < limit ? i + NDJSON_BATCH_SIZE : limit;
+                    for (; i < last; i++) {
+                        if (i > error_index.load(std::memory_order_relaxed)) break;
+                        Value tmp;
+                        Value &v = opt.ordered ? values[i - base] : tmp;
+                        c.json = records[i].begin;
+                        c.end = records[i].end;
+                        int ret = parse_root(c, v);
+                        if (ret != PARSE_OK) {
+                            size_t cur = error_index.load();
+                            while (i < cur && !error_index.compare_exchange_weak(cur, i));
+                            break;
+                        }
+                        if (!opt.ordered) {
+                            cb(v, i, user);
+                            if (!arena) value_free(v, c.alloc);
+                        }
+                    }
+                    // 无序模式下这一批已经全部回调，连同栈一起归还给 arena
+                    if (arena && !opt.ordered) {
+                        context_free(c);
+                        arena_reset(*arena);
+                    }
+                }
+                context_free(c);
+            };
+
+            if (threads == 1) {
+                worker(0);
+            } else {
+                std::vector<Stats> stats(threads);
+                std::vector<std::thread> pool;
+                for (unsigned t = 0; t < threads; t++) {
+                    pool.emplace_back([&worker, &stats, t]() {
+                        STATS_WORKER(stats[t], 0);
+                        worker(t);
+                    });
+                }
+                for (auto &t: pool)
+                    t.join();
+                for (unsigned t = 0; t < threads; t++)
+                    STATS_MERGE(stats[t]);
+            }
+
+            if (opt.ordered) {
+                size_t stop = error_index.load() < limit ? error_index.load() : limit;
+                for (size_t i = base; i < limit; i++) {
+                    if (i < stop) cb(values[i - base], i, user);
+                    if (!opt.arena) value_free(values[i - base], opt.parse.alloc);
+                }
+                for (auto &a: arenas)
+                    arena_reset(a);
+            }
+        }
+        for (auto &a: arenas)
+            arena_destroy(a);
+
+        if (error_index.load() == n) return PARSE_OK;
+        // 重新解析最早出错的那条记录拿到错误码，这样结果与线程调度无关
+        Value v;
+        const Record &r = records[error_index.load()];
+        return parse(v, r.begin, r.end - r.begin, opt.parse);
+    }
+
+    int parse_ndjson(const char *path, ndjson_callback cb, void *user, const NdjsonOptions &opt) {
+        MappedFile f;
+        if (!map_file(path, f)) return PARSE_FILE_ERROR;
+        int ret = parse_ndjson(f.data, f.size, cb, user, opt);
+        unmap_file(f);
+        return ret;
+    }
+
+#ifndef PARSE_PARALLEL_MIN_SIZE
+#define PARSE_PARALLEL_MIN_SIZE (1 << 16)
+#endif
+
+    // 结构预扫描：找到顶层数组的右括号，并在每个字节目标位置之后的第一个顶层逗号处切分。
+    // 只跟踪字符串和嵌套深度，不做校验，切分错误会在分块解析时暴露出来。
+    // flags 里的宽松语法会影响扫描：注释和单引号字符串里的括号、逗号都要跳过。
+    // 这一遍是串行的，字符串内容和空白用当前的扫描内核成段跳过，不逐字节判断
+    static const char *scan_array_splits(const char *p, const char *end, unsigned parts, unsigned flags,
+                                         std::vector<const char *> &splits) {
+        assert(*p == '[');
+        const Kernels &k = current_kernels();
+        size_t step = (end - p) / parts;
+        const char *target = p + step;
+        // 各层期待的右括号，对不上时交给串行解析报错
+        std::vector<char> closers;
+        for (; p != end; ++p) {
+            switch (*p) {
+                case ' ':
+                case '\t':
+                case '\n':
+                case '\r':
+                    // 循环末尾还会前进一个字节
+                    p = k.skip_whitespace(p, end) - 1;
+                    break;
+                case '\'':
+                    if (!(flags & CONTEXT_SINGLE_QUOTES)) break;
+                    // fallthrough
+                case '"': {
+                    char quote = *p;
+                    const char *(*scan)(const char *, const char *) = quote == '"' ? k.scan_string : scan_single_quoted;
+                    // 扫描在引号、反斜杠和控制字符处停下，控制字符留给分块解析报错
+                    for (++p; (p = scan(p, end)) != end && *p != quote; ++p)
+                        if (*p == '\\' && ++p == end) return NULL;
+                    if (p == end) return NULL;
+                    break;
+                }
+                case '/':
+                    if (!(flags & CONTEXT_COMMENTS) || p + 1 == end) break;
+                    if (p[1] == '/') {
+                        while (p != end && *p != '\n') ++p;
+                        if (p == end) return NULL;
+                    } else if (p[1] == '*') {
+                        for (p += 2; p != end && !(*p == '*' && p + 1 != end && p[1] == '/'); ++p);
+                        if (p == end) return NULL;
+                        ++p;
+                    }
+                    break;
+                case '[':
+                    closers.push_back(']');
+                    break;
+                case '{':
+                    closers.push_back('}');
+                    break;
+                case ']':
+                case '}':
+                    if (closers.back() != *p) return NULL;
+                    closers.pop_back();
+                    if (closers.empty()) return p;
+                    break;
+                case ',':
+                    if (closers.size() == 1 && p >= target) {
+                        splits.push_back(p);
+                        target = p + step;
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        return NULL;
+    }
+
+    struct ArrayChunk {
+        Context c;
+        size_t size;
+        int ret;
+        bool tail;      // 允许尾随逗号时的最后一个分块，可以以逗号结尾；不是第一块时还可以为空
+    };
+
+    // elements = ws value ws *(',' ws value ws)，一直解析到 c.end
+    static void parse_array_chunk(ArrayChunk &chunk) {
+        Context &c = chunk.c;
+        chunk.size = 0;
+        // 分块前面是 '[' 或切分处的逗号
+        bool after_comma = chunk.tail && c.json[-1] == ',';
+        while (true) {
+            Value tmp;
+            init(tmp);
+            parse_whitespace(c);
+            if (after_comma && c.json == c.end) {
+                chunk.ret = PARSE_OK;
+                return;
+            }
+            if ((chunk.ret = parse_value(c, tmp)) != PARSE_OK) return;
+            memcpy(context_push(c, sizeof(Value)), &tmp, sizeof(Value));
+            chunk.size++;
+            parse_whitespace(c);
+            if (c.json == c.end) return;
+            if (*c.json != ',') {
+                chunk.ret = PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+                return;
+            }
+            ++c.json;
+            after_comma = chunk.tail;
+        }
+    }
+
+    int parse_parallel(Value &v, const char *json, size_t len, unsigned threads, const Allocator *alloc) {
+        ParseOptions opt;
+        opt.threads = threads;
+        opt.alloc = alloc;
+        return parse_parallel(v, json, len, opt);
+    }
+
+    int parse_parallel(Value &v, const char *json, size_t len, const ParseOptions &opt) {
+        // 串行回退和各分块的计数都算在这一次调用里
+        STATS_SCOPE();
+        unsigned threads = opt.threads ? opt.threads : std::thread::hardware_concurrency();
+        ParseOptions serial = opt;
+        serial.threads = 1;
+        Context root;
+        context_init(root, json, len, opt.alloc);
+        root.flags = context_flags(opt);
+        parse_whitespace(root);
+        if (threads <= 1 || len < PARSE_PARALLEL_MIN_SIZE || peek(root, root.json) != '[')
+            return parse(v, json, len, serial);
+
+        const char *open = root.json;
+        std::vector<const char *> splits;
+        const char *close = scan_array_splits(open, root.end, threads, root.flags, splits);
+        if (!close) return parse(v, json, len, serial);
+        root.json = close + 1;
+        parse_whitespace(root);
+        if (root.json != root.end) return parse(v, json, len, serial);
+
+        // 相邻两个切分点之间是一个分块，分块边界上的逗号不属于任何分块
+        size_t n = splits.size() + 1;
+        std::vector<ArrayChunk> chunks(n);
+        for (size_t i = 0; i < n; i++) {
+            Context &c = chunks[i].c;
+            const char *begin = i == 0 ? open + 1 : splits[i - 1] + 1;
+            context_init(c, begin, (i + 1 < n ? splits[i] : close) - begin, opt.alloc);
+            c.keys = opt.keys;
+            c.flags = root.flags;
+            chunks[i].tail = i + 1 == n && (c.flags & CONTEXT_TRAILING_COMMAS);
+        }
+
+        STATS_ADD(bytes_parsed, len);
+        STATS_NODE(ARRAY);
+        std::vector<Stats> stats(n);
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < n; i++) {
+            pool.emplace_back([&chunks, &stats, i]() {
+                // 分块里的元素位于最外层数组之下
+                STATS_WORKER(stats[i], 1);
+                parse_array_chunk(chunks[i]);
+            });
+        }
+        {
+            STATS_DEPTH();
+            parse_array_chunk(chunks[0]);
+        }
+        for (auto &t: pool)
+            t.join();
+        for (size_t i = 1; i < n; i++)
+            STATS_MERGE(stats[i]);
+
+        bool ok = true;
+        size_t total = 0;
+        for (auto &chunk: chunks) {
+            ok = ok && chunk.ret == PARSE_OK;
+            total += chunk.size;
+        }
+
+        init(v);
+        if (ok) {
+            v.type = ARRAY;
+            v.a_size = total;
+            v.arr = (Value *) mem_alloc(root.alloc, total * sizeof(Value));
+        }
+        Value *out = v.arr;
+        for (auto &chunk: chunks) {
+            size_t size = chunk.size * sizeof(Value);
+            Value *src = (Value *) context_pop(chunk.c, size);
+            if (ok) {
+                memcpy(out, src, size);
+                out += chunk.size;
+            } else {
+                for (size_t i = 0; i < chunk.size; i++)
+                    value_free(src[i], root.alloc);
+            }
+            context_free(chunk.c);
+        }
+        // 出错时重新串行解析一遍，保证错误码和 parse 完全一致
+        return ok ? PARSE_OK : parse(v, json, len, serial);
+    }
+
+
+    Type get_type(const Value &v) {
+        return v.type;
+    }
+
+    int get_boolean(const Value &v) {
+        assert(v.type == FALSE || v.type == TRUE);
+        return v.type;
+    }
+
+    void set_boolean(Value &v, bool flag, const Allocator *alloc) {
+        value_free(v, alloc);
+        v.type = flag ? TRUE : FALSE;
+    }
+
+    double get_number(const Value &v) {
+        assert(v.type == NUMBER);
+        return v.num;
+    }
+
+    void set_number(Value &v, double num, const Allocator *alloc) {
+        value_free(v, alloc);
+        v.type = NUMBER;
+        v.num = num;
+    }
+
+    const char *get_string(const Value &v) {
+        assert(v.type == STRING);
+        return v.short_len ? v.short_str : v.str;
+    }
+
+    size_t get_string_length(const Value &v) {
+        return string_length(v);
+    }
+
+    std::string_view get_string_view(const Value &v) {
+        return std::string_view(get_string(v), string_length(v));
+    }
+
+    bool string_equal(const Value &v, const char *s, size_t len) {
+        return string_length(v) == len && memcmp(get_string(v), s, len) == 0;
+    }
+
+    // 按字节比较，前缀相同时短的排在前面，嵌入的 '\0' 也参与比较
+    int string_compare(const Value &a, const Value &b) {
+        size_t la = string_length(a), lb = string_length(b);
+        int ret = memcmp(get_string(a), get_string(b), la < lb ? la : lb);
+        if (ret != 0) return ret;
+        return la < lb ? -1 : la > lb;
+    }
+
+    void set_string(Value &v, const char *s, size_t len, const Allocator *alloc) {
+        assert(s != NULL || len == 0);
+        alloc = allocator_or_default(alloc);
+        value_free(v, alloc);
+        if (len < sizeof(v.short_str)) {
+            if (len) memcpy(v.short_str, s, len);
+            v.short_str[len] = '\0';
+            v.short_len = (unsigned char) (len + 1);
+        } else {
+            v.str = (char *) mem_alloc(alloc, len + 1);
+            memcpy(v.str, s, len);
+            v.str[len] = '\0';
+            v.len = len;
+            v.short_len = 0;
+        }
+        v.type = STRING;
+    }
+
+    size_t get_array_size(const Value &v) {
+        assert(v.type == ARRAY);
+        return v.a_size;
+    }
+
+    Value *get_array_element(const Value &v, size_t index) {
+        assert(v.type == ARRAY);
+        assert(v.a_size > index);
+        return &v.arr[index];
+    }
+
+    size_t get_object_size(const Value &v) {
+        assert(v.type == OBJECT);
+        return v.m_size;
+    }
+
+    const char *get_object_key(const Value &v, size_t index) {
+        assert(v.type == OBJECT);
+        assert(v.m_size > index);
+        return v.m[index].k;
+    }
+
+    size_t get_object_key_length(const Value &v, size_t index) {
+        assert(v.type == OBJECT);
+        assert(v.m_size > index);
+        return v.m[index].k_len;
+    }
+
+    std::string_view get_object_key_view(const Value &v, size_t index) {
+        assert(v.type == OBJECT);
+        assert(v.m_size > index);
+        return std::string_view(v.m[index].k, v.m[index].k_len);
+    }
+
+    Value *get_object_value(const Value &v, size_t index) {
+        assert(v.type == OBJECT);
+        assert(v.m_size > index);
+        return &v.m[index].v;
+    }
+
+    size_t find_object_index(const Value &v, const char *key, size_t klen) {
+        assert(v.type == OBJECT);
+        for (size_t i = 0; i < v.m_size; i++)
+            if (v.m[i].k_len == klen && memcmp(v.m[i].k, key, klen) == 0)
+                return i;
+        return KEY_NOT_EXIST;
+    }
+
+    size_t find_interned_object_index(const Value &v, const char *key) {
+        assert(v.type == OBJECT);
+        for (size_t i = 0; i < v.m_size; i++)
+            if (v.m[i].k == key)
+                return i;
+        return KEY_NOT_EXIST;
+    }
+
+    Value *find_object_value(const Value &v, const char *key, size_t klen) {
+        size_t i = find_object_index(v, key, klen);
+        return i == KEY_NOT_EXIST ? NULL : &v.m[i].v;
+    }
+
+    size_t find_sorted_object_index(const Value &v, const char *key, size_t klen) {
+        assert(v.type == OBJECT);
+        member probe;
+        probe.k = (char *) key;
+        probe.k_len = klen;
+        const member *m = std::lower_bound(v.m, v.m + v.m_size, probe, member_less);
+        if (m == v.m + v.m_size || member_less(probe, *m)) return KEY_NOT_EXIST;
+        return m - v.m;
+    }
+
+    void sort_members(Value &v, const Allocator *alloc) {
+        alloc = allocator_or_default(alloc);
+        if (v.type == ARRAY) {
+            for (size_t i = 0; i < v.a_size; i++)
+                sort_members(v.arr[i], alloc);
+        } else if (v.type == OBJECT) {
+            for (size_t i = 0; i < v.m_size; i++)
+                sort_members(v.m[i].v, alloc);
+            size_t half = v.m_size / 2 * sizeof(member);
+            auto *tmp = (member *) (half ? mem_alloc(alloc, half) : NULL);
+            member_sort(v.m, v.m_size, tmp);
+            mem_free(alloc, tmp, half);
+        }
+    }
+
+    // 数组、成员块总是按元素个数精确分配，空容器的指针为 NULL
+    static void *block_resize(const Allocator *alloc, void *p, size_t old_size, size_t new_size) {
+        if (new_size == 0) {
+            mem_free(alloc, p, old_size);
+            return NULL;
+        }
+        return mem_realloc(alloc, p, old_size, new_size);
+    }
+
+    // dst 视为未初始化
+    static void value_copy_raw(Value &dst, const Value &src, const Allocator *alloc) {
+        switch (src.type) {
+            case STRING:
+                init(dst);
+                set_string(dst, get_string(src), string_length(src), alloc);
+                break;
+            case ARRAY:
+                dst.type = ARRAY;
+                dst.a_size = src.a_size;
+                dst.arr = (Value *) block_resize(alloc, NULL, 0, src.a_size * sizeof(Value));
+                for (size_t i = 0; i < src.a_size; i++)
+                    value_copy_raw(dst.arr[i], src.arr[i], alloc);
+                break;
+            case OBJECT:
+                dst.type = OBJECT;
+                dst.m_size = src.m_size;
+                dst.m = (member *) block_resize(alloc, NULL, 0, src.m_size * sizeof(member));
+                for (size_t i = 0; i < src.m_size; i++) {
+                    member &m = dst.m[i];
+                    m.k_len = src.m[i].k_len;
+                    m.k = (char *) mem_alloc(alloc, m.k_len + 1);
+                    memcpy(m.k, src.m[i].k, m.k_len + 1);
+                    m.k_interned = 0;
+                    value_copy_raw(m.v, src.m[i].v, alloc);
+                }
+                break;
+            default:
+                dst = src;
+                break;
+        }
+    }
+
+    void value_copy(Value &dst, const Value &src, const Allocator *alloc) {
+        alloc = allocator_or_default(alloc);
+        value_free(dst, alloc);
+        value_copy_raw(dst, src, alloc);
+    }
+
+    bool value_equal(const Value &a, const Value &b) {
+        if (a.type != b.type) return false;
+        switch (a.type) {
+            case NUMBER:
+                return a.num == b.num;
+            case STRING:
+                return string_compare(a, b) == 0;
+            case ARRAY:
+                if (a.a_size != b.a_size) return false;
+                for (size_t i = 0; i < a.a_size; i++)
+                    if (!value_equal(a.arr[i], b.arr[i])) return false;
+                return true;
+            case OBJECT:
+                if (a.m_size != b.m_size) return false;
+                for (size_t i = 0; i < a.m_size; i++) {
+                    // 同一位置的键相同时直接比较，这样重复的键也能逐个对上
+                    const member &bm = b.m[i];
+                    const Value *bv = bm.k_len == a.m[i].k_len && memcmp(bm.k, a.m[i].k, bm.k_len) == 0
+                                      ? &bm.v : find_object_value(b, a.m[i].k, a.m[i].k_len);
+                    if (!bv || !value_equal(a.m[i].v, *bv)) return false;
+                }
+                return true;
+            default:
+                return true;
+        }
+    }
+
+    // 以下几个函数只搬动 Value / member 本身，子树原样移动，不做拷贝
+    static void array_put(Value &v, size_t index, const Value &e, const Allocator *alloc) {
+        assert(v.type == ARRAY && index <= v.a_size);
+        v.arr = (Value *) mem_realloc(alloc, v.arr, v.a_size * sizeof(Value), (v.a_size + 1) * sizeof(Value));
+        memmove(v.arr + index + 1, v.arr + index, (v.a_size - index) * sizeof(Value));
+        v.arr[index] = e;
+        v.a_size++;
+    }
+
+    static Value array_take(Value &v, size_t index, const Allocator *alloc) {
+        assert(v.type == ARRAY && index < v.a_size);
+        Value e = v.arr[index];
+        memmove(v.arr + index, v.arr + index + 1, (v.a_size - index - 1) * sizeof(Value));
+        v.arr = (Value *) block_resize(alloc, v.arr, v.a_size * sizeof(Value), (v.a_size - 1) * sizeof(Value));
+        v.a_size--;
+        return e;
+    }
+
+    static void object_put(Value &v, size_t index, const member &m, const Allocator *alloc) {
+        assert(v.type == OBJECT && index <= v.m_size);
+        v.m = (member *) mem_realloc(alloc, v.m, v.m_size * sizeof(member), (v.m_size + 1) * sizeof(member));
+        memmove(v.m + index + 1, v.m + index, (v.m_size - index) * sizeof(member));
+        v.m[index] = m;
+        v.m_size++;
+    }
+
+    static member object_take(Value &v, size_t index, const Allocator *alloc) {
+        assert(v.type == OBJECT && index < v.m_size);
+        member m = v.m[index];
+        memmove(v.m + index, v.m + index + 1, (v.m_size - index - 1) * sizeof(member));
+        v.m = (member *) block_resize(alloc, v.m, v.m_size * sizeof(member), (v.m_size - 1) * sizeof(member));
+        v.m_size--;
+        return m;
+    }
+
+    static void member_free(member &m, const Allocator *alloc) {
+        if (!m.k_interned) mem_free(alloc, m.k, m.k_len + 1);
+        value_free(m.v, alloc);
+    }
+
+    Value *array_insert(Value &v, size_t index, const Allocator *alloc) {
+        Value e;
+        init(e);
+        array_put(v, index, e, allocator_or_default(alloc));
+        return &v.arr[index];
+    }
+
+    void array_erase(Value &v, size_t index, const Allocator *alloc) {
+        alloc = allocator_or_default(alloc);
+        Value e = array_take(v, index, alloc);
+        value_free(e, alloc);
+    }
+
+    Value *object_set(Value &v, const char *key, size_t klen, const Allocator *alloc) {
+        size_t i = find_object_index(v, key, klen);
+        if (i != KEY_NOT_EXIST) return &v.m[i].v;
+        alloc = allocator_or_default(alloc);
+        member m;
+        m.k_len = klen;
+        m.k = (char *) mem_alloc(alloc, klen + 1);
+        memcpy(m.k, key, klen);
+        m.k[klen] = '\0';
+        m.k_interned = 0;
+        init(m.v);
+        object_put(v, v.m_size, m, alloc);
+        return &v.m[v.m_size - 1].v;
+    }
+
+    bool object_remove(Value &v, const char *key, size_t klen, const Allocator *alloc) {
+        size_t i = find_object_index(v, key, klen);
+        if (i == KEY_NOT_EXIST) return false;
+        alloc = allocator_or_default(alloc);
+        member m = object_take(v, i, alloc);
+        member_free(m, alloc);
+        return true;
+    }
+
+    // JSON Pointer (RFC 6901)：令牌中 ~1 表示 '/'，~0 表示 '~'。
+    // 以下函数接受未转义的原始令牌，比较和解码时再处理转义。
+    static bool token_equal(const char *tok, size_t tlen, const char *k, size_t klen) {
+        size_t i = 0, j = 0;
+        for (; i < tlen && j < klen; i++, j++) {
+            char ch = tok[i];
+            if (ch == '~') {
+                if (++i == tlen) return false;
+                if (tok[i] == '0') ch = '~';
+                else if (tok[i] == '1') ch = '/';
+                else return false;
+            }
+            if (ch != k[j]) return false;
+        }
+        return i == tlen && j == klen;
+    }
+
+    // 每个 '~' 后面都是 '0' 或 '1'。token_decode 按这个前提计算长度，补丁的路径先用它检查
+    static bool pointer_escapes_valid(const char *p, size_t len) {
+        for (size_t i = 0; i < len; i++)
+            if (p[i] == '~' && (++i == len || (p[i] != '0' && p[i] != '1'))) return false;
+        return true;
+    }
+
+    // tok 必须通过 pointer_escapes_valid
+    static char *token_decode(const char *tok, size_t tlen, size_t &klen, const Allocator *alloc) {
+        assert(pointer_escapes_valid(tok, tlen));
+        klen = tlen;
+        for (size_t i = 0; i < tlen; i++)
+            klen -= tok[i] == '~';
+        char *k = (char *) mem_alloc(alloc, klen + 1);
+        for (size_t i = 0, j = 0; i < tlen; i++, j++)
+            k[j] = tok[i] == '~' ? (tok[++i] == '0' ? '~' : '/') : tok[i];
+        k[klen] = '\0';
+        return k;
+    }
+
+    // 数组下标："0" 或不以 0 开头的十进制数；"-" 表示末尾之后，只有 allow_end 时接受
+    static bool token_index(const char *tok, size_t tlen, size_t size, bool allow_end, size_t &index) {
+        if (tlen == 1 && tok[0] == '-') {
+            index = size;
+            return allow_end;
+        }
+        if (tlen == 0 || (tok[0] == '0' && tlen > 1)) return false;
+        index = 0;
+        for (size_t i = 0; i < tlen; i++) {
+            if (!IS_DIGIT(tok[i]) || index > size) return false;
+            index = index * 10 + (tok[i] - '0');
+        }
+        return allow_end ? index <= size : index < size;
+    }
+
+    static size_t token_member(const Value &v, const char *tok, size_t tlen) {
+        for (size_t i = 0; i < v.m_size; i++)
+            if (token_equal(tok, tlen, v.m[i].k, v.m[i].k_len)) return i;
+        return KEY_NOT_EXIST;
+    }
+
+    static Value *pointer_step(const Value &v, const char *tok, size_t tlen) {
+        size_t i;
+        if (v.type == ARRAY)
+            return token_index(tok, tlen, v.a_size, false, i) ? &v.arr[i] : NULL;
+        if (v.type == OBJECT)
+            return (i = token_member(v, tok, tlen)) != KEY_NOT_EXIST ? &v.m[i].v : NULL;
+        return NULL;
+    }
+
+    Value *find_pointer(const Value &v, const char *ptr, size_t len) {
+        const char *end = ptr + len;
+        auto *cur = const_cast<Value *>(&v);
+        if (len && *ptr != '/') return NULL;
+        while (cur && ptr < end) {
+            const char *tok = ++ptr;
+            while (ptr < end && *ptr != '/') ptr++;
+            cur = pointer_step(*cur, tok, ptr - tok);
+        }
+        return cur;
+    }
+
+    // 补丁的撤销日志：每一步修改记一条反向操作，失败时倒序回放恢复原状。
+    // 父容器记录的是路径而不是指针，后面的操作可能让数组搬迁，
+    // 但倒序回放到某一条时文档的形状与当时完全相同，按路径一定能找回同一个容器。
+    enum {
+        UNDO_REMOVE,    // 取出 index 处的元素
+        UNDO_RESTORE,   // 把 saved.v 放回 index 处，换下当前的值
+        UNDO_INSERT,    // 把 saved 插回 index 处
+    };
+
+#define PATCH_ROOT ((size_t) -1)    // index 为这个值时指整个文档
+
+    struct PatchUndo {
+        int kind;
+        bool carry;     // 属于 move：取出的值交给下一条回放使用，插回时用的也是它
+        const char *parent;
+        size_t parent_len;
+        size_t index;   // 数组下标或成员下标
+        member saved;
+    };
+
+    // 路径拆成父容器和最后一个令牌；parent 为 NULL 表示路径指向整个文档
+    struct PatchSlot {
+        Value *parent;
+        const char *path, *tok;
+        size_t path_len, tlen;
+    };
+
+    static int patch_locate(Value &doc, const Value &path, PatchSlot &slot) {
+        const char *p = get_string(path);
+        size_t len = string_length(path);
+        slot.parent = NULL;
+        if (len == 0) return PARSE_OK;
+        if (p[0] != '/') return PATCH_INVALID;
+        size_t i = len;
+        while (p[i - 1] != '/') i--;
+        slot.path = p;
+        slot.path_len = i - 1;
+        slot.tok = p + i;
+        slot.tlen = len - i;
+        slot.parent = find_pointer(doc, p, i - 1);
+        if (!slot.parent || (slot.parent->type != ARRAY && slot.parent->type != OBJECT)) return PATCH_PATH;
+        return PARSE_OK;
+    }
+
+    static void patch_log(Context &log, int kind, bool carry, const PatchSlot &slot, size_t index,
+                          const member &saved) {
+        auto *u = (PatchUndo *) context_push(log, sizeof(PatchUndo));
+        u->kind = kind;
+        u->carry = carry;
+        u->parent = slot.parent ? slot.path : NULL;
+        u->parent_len = slot.parent ? slot.path_len : 0;
+        u->index = slot.parent ? index : PATCH_ROOT;
+        u->saved = saved;
+    }
+
+    static member patch_saved(const Value &v) {
+        member m;
+        m.k = NULL;
+        m.k_len = 0;
+        m.k_interned = 0;
+        m.v = v;
+        return m;
+    }
+
+    // 成功后 v 归文档所有，失败时仍归调用者
+    static int patch_add(Value &doc, const PatchSlot &slot, const Value &v, bool carry, Context &log,
+                         const Allocator *alloc) {
+        size_t i;
+        if (!slot.parent) {
+            patch_log(log, UNDO_RESTORE, carry, slot, 0, patch_saved(doc));
+            doc = v;
+            return PARSE_OK;
+        }
+        Value &parent = *slot.parent;
+        if (parent.type == ARRAY) {
+            if (!token_index(slot.tok, slot.tlen, parent.a_size, true, i)) return PATCH_PATH;
+            array_put(parent, i, v, alloc);
+            patch_log(log, UNDO_REMOVE, carry, slot, i, patch_saved(v));
+        } else if ((i = token_member(parent, slot.tok, slot.tlen)) != KEY_NOT_EXIST) {
+            patch_log(log, UNDO_RESTORE, carry, slot, i, patch_saved(parent.m[i].v));
+            parent.m[i].v = v;
+        } else {
+            member m;
+            size_t k_len;
+            m.k = token_decode(slot.tok, slot.tlen, k_len, alloc);
+            m.k_len = k_len;
+            m.k_interned = 0;
+            m.v = v;
+            object_put(parent, parent.m_size, m, alloc);
+            patch_log(log, UNDO_REMOVE, carry, slot, parent.m_size - 1, patch_saved(v));
+        }
+        return PARSE_OK;
+    }
+
+    // out 不为空时属于 move，取出的值交给调用者
+    static int patch_remove(const PatchSlot &slot, Value *out, Context &log, const Allocator *alloc) {
+        size_t i;
+        member saved;
+        if (!slot.parent) return PATCH_PATH;
+        Value &parent = *slot.parent;
+        if (parent.type == ARRAY) {
+            if (!token_index(slot.tok, slot.tlen, parent.a_size, false, i)) return PATCH_PATH;
+            saved = patch_saved(array_take(parent, i, alloc));
+        } else {
+            if ((i = token_member(parent, slot.tok, slot.tlen)) == KEY_NOT_EXIST) return PATCH_PATH;
+            saved = object_take(parent, i, alloc);
+        }
+        patch_log(log, UNDO_INSERT, out != NULL, slot, i, saved);
+        if (out) *out = saved.v;
+        return PARSE_OK;
+    }
+
+    static int patch_replace(Value &doc, const PatchSlot &slot, const Value &v, Context &log) {
+        size_t i = 0;
+        Value *target = &doc;
+        if (slot.parent) {
+            Value &parent = *slot.parent;
+            if (parent.type == ARRAY) {
+                if (!token_index(slot.tok, slot.tlen, parent.a_size, false, i)) return PATCH_PATH;
+                target = &parent.arr[i];
+            } else {
+                if ((i = token_member(parent, slot.tok, slot.tlen)) == KEY_NOT_EXIST) return PATCH_PATH;
+                target = &parent.m[i].v;
+            }
+        }
+        patch_log(log, UNDO_RESTORE, false, slot, i, patch_saved(*target));
+        *target = v;
+        return PARSE_OK;
+    }
+
+    static void patch_rollback(Value &doc, Context &log, Value carry, const Allocator *alloc) {
+        while (log.top) {
+            PatchUndo &u = *(PatchUndo *) context_pop(log, sizeof(PatchUndo));
+            Value *parent = u.index == PATCH_ROOT ? NULL : find_pointer(doc, u.parent, u.parent_len);
+            Value cur;
+            if (u.kind == UNDO_INSERT) {
+                if (u.carry) u.saved.v = carry;
+                if (parent->type == ARRAY) array_put(*parent, u.index, u.saved.v, alloc);
+                else object_put(*parent, u.index, u.saved, alloc);
+                continue;
+            }
+            if (u.kind == UNDO_REMOVE) {
+                if (parent->type == ARRAY) {
+                    cur = array_take(*parent, u.index, alloc);
+                } else {
+                    member m = object_take(*parent, u.index, alloc);
+                    if (!m.k_interned) mem_free(alloc, m.k, m.k_len + 1);
+                    cur = m.v;
+                }
+            } else {
+                Value &slot = !parent ? doc : parent->type == ARRAY ? parent->arr[u.index] : parent->m[u.index].v;
+                cur = slot;
+                slot = u.saved.v;
+            }
+            if (u.carry) carry = cur;
+            else value_free(cur, alloc);
+        }
+    }
+
+    // 全部成功后释放被删除和被替换下来的值
+    static void patch_commit(Context &log, const Allocator *alloc) {
+        while (log.top) {
+            PatchUndo &u = *(PatchUndo *) context_pop(log, sizeof(PatchUndo));
+            if (u.kind == UNDO_REMOVE) continue;
+            if (u.kind == UNDO_INSERT && u.carry) init(u.saved.v);
+            member_free(u.saved, alloc);
+        }
+    }
+
+    static int patch_apply_op(Value &doc, const Value &op, Context &log, Value &carry, const Allocator *alloc) {
+        if (op.type != OBJECT) return PATCH_INVALID;
+        const Value *name = find_object_value(op, "op", 2);
+        const Value *path = find_object_value(op, "path", 4);
+        const Value *value = find_object_value(op, "value", 5);
+        const Value *from = find_object_value(op, "from", 4);
+        if (!name || name->type != STRING || !path || path->type != STRING) return PATCH_INVALID;
+        if (!pointer_escapes_valid(get_string(*path), string_length(*path))) return PATCH_INVALID;
+        if (from && from->type == STRING && !pointer_escapes_valid(get_string(*from), string_length(*from)))
+            return PATCH_INVALID;
+
+        PatchSlot slot;
+        Value v;
+        int ret;
+        if (string_equal(*name, "test", 4)) {
+            if (!value) return PATCH_INVALID;
+            const Value *target = find_pointer(doc, get_string(*path), string_length(*path));
+            if (!target) return PATCH_PATH;
+            return value_equal(*target, *value) ? PARSE_OK : PATCH_TEST;
+        }
+        if (string_equal(*name, "remove", 6)) {
+            if ((ret = patch_locate(doc, *path, slot)) != PARSE_OK) return ret;
+            return patch_remove(slot, NULL, log, alloc);
+        }
+        if (string_equal(*name, "add", 3) || string_equal(*name, "replace", 7)) {
+            if (!value) return PATCH_INVALID;
+            if ((ret = patch_locate(doc, *path, slot)) != PARSE_OK) return ret;
+            value_copy_raw(v, *value, alloc);
+            ret = string_equal(*name, "add", 3) ? patch_add(doc, slot, v, false, log, alloc)
+                                                : patch_replace(doc, slot, v, log);
+            if (ret != PARSE_OK) value_free(v, alloc);
+            return ret;
+        }
+        if (string_equal(*name, "copy", 4)) {
+            if (!from || from->type != STRING) return PATCH_INVALID;
+            const Value *src = find_pointer(doc, get_string(*from), string_length(*from));
+            if (!src) return PATCH_PATH;
+            if ((ret = patch_locate(doc, *path, slot)) != PARSE_OK) return ret;
+            value_copy_raw(v, *src, alloc);
+            if ((ret = patch_add(doc, slot, v, false, log, alloc)) != PARSE_OK) value_free(v, alloc);
+            return ret;
+        }
+        if (string_equal(*name, "move", 4)) {
+            if (!from || from->type != STRING) return PATCH_INVALID;
+            // 不能移动到自己的子孙下面
+            size_t flen = string_length(*from), plen = string_length(*path);
+            if (plen > flen && memcmp(get_string(*from), get_string(*path), flen) == 0 &&
+                get_string(*path)[flen] == '/')
+                return PATCH_INVALID;
+            if ((ret = patch_locate(doc, *from, slot)) != PARSE_OK) return ret;
+            if ((ret = patch_remove(slot, &carry, log, alloc)) != PARSE_OK) return ret;
+            // 取出之后文档已经变了，目标位置要重新定位；失败时 carry 留给回放插回原处
+            if ((ret = patch_locate(doc, *path, slot)) != PARSE_OK) return ret;
+            if ((ret = patch_add(doc, slot, carry, true, log, alloc)) != PARSE_OK) return ret;
+            init(carry);
+            return PARSE_OK;
+        }
+        return PATCH_INVALID;
+    }
+
+    int apply_patch(Value &doc, const Value &patch, const Allocator *alloc) {
+        alloc = allocator_or_default(alloc);
+        if (patch.type != ARRAY) return PATCH_INVALID;
+        Context log;
+        context_init(log, NULL, 0, alloc);
+        Value carry;
+        init(carry);
+        int ret = PARSE_OK;
+        for (size_t i = 0; i < patch.a_size && ret == PARSE_OK; i++)
+            ret = patch_apply_op(doc, patch.arr[i], log, carry, alloc);
+        if (ret == PARSE_OK) patch_commit(log, alloc);
+        else patch_rollback(doc, log, carry, alloc);
+        context_free(log);
+        return ret;
+    }
+
+    void apply_merge_patch(Value &doc, const Value &patch, const Allocator *alloc) {
+        alloc = allocator_or_default(alloc);
+        if (patch.type != OBJECT) {
+            value_copy(doc, patch, alloc);
+            return;
+        }
+        if (doc.type != OBJECT) {
+            value_free(doc, alloc);
+            doc.type = OBJECT;
+            doc.m = NULL;
+            doc.m_size = 0;
+        }
+        for (size_t i = 0; i < patch.m_size; i++) {
+            const member &m = patch.m[i];
+            if (m.v.type == NUL) object_remove(doc, m.k, m.k_len, alloc);
+            else apply_merge_patch(*object_set(doc, m.k, m.k_len, alloc), m.v, alloc);
+        }
+    }
+
+    // 键表：开放寻址的哈希集合，键的内容追加在按块分配的内存里，表释放前不会移动
+    struct KeyEntry {
+        const char *k;
+        size_t len;
+        size_t hash;
+    };
+
+    struct KeyBlock {
+        KeyBlock *next;
+        size_t size, used;
+    };
+
+    struct KeyTable {
+        KeyEntry *slots;
+        size_t capacity, count;
+        KeyBlock *blocks;
+        const Allocator *alloc;
+        bool shared;
+        std::mutex lock;
+    };
+
+#ifndef KEY_TABLE_INIT_CAPACITY
+#define KEY_TABLE_INIT_CAPACITY 64
+#endif
+
+#ifndef KEY_TABLE_BLOCK_SIZE
+#define KEY_TABLE_BLOCK_SIZE 4096
+#endif
+
+    static size_t hash_bytes(const char *s, size_t len) {
+        size_t h = (size_t) 14695981039346656037ULL;
+        for (size_t i = 0; i < len; i++) {
+            h ^= (unsigned char) s[i];
+            h *= (size_t) 1099511628211ULL;
+        }
+        return h;
+    }
+
+    KeyTable *key_table_create(bool shared, const Allocator *alloc) {
+        alloc = allocator_or_default(alloc);
+        auto *t = new(mem_alloc(alloc, sizeof(KeyTable))) KeyTable;
+        t->capacity = KEY_TABLE_INIT_CAPACITY;
+        t->count = 0;
+        t->slots = (KeyEntry *) mem_alloc(alloc, t->capacity * sizeof(KeyEntry));
+        memset(t->slots, 0, t->capacity * sizeof(KeyEntry));
+        t->blocks = NULL;
+        t->alloc = alloc;
+        t->shared = shared;
+        return t;
+    }
+
+    void key_table_free(KeyTable *t) {
+        if (!t) return;
+        const Allocator *alloc = t->alloc;
+        for (KeyBlock *b = t->blocks, *next; b; b = next) {
+            next = b->next;
+            mem_free(alloc, b, sizeof(KeyBlock) + b->size);
+        }
+        mem_free(alloc, t->slots, t->capacity * sizeof(KeyEntry));
+        t->~KeyTable();
+        mem_free(alloc, t, sizeof(KeyTable));
+    }
+
+    size_t key_table_size(KeyTable *t) {
+        if (!t->shared) return t->count;
+        std::lock_guard<std::mutex> guard(t->lock);
+        return t->count;
+    }
+
+    static const char *key_table_store(KeyTable *t, const char *k, size_t len) {
+        KeyBlock *b = t->blocks;
+        if (!b || b->size - b->used < len + 1) {
+            size_t size = len + 1 > KEY_TABLE_BLOCK_SIZE ? len + 1 : KEY_TABLE_BLOCK_SIZE;
+            b = (KeyBlock *) mem_alloc(t->alloc, sizeof(KeyBlock) + size);
+            b->size = size;
+            b->used = 0;
+            b->next = t->blocks;
+            t->blocks = b;
+        }
+        char *p = (char *) (b + 1) + b->used;
+        if (len) memcpy(p, k, len);
+        p[len] = '\0';
+        b->used += len + 1;
+        return p;
+    }
+
+    static void key_table_grow(KeyTable *t) {
+        size_t capacity = t->capacity * 2;
+        auto *slots = (KeyEntry *) mem_alloc(t->alloc, capacity * sizeof(KeyEntry));
+        memset(slots, 0, capacity * sizeof(KeyEntry));
+        for (size_t i = 0; i < t->capacity; i++) {
+            if (!t->slots[i].k) continue;
+            size_t j = t->slots[i].hash & (capacity - 1);
+            while (slots[j].k) j = (j + 1) & (capacity - 1);
+            slots[j] = t->slots[i];
+        }
+        mem_free(t->alloc, t->slots, t->capacity * sizeof(KeyEntry));
+        t->slots = slots;
+        t->capacity = capacity;
+    }
+
+    static const char *key_table_intern_locked(KeyTable *t, const char *k, size_t len) {
+        size_t hash = hash_bytes(k, len);
+        size_t i = hash & (t->capacity - 1);
+        for (; t->slots[i].k; i = (i + 1) & (t->capacity - 1)) {
+            const KeyEntry &e = t->slots[i];
+            // 空键从解析栈上取出时 k 可能是 NULL，不能交给 memcmp
+            if (e.hash == hash && e.len == len && (len == 0 || memcmp(e.k, k, len) == 0))
+                return e.k;
+        }
+        KeyEntry &e = t->slots[i];
+        e.k = key_table_store(t, k, len);
+        e.len = len;
+        e.hash = hash;
+        const char *ret = e.k;
+        // 装载因子保持在 1/2 以下
+        if (++t->count * 2 > t->capacity)
+            key_table_grow(t);
+        return ret;
+    }
+
+    const char *key_table_intern(KeyTable *t, const char *k, size_t len) {
+        if (!t->shared) return key_table_intern_locked(t, k, len);
+        std::lock_guard<std::mutex> guard(t->lock);
+        return key_table_intern_locked(t, k, len);
+    }
+
+    // 冻结文档：创建时把需要索引的对象按成员块地址登记到一张开放寻址表里，
+    // 这张表之后只读。每个对象的键索引在第一次查找时才建立，用 compare_exchange 发布，
+    // 竞争失败的线程释放自己建的那份。索引 idx[0] 是容量，idx[1..] 存成员下标加 1，0 表示空。
+    struct DocumentSlot {
+        const member *m;
+        std::atomic<size_t *> index;
+    };
+
+    struct Document {
+        Value root;
+        const Allocator *alloc;
+        std::atomic<size_t> refs;
+        DocumentSlot *slots;
+        size_t capacity;
+    };
+
+#ifndef DOCUMENT_INDEX_MIN_MEMBERS
+#define DOCUMENT_INDEX_MIN_MEMBERS 16
+#endif
+
+    static size_t hash_pointer(const void *p) {
+        return (size_t) (((uint64_t) (uintptr_t) p >> 4) * 0x9E3779B97F4A7C15ULL);
+    }
+
+    static size_t document_count_objects(const Value &v) {
+        size_t n = 0;
+        if (v.type == ARRAY) {
+            for (size_t i = 0; i < v.a_size; i++)
+                n += document_count_objects(v.arr[i]);
+        } else if (v.type == OBJECT) {
+            n = v.m_size >= DOCUMENT_INDEX_MIN_MEMBERS;
+            for (size_t i = 0; i < v.m_size; i++)
+                n += document_count_objects(v.m[i].v);
+        }
+        return n;
+    }
+
+    static void document_register_objects(Document *doc, const Value &v) {
+        if (v.type == ARRAY) {
+            for (size_t i = 0; i < v.a_size; i++)
+                document_register_objects(doc, v.arr[i]);
+        } else if (v.type == OBJECT) {
+            if (v.m_size >= DOCUMENT_INDEX_MIN_MEMBERS) {
+                size_t j = hash_pointer(v.m) & (doc->capacity - 1);
+                while (doc->slots[j].m) j = (j + 1) & (doc->capacity - 1);
+                doc->slots[j].m = v.m;
+            }
+            for (size_t i = 0; i < v.m_size; i++)
+                document_register_objects(doc, v.m[i].v);
+        }
+    }
+
+    Document *document_create(Value &v, const Allocator *alloc) {
+        alloc = allocator_or_default(alloc);
+        auto *doc = new(mem_alloc(alloc, sizeof(Document))) Document;
+        doc->root = v;
+        v.type = NUL;
+        doc->alloc = alloc;
+        doc->refs.store(1, std::memory_order_relaxed);
+        doc->slots = NULL;
+        doc->capacity = 0;
+        size_t n = document_count_objects(doc->root);
+        if (n) {
+            // 装载因子保持在 1/2 以下
+            size_t capacity = 2;
+            while (capacity < n * 2) capacity *= 2;
+            doc->slots = (DocumentSlot *) mem_alloc(alloc, capacity * sizeof(DocumentSlot));
+            for (size_t i = 0; i < capacity; i++) {
+                doc->slots[i].m = NULL;
+                new(&doc->slots[i].index) std::atomic<size_t *>(nullptr);
+            }
+            doc->capacity = capacity;
+            document_register_objects(doc, doc->root);
+        }
+        return doc;
+    }
+
+    Document *document_retain(Document *doc) {
+        doc->refs.fetch_add(1, std::memory_order_relaxed);
+        return doc;
+    }
+
+    void document_release(Document *doc) {
+        if (!doc || doc->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        const Allocator *alloc = doc->alloc;
+        for (size_t i = 0; i < doc->capacity; i++) {
+            size_t *idx = doc->slots[i].index.load(std::memory_order_relaxed);
+            if (idx) mem_free(alloc, idx, (idx[0] + 1) * sizeof(size_t));
+            doc->slots[i].index.~atomic();
+        }
+        mem_free(alloc, doc->slots, doc->capacity * sizeof(DocumentSlot));
+        value_free(doc->root, alloc);
+        doc->~Document();
+        mem_free(alloc, doc, sizeof(Document));
+    }
+
+    const Value &document_root(const Document *doc) {
+        return doc->root;
+    }
+
+    static size_t *document_build_index(const Document *doc, DocumentSlot &s, const Value &v) {
+        size_t capacity = 2;
+        while (capacity < v.m_size * 2) capacity *= 2;
+        auto *idx = (size_t *) mem_alloc(doc->alloc, (capacity + 1) * sizeof(size_t));
+        memset(idx, 0, (capacity + 1) * sizeof(size_t));
+        idx[0] = capacity;
+        for (size_t i = 0; i < v.m_size; i++) {
+            const member &m = v.m[i];
+            size_t j = hash_bytes(m.k, m.k_len) & (capacity - 1);
+            for (; idx[j + 1]; j = (j + 1) & (capacity - 1)) {
+                const member &e = v.m[idx[j + 1] - 1];
+                if (e.k_len == m.k_len && memcmp(e.k, m.k, m.k_len) == 0) break;
+            }
+            // 重复的键保留第一个，和 find_object_index 一致
+            if (!idx[j + 1]) idx[j + 1] = i + 1;
+        }
+        size_t *expected = nullptr;
+        if (s.index.compare_exchange_strong(expected, idx, std::memory_order_acq_rel, std::memory_order_acquire))
+            return idx;
+        mem_free(doc->alloc, idx, (capacity + 1) * sizeof(size_t));
+        return expected;
+    }
+
+    const Value *document_find(const Document *doc, const Value &object, const char *key, size_t klen) {
+        assert(object.type == OBJECT);
+        if (object.m_size < DOCUMENT_INDEX_MIN_MEMBERS || !doc->capacity)
+            return find_object_value(object, key, klen);
+        size_t j = hash_pointer(object.m) & (doc->capacity - 1);
+        while (doc->slots[j].m && doc->slots[j].m != object.m) j = (j + 1) & (doc->capacity - 1);
+        // 不是文档里的对象
+        if (!doc->slots[j].m) return find_object_value(object, key, klen);
+        DocumentSlot &s = doc->slots[j];
+        size_t *idx = s.index.load(std::memory_order_acquire);
+        if (!idx) idx = document_build_index(doc, s, object);
+        size_t capacity = idx[0];
+        for (size_t i = hash_bytes(key, klen) & (capacity - 1); idx[i + 1]; i = (i + 1) & (capacity - 1)) {
+            const member &m = object.m[idx[i + 1] - 1];
+            if (m.k_len == klen && memcmp(m.k, key, klen) == 0)
+                return &m.v;
+        }
+        return NULL;
+    }
+
+    // 结构哈希，只用来快速排除不相等的子树，相等时仍由 value_equal 确认。
+    // 对象的哈希与成员顺序无关，和 value_equal 的语义一致。
+    static size_t value_hash(const Value &v) {
+        size_t h = (size_t) v.type * (size_t) 0x9E3779B97F4A7C15ULL;
+        switch (v.type) {
+            case NUMBER: {
+                double num = v.num == 0.0 ? 0.0 : v.num;    // -0 与 0 相等
+                return h ^ hash_bytes((const char *) &num, sizeof(num));
+            }
+            case STRING:
+                return h ^ hash_bytes(get_string(v), string_length(v));
+            case ARRAY:
+                for (size_t i = 0; i < v.a_size; i++)
+                    h = (h ^ value_hash(v.arr[i])) * (size_t) 1099511628211ULL;
+                return h;
+            case OBJECT: {
+                size_t sum = 0;
+                for (size_t i = 0; i < v.m_size; i++)
+                    sum += hash_bytes(v.m[i].k, v.m[i].k_len) * 31 + value_hash(v.m[i].v);
+                return h ^ sum;
+            }
+            default:
+                return h;
+        }
+    }
+
+#ifndef DIFF_LCS_MAX_CELLS
+#define DIFF_LCS_MAX_CELLS (1 << 20)
+#endif
+
+    struct DiffContext {
+        Context path;       // 当前位置的 JSON Pointer
+        Context ops;        // 生成的操作，最后一次性拷进 patch
+        Context scratch;    // 数组对齐用的哈希、LCS 表和编辑脚本
+        const Allocator *alloc;
+    };
+
+    enum {
+        DIFF_KEEP, DIFF_MODIFY, DIFF_REMOVE, DIFF_ADD
+    };
+
+    struct DiffEdit {
+        int kind;
+        size_t i, j;
+    };
+
+    static void diff_emit(DiffContext &d, const char *op, const Value *value) {
+        Value o;
+        o.type = OBJECT;
+        o.m = NULL;
+        o.m_size = 0;
+        set_string(*object_set(o, "op", 2, d.alloc), op, strlen(op), d.alloc);
+        set_string(*object_set(o, "path", 4, d.alloc), d.path.stack, d.path.top, d.alloc);
+        if (value) value_copy_raw(*object_set(o, "value", 5, d.alloc), *value, d.alloc);
+        *(Value *) context_push(d.ops, sizeof(Value)) = o;
+    }
+
+    static void diff_push_key(DiffContext &d, const char *k, size_t klen) {
+        *(char *) context_push(d.path, 1) = '/';
+        for (size_t i = 0; i < klen; i++) {
+            if (k[i] == '~' || k[i] == '/') {
+                char *p = (char *) context_push(d.path, 2);
+                p[0] = '~';
+                p[1] = k[i] == '~' ? '0' : '1';
+            } else {
+                *(char *) context_push(d.path, 1) = k[i];
+            }
+        }
+    }
+
+    static void diff_push_index(DiffContext &d, size_t index) {
+        char buffer[32];
+        int n = snprintf(buffer, sizeof(buffer), "/%zu", index);
+        memcpy(context_push(d.path, n), buffer, n);
+    }
+
+    static void diff_value(DiffContext &d, const Value &a, const Value &b);
+
+    // 先按同一下标找，键的顺序没变时不需要搜索
+    static size_t diff_find_member(const Value &v, size_t hint, const char *k, size_t klen) {
+        if (hint < v.m_size && v.m[hint].k_len == klen && memcmp(v.m[hint].k, k, klen) == 0) return hint;
+        return find_object_index(v, k, klen);
+    }
+
+    static void diff_object(DiffContext &d, const Value &a, const Value &b) {
+        size_t top = d.path.top;
+        for (size_t i = 0; i < a.m_size; i++) {
+            size_t j = diff_find_member(b, i, a.m[i].k, a.m[i].k_len);
+            diff_push_key(d, a.m[i].k, a.m[i].k_len);
+            if (j == KEY_NOT_EXIST) diff_emit(d, "remove", NULL);
+            else diff_value(d, a.m[i].v, b.m[j].v);
+            d.path.top = top;
+        }
+        for (size_t j = 0; j < b.m_size; j++) {
+            if (diff_find_member(a, j, b.m[j].k, b.m[j].k_len) != KEY_NOT_EXIST) continue;
+            diff_push_key(d, b.m[j].k, b.m[j].k_len);
+            diff_emit(d, "add", &b.m[j].v);
+            d.path.top = top;
+        }
+    }
+
+    // scratch 上混放着 size_t、unsigned 和 DiffEdit，每次压栈都按 size_t 对齐，
+    // 这样 LCS 表的格子数为奇数时，后面的编辑脚本和嵌套数组的哈希也不会错位
+    static void *diff_scratch_push(DiffContext &d, size_t size) {
+        return context_push(d.scratch, (size + alignof(size_t) - 1) & ~(alignof(size_t) - 1));
+    }
+
+    // 把中间一段对不上的删除和插入两两配对成原地修改，剩下的才真正删除或插入
+    static void diff_flush(DiffContext &d, size_t i, size_t removed, size_t j, size_t added) {
+        size_t n = removed < added ? removed : added;
+        for (size_t t = 0; t < n; t++)
+            *(DiffEdit *) diff_scratch_push(d, sizeof(DiffEdit)) = {DIFF_MODIFY, i + t, j + t};
+        for (size_t t = n; t < removed; t++)
+            *(DiffEdit *) diff_scratch_push(d, sizeof(DiffEdit)) = {DIFF_REMOVE, i + t, 0};
+        for (size_t t = n; t < added; t++)
+            *(DiffEdit *) diff_scratch_push(d, sizeof(DiffEdit)) = {DIFF_ADD, 0, j + t};
+    }
+
+    // 两端相同的元素先去掉，中间部分按 LCS 对齐。
+    // scratch 上依次是两边的哈希、LCS 表和编辑脚本，递归时栈可能搬迁，一律按偏移访问。
+    static void diff_array(DiffContext &d, const Value &a, const Value &b) {
+        size_t base = d.scratch.top;
+        size_t m = a.a_size, n = b.a_size;
+        auto *h = (size_t *) diff_scratch_push(d, (m + n + 1) * sizeof(size_t));
+        for (size_t i = 0; i < m; i++) h[i] = value_hash(a.arr[i]);
+        for (size_t j = 0; j < n; j++) h[m + j] = value_hash(b.arr[j]);
+        auto same = [&](size_t i, size_t j) {
+            return h[i] == h[m + j] && value_equal(a.arr[i], b.arr[j]);
+        };
+
+        size_t prefix = 0, suffix = 0;
+        while (prefix < m && prefix < n && same(prefix, prefix)) prefix++;
+        while (suffix < m - prefix && suffix < n - prefix && same(m - 1 - suffix, n - 1 - suffix)) suffix++;
+        size_t am = m - prefix - suffix, bn = n - prefix - suffix;
+
+        size_t script = d.scratch.top;
+        if (am && bn && (am + 1) * (bn + 1) <= DIFF_LCS_MAX_CELLS) {
+            // lcs[x * (bn + 1) + y] 是 a[prefix + x..] 和 b[prefix + y..] 中间部分的 LCS 长度
+            size_t cols = bn + 1;
+            size_t table = d.scratch.top;
+            diff_scratch_push(d, (am + 1) * cols * sizeof(unsigned));
+            script = d.scratch.top;
+            h = (size_t *) (d.scratch.stack + base);
+            auto *lcs = (unsigned *) (d.scratch.stack + table);
+            for (size_t x = am + 1; x-- > 0;) {
+                for (size_t y = bn + 1; y-- > 0;) {
+                    unsigned &cell = lcs[x * cols + y];
+                    if (x == am || y == bn) cell = 0;
+                    else if (same(prefix + x, prefix + y)) cell = lcs[(x + 1) * cols + y + 1] + 1;
+                    else cell = lcs[(x + 1) * cols + y] > lcs[x * cols + y + 1] ?
+                                lcs[(x + 1) * cols + y] : lcs[x * cols + y + 1];
+                }
+            }
+            size_t x = 0, y = 0, gx = 0, gy = 0;
+            while (x < am && y < bn) {
+                // 脚本追加在表之后，push 可能让表搬迁，每次重新取
+                lcs = (unsigned *) (d.scratch.stack + table);
+                h = (size_t *) (d.scratch.stack + base);
+                if (same(prefix + x, prefix + y)) {
+                    diff_flush(d, prefix + gx, x - gx, prefix + gy, y - gy);
+                    *(DiffEdit *) diff_scratch_push(d, sizeof(DiffEdit)) = {DIFF_KEEP, 0, 0};
+                    gx = ++x;
+                    gy = ++y;
+                } else if (lcs[(x + 1) * cols + y] >= lcs[x * cols + y + 1]) {
+                    x++;
+                } else {
+                    y++;
+                }
+            }
+            diff_flush(d, prefix + gx, am - gx, prefix + gy, bn - gy);
+        } else {
+            diff_flush(d, prefix, am, prefix, bn);
+        }
+
+        // 按脚本顺序生成操作，k 是补丁应用到这一步时元素在数组中的实际下标
+        size_t top = d.path.top;
+        size_t k = prefix;
+        for (size_t e = script; e < d.scratch.top; e += sizeof(DiffEdit)) {
+            DiffEdit edit = *(DiffEdit *) (d.scratch.stack + e);
+            if (edit.kind == DIFF_KEEP) {
+                k++;
+                continue;
+            }
+            diff_push_index(d, k);
+            if (edit.kind == DIFF_MODIFY) {
+                diff_value(d, a.arr[edit.i], b.arr[edit.j]);
+                k++;
+            } else if (edit.kind == DIFF_REMOVE) {
+                diff_emit(d, "remove", NULL);
+            } else {
+                diff_emit(d, "add", &b.arr[edit.j]);
+                k++;
+            }
+            d.path.top = top;
+        }
+        d.scratch.top = base;
+    }
+
+    static void diff_value(DiffContext &d, const Value &a, const Value &b) {
+        if (a.type != b.type) {
+            diff_emit(d, "replace", &b);
+            return;
+        }
+        switch (a.type) {
+            case NUMBER:
+                if (a.num != b.num) diff_emit(d, "replace", &b);
+                break;
+            case STRING:
+                if (string_compare(a, b) != 0) diff_emit(d, "replace", &b);
+                break;
+            case ARRAY:
+                diff_array(d, a, b);
+                break;
+            case OBJECT:
+                diff_object(d, a, b);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void diff(Value &patch, const Value &a, const Value &b, const Allocator *alloc) {
+        DiffContext d;
+        d.alloc = allocator_or_default(alloc);
+        context_init(d.path, NULL, 0, d.alloc);
+        context_init(d.ops, NULL, 0, d.alloc);
+        context_init(d.scratch, NULL, 0, d.alloc);
+        diff_value(d, a, b);
+
+        value_free(patch, d.alloc);
+        patch.type = ARRAY;
+        patch.a_size = d.ops.top / sizeof(Value);
+        patch.arr = (Value *) block_resize(d.alloc, NULL, 0, d.ops.top);
+        if (d.ops.top) memcpy(patch.arr, d.ops.stack, d.ops.top);
+        context_free(d.path);
+        context_free(d.ops);
+        context_free(d.scratch);
+    }
+
+    static const char hex_digits[] = "0123456789ABCDEF";
+
+    static inline void stringify_unicode_escape(Context &c, unsigned u) {
+        char *p = (char *) context_push(c, 6);
+        p[0] = '\\';
+        p[1] = 'u';
+        p[2] = hex_digits[(u >> 12) & 0xF];
+        p[3] = hex_digits[(u >> 8) & 0xF];
+        p[4] = hex_digits[(u >> 4) & 0xF];
+        p[5] = hex_digits[u & 0xF];
+    }
+
+    // 解码 p 处的一个 UTF-8 序列，返回它的字节数，规则同 validate_utf8_scalar。
+    // 不合法时 u 为 U+FFFD，返回最长的合法前缀的长度（至少为 1），一段截断的序列只替换成一个字符
+    static size_t decode_utf8(const char *p, const char *end, unsigned &u) {
+        unsigned char ch = (unsigned char) *p;
+        size_t n;
+        unsigned char lo = 0x80, hi = 0xBF;
+        if (ch < 0x80) {
+            u = ch;
+            return 1;
+        } else if (ch >= 0xC2 && ch <= 0xDF) {
+            n = 1;
+            u = ch & 0x1F;
+        } else if (ch >= 0xE0 && ch <= 0xEF) {
+            n = 2;
+            u = ch & 0x0F;
+            if (ch == 0xE0) lo = 0xA0;
+            else if (ch == 0xED) hi = 0x9F;
+        } else if (ch >= 0xF0 && ch <= 0xF4) {
+            n = 3;
+            u = ch & 0x07;
+            if (ch == 0xF0) lo = 0x90;
+            else if (ch == 0xF4) hi = 0x8F;
+        } else {
+            u = 0xFFFD;
+            return 1;
+        }
+        for (size_t i = 1; i <= n; i++) {
+            unsigned char b = p + i != end ? (unsigned char) p[i] : 0;
+            if (b < (i == 1 ? lo : 0x80) || b > (i == 1 ? hi : 0xBF)) {
+                u = 0xFFFD;
+                return i;
+            }
+            u = (u << 6) | (b & 0x3F);
+        }
+        return n + 1;
+    }
+
+    static void stringify_string(Context &c, const char *str, size_t len) {
+        *(char *) context_push(c, 1) = '"';
+        const char *end = str + len;
+        // 默认原样输出非 ASCII 字节；只输出 ASCII 时扫描也停在它们上面，逐个解码转义
+        const char *(*scan)(const char *, const char *) = c.flags & CONTEXT_ASCII
+                                                          ? current_kernels().scan_string_ascii
+                                                          : current_kernels().scan_string;
+        for (const char *p = str; p != end; p++) {
+            const char *q = scan(p, end);
+            if (q != p) {
+                memcpy(context_push(c, q - p), p, q - p);
+                if ((p = q) == end) break;
+            }
+            unsigned char ch = (unsigned char) *p;
+            switch (ch) {
+                case '\\':
+                    memcpy((char *) context_push(c, 2), "\\\\", 2);
+                    break;
+                case '\"' :
+                    memcpy((char *) context_push(c, 2), "\\\"", 2);
+                    break;
+                case '\b':
+                    memcpy((char *) context_push(c, 2), "\\b", 2);
+                    break;
+                case '\f':
+                    memcpy((char *) context_push(c, 2), "\\f", 2);
+                    break;
+                case '\r':
+                    memcpy((char *) context_push(c, 2), "\\r", 2);
+                    break;
+                case '\n':
+                    memcpy((char *) context_push(c, 2), "\\n", 2);
+                    break;
+                case '\t':
+                    memcpy((char *) context_push(c, 2), "\\t", 2);
+                    break;
+                default:
+                    if (ch < 0x20) {
+                        stringify_unicode_escape(c, ch);
+                    } else if (ch < 0x80) {
+                        *(char *) context_push(c, 1) = *p;
+                    } else {
+                        unsigned u;
+                        size_t n = decode_utf8(p, end, u);
+                        if (u >= 0x10000) {
+                            u -= 0x10000;
+                            stringify_unicode_escape(c, 0xD800 | (u >> 10));
+                            stringify_unicode_escape(c, 0xDC00 | (u & 0x3FF));
+                        } else {
+                            stringify_unicode_escape(c, u);
+                        }
+                        p += n - 1;
+                    }
+            }
+
+        }
+        *(char *) context_push(c, 1) = '"';
+    }
+
+    static void stringify_number(Context &c, double num) {
+        // NaN 和无穷大不是合法的 JSON，写成 allow_nan_inf 能读回来的形式
+        if (!std::isfinite(num)) {
+            const char *s = std::isnan(num) ? "NaN" : num > 0 ? "Infinity" : "-Infinity";
+            size_t n = strlen(s);
+            memcpy(context_push(c, n), s, n);
+            return;
+        }
+        c.top -= 32 - sprintf((char *) context_push(c, 32), "%.17g", num);
+    }
+
+    static int stringify_value(Context &c, const Value &v);
+
+    static void stringify_array(Context &c, const Value &v) {
+        STATS_DEPTH();
+        *(char *) context_push(c, 1) = '[';
+        for (size_t i = 0; i < v.a_size; i++) {
+            stringify_value(c, v.arr[i]);
+            if (i != v.a_size - 1)
+                *(char *) context_push(c, 1) = ',';
+        }
+        *(char *) context_push(c, 1) = ']';
+    }
+
+    static void stringify_object(Context &c, const Value &v) {
+        STATS_DEPTH();
+        *(char *) context_push(c, 1) = '{';
+        for (size_t i = 0; i < v.m_size; i++) {
+            stringify_string(c, v.m[i].k, v.m[i].k_len);
+            *(char *) context_push(c, 1) = ':';
+            stringify_value(c, v.m[i].v);
+            if (i != v.m_size - 1)
+                *(char *) context_push(c, 1) = ',';
+        }
+        *(char *) context_push(c, 1) = '}';
+    }
+
+    static int stringify_value(Context &c, const Value &v) {
+        size_t i;
+        int ret;
+        STATS_NODE(v.type);
+        switch (v.type) {
+            case NUL:
+                memcpy(context_push(c, 4), "null", 4);
+                break;
+            case FALSE:
+                memcpy(context_push(c, 5), "false", 5);
+                break;
+            case TRUE:
+                memcpy(context_push(c, 4), "true", 4);
+                break;
+            case STRING:
+                stringify_string(c, get_string(v), string_length(v));
+                break;
+            case NUMBER:
+                stringify_number(c, v.num);
+                break;
+            case ARRAY:
+                stringify_array(c, v);
+                break;
+            case OBJECT:
+                stringify_object(c, v);
+                break;
+            default:
+                break;
+        }
+        return STRINGIFY_OK;
+    }
+
+#define PARSE_STRINGIFY_INIT_SIZE 256
+
+    // 自定义分配器按申请时的大小归还内存，所以把结果收缩到调用者知道的大小
+    static char *context_release(Context &c) {
+        if (c.alloc != &std_allocator && c.top != c.size)
+            c.stack = (char *) mem_realloc(c.alloc, c.stack, c.size, c.top);
+        return c.stack;
+    }
+
+    char *stringify(const Value &v, size_t &len, const Allocator *alloc) {
+        StringifyOptions opt;
+        opt.alloc = alloc;
+        return stringify(v, len, opt);
+    }
+
+    char *stringify(const Value &v, size_t &len, const StringifyOptions &opt) {
+        STATS_SCOPE();
+        Context c;
+        int ret;
+        context_init(c, NULL, 0, opt.alloc);
+        if (opt.ascii) c.flags |= CONTEXT_ASCII;
+        c.stack = (char *) mem_alloc(c.alloc, PARSE_STRINGIFY_INIT_SIZE);
+        c.size = PARSE_STRINGIFY_INIT_SIZE;
+        ret = stringify_value(c, v);
+        assert(ret == STRINGIFY_OK);
+        len = c.top;
+        STATS_ADD(bytes_stringified, len);
+        *(char *) context_push(c, 1) = '\0';
+        return context_release(c);
+    }
+
+    void writer_init(Writer &w, const StringifyOptions &opt) {
+        context_init(w.c, NULL, 0, opt.alloc);
+        if (opt.ascii) w.c.flags |= CONTEXT_ASCII;
+        context_init(w.levels, NULL, 0, opt.alloc);
+        w.first = true;
+    }
+
+    void writer_free(Writer &w) {
+        context_free(w.c);
+        context_free(w.levels);
+    }
+
+#ifndef NDEBUG
+    static inline char writer_level(const Writer &w) {
+        return w.levels.top ? w.levels.stack[w.levels.top - 1] : '\0';
+    }
+#endif
+
+    // 每个值（包括容器的开头）之前调用：补上逗号，检查这里是否允许写值
+    static inline void writer_before_value(Writer &w) {
+#ifndef NDEBUG
+        char level = writer_level(w);
+        assert(level != '{');
+        // 根只能有一个值
+        assert(level || w.c.top == 0);
+        if (level == ':') w.levels.stack[w.levels.top - 1] = '{';
+#endif
+        if (!w.first) *(char *) context_push(w.c, 1) = ',';
+        w.first = false;
+    }
+
+    static inline void writer_start(Writer &w, char ch) {
+        writer_before_value(w);
+        *(char *) context_push(w.c, 1) = ch;
+        w.first = true;
+#ifndef NDEBUG
+        *(char *) context_push(w.levels, 1) = ch;
+#endif
+    }
+
+    static inline void writer_end(Writer &w, char ch) {
+#ifndef NDEBUG
+        // 对象不能停在键和值之间
+        assert(writer_level(w) == (ch == '}' ? '{' : '['));
+        context_pop(w.levels, 1);
+#endif
+        *(char *) context_push(w.c, 1) = ch;
+        w.first = false;
+    }
+
+    void writer_start_object(Writer &w) {
+        writer_start(w, '{');
+    }
+
+    void writer_end_object(Writer &w) {
+        writer_end(w, '}');
+    }
+
+    void writer_start_array(Writer &w) {
+        writer_start(w, '[');
+    }
+
+    void writer_end_array(Writer &w) {
+        writer_end(w, ']');
+    }
+
+    void writer_key(Writer &w, const char *k, size_t len) {
+#ifndef NDEBUG
+        assert(writer_level(w) == '{');
+        w.levels.stack[w.levels.top - 1] = ':';
+#endif
+        if (!w.first) *(char *) context_push(w.c, 1) = ',';
+        stringify_string(w.c, k, len);
+        *(char *) context_push(w.c, 1) = ':';
+        w.first = true;
+    }
+
+    void writer_null(Writer &w) {
+        writer_before_value(w);
+        memcpy(context_push(w.c, 4), "null", 4);
+    }
+
+    void writer_bool(Writer &w, bool b) {
+        writer_before_value(w);
+        if (b) memcpy(context_push(w.c, 4), "true", 4);
+        else memcpy(context_push(w.c, 5), "false", 5);
+    }
+
+    void writer_number(Writer &w, double d) {
+        writer_before_value(w);
+        stringify_number(w.c, d);
+    }
+
+    void writer_string(Writer &w, const char *s, size_t len) {
+        writer_before_value(w);
+        stringify_string(w.c, s, len);
+    }
+
+    void writer_value(Writer &w, const Value &v) {
+        writer_before_value(w);
+        stringify_value(w.c, v);
+    }
+
+    const char *writer_data(const Writer &w, size_t &len) {
+        len = w.c.top;
+        return w.c.stack;
+    }
+
+    void writer_clear(Writer &w) {
+        w.c.top = 0;
+        w.levels.top = 0;
+        w.first = true;
+    }
+
+    char *writer_finish(Writer &w, size_t &len) {
+        assert(w.levels.top == 0);
+        len = w.c.top;
+        STATS_ADD(bytes_stringified, len);
+        *(char *) context_push(w.c, 1) = '\0';
+        char *ret = context_release(w.c);
+        w.c.stack = NULL;
+        w.c.size = w.c.top = 0;
+        w.first = true;
+        return ret;
+    }
+
+    // 二进制编码：
+    //   value  = type(1 字节) [payload]
+    //   NUMBER = 8 字节本机字节序的 double
+    //   STRING = varint(len) bytes
+    //   ARRAY  = varint(size) *value
+    //   OBJECT = varint(size) *(varint(k_len) bytes value)
+    // 只用于同构机器之间的缓存，对外交换仍然使用 JSON 文本。
+
+    static void encode_varint(Context &c, size_t n) {
+        while (n >= 0x80) {
+            *(char *) context_push(c, 1) = (char) ((n & 0x7F) | 0x80);
+            n >>= 7;
+        }
+        *(char *) context_push(c, 1) = (char) n;
+    }
+
+    static void encode_bytes(Context &c, const char *s, size_t len) {
+        encode_varint(c, len);
+        if (len) memcpy(context_push(c, len), s, len);
+    }
+
+    static void encode_value(Context &c, const Value &v) {
+        *(char *) context_push(c, 1) = (char) v.type;
+        switch (v.type) {
+            case NUMBER:
+                memcpy(context_push(c, sizeof(double)), &v.num, sizeof(double));
+                break;
+            case STRING:
+                encode_bytes(c, get_string(v), string_length(v));
+                break;
+            case ARRAY:
+                encode_varint(c, v.a_size);
+                for (size_t i = 0; i < v.a_size; i++)
+                    encode_value(c, v.arr[i]);
+                break;
+            case OBJECT:
+                encode_varint(c, v.m_size);
+                for (size_t i = 0; i < v.m_size; i++) {
+                    encode_bytes(c, v.m[i].k, v.m[i].k_len);
+                    encode_value(c, v.m[i].v);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    char *encode_binary(const Value &v, size_t &len, const Allocator *alloc) {
+        Context c;
+        context_init(c, NULL, 0, alloc);
+        c.stack = (char *) mem_alloc(c.alloc, PARSE_STRINGIFY_INIT_SIZE);
+        c.size = PARSE_STRINGIFY_INIT_SIZE;
+        encode_value(c, v);
+        len = c.top;
+        return context_release(c);
+    }
+
+    static bool decode_varint(Context &c, size_t &n) {
+        n = 0;
+        for (unsigned shift = 0; c.json != c.end && shift < sizeof(size_t) * 8; shift += 7) {
+            unsigned char ch = (unsigned char) *c.json++;
+            n |= (size_t) (ch & 0x7F) << shift;
+            if (!(ch & 0x80)) return true;
+        }
+        return false;
+    }
+
+    // 每个元素至少占 1 字节，所以数量不可能超过剩余长度，借此拒绝畸形输入里的超大分配
+    static bool decode_size(Context &c, size_t &n) {
+        return decode_varint(c, n) && n <= (size_t) (c.end - c.json);
+    }
+
+    static int decode_value(Context &c, Value &v) {
+        if (c.json == c.end) return PARSE_INVALID_BINARY;
+        size_t n;
+        switch (*c.json++) {
+            case NUL:
+                v.type = NUL;
+                return PARSE_OK;
+            case FALSE:
+                v.type = FALSE;
+                return PARSE_OK;
+            case TRUE:
+                v.type = TRUE;
+                return PARSE_OK;
+            case NUMBER:
+                if ((size_t) (c.end - c.json) < sizeof(double)) return PARSE_INVALID_BINARY;
+                memcpy(&v.num, c.json, sizeof(double));
+                c.json += sizeof(double);
+                v.type = NUMBER;
+                return PARSE_OK;
+            case STRING:
+                if (!decode_size(c, n)) return PARSE_INVALID_BINARY;
+                set_string(v, c.json, n, c.alloc);
+                c.json += n;
+                return PARSE_OK;
+            case ARRAY:
+                if (!decode_size(c, n)) return PARSE_INVALID_BINARY;
+                v.arr = n ? (Value *) mem_alloc(c.alloc, n * sizeof(Value)) : nullptr;
+                for (size_t i = 0; i < n; i++) {
+                    init(v.arr[i]);
+                    int ret = decode_value(c, v.arr[i]);
+                    if (ret != PARSE_OK) {
+                        // 剩下的元素置空，整块按申请时的大小释放
+                        while (++i < n) init(v.arr[i]);
+                        v.a_size = n;
+                        v.type = ARRAY;
+                        value_free(v, c.alloc);
+                        return ret;
+                    }
+                }
+                v.a_size = n;
+                v.type = ARRAY;
+                return PARSE_OK;
+            case OBJECT:
+                if (!decode_size(c, n)) return PARSE_INVALID_BINARY;
+                v.m = n ? (member *) mem_alloc(c.alloc, n * sizeof(member)) : nullptr;
+                for (size_t i = 0; i < n; i++) {
+                    member &m = v.m[i];
+                    size_t k_len;
+                    int ret = PARSE_INVALID_BINARY;
+                    m.k = nullptr;
+                    m.k_len = 0;
+                    m.k_interned = 0;
+                    init(m.v);
+                    if (decode_size(c, k_len)) {
+                        m.k = (char *) mem_alloc(c.alloc, k_len + 1);
+                        memcpy(m.k, c.json, k_len);
+                        m.k[k_len] = '\0';
+                        m.k_len = k_len;
+                        c.json += k_len;
+                        ret = decode_value(c, m.v);
+                    }
+                    if (ret != PARSE_OK) {
+                        while (++i < n) {
+                            v.m[i].k = nullptr;
+                            v.m[i].k_interned = 0;
+                            init(v.m[i].v);
+                        }
+                        v.m_size = n;
+                        v.type = OBJECT;
+                        value_free(v, c.alloc);
+                        return ret;
+                    }
+                }
+                v.m_size = n;
+                v.type = OBJECT;
+                return PARSE_OK;
+            default:
+                return PARSE_INVALID_BINARY;
+        }
+    }
+
+    int decode_binary(Value &v, const char *data, size_t len, const Allocator *alloc) {
+        Context c;
+        context_init(c, data, len, alloc);
+        init(v);
+        int ret = decode_value(c, v);
+        if (ret == PARSE_OK && c.json != c.end) {
+            value_free(v, c.alloc);
+            ret = PARSE_INVALID_BINARY;
+        }
+        return ret;
+    }
+
+    // 磁带布局：[TapeHeader][TapeNode * nodes][字符串池]。
+    // 子节点紧跟在父节点之后，对象的每个成员是一个 STRING 键节点加上值的子树。
+    struct TapeHeader {
+        size_t nodes;
+        size_t strings;
+    };
+
+    static inline const TapeNode *tape_nodes(const Tape &t) {
+        return (const TapeNode *) (t.data + sizeof(TapeHeader));
+    }
+
+    static inline const char *tape_strings(const Tape &t) {
+        return (const char *) (tape_nodes(t) + ((const TapeHeader *) t.data)->nodes);
+    }
+
+    static void tape_count(const Value &v, size_t &nodes, size_t &strings) {
+        nodes++;
+        switch (v.type) {
+            case STRING:
+                strings += string_length(v) + 1;
+                break;
+            case ARRAY:
+                for (size_t i = 0; i < v.a_size; i++)
+                    tape_count(v.arr[i], nodes, strings);
+                break;
+            case OBJECT:
+                for (size_t i = 0; i < v.m_size; i++) {
+                    nodes++;
+                    strings += v.m[i].k_len + 1;
+                    tape_count(v.m[i].v, nodes, strings);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    struct TapeWriter {
+        TapeNode *nodes;
+        char *strings;
+        size_t node, offset;
+    };
+
+    static void tape_string(TapeWriter &w, const char *s, size_t len) {
+        TapeNode &n = w.nodes[w.node++];
+        n.type = STRING;
+        n.size = len;
+        n.offset = w.offset;
+        memcpy(w.strings + w.offset, s, len);
+        w.strings[w.offset + len] = '\0';
+        w.offset += len + 1;
+    }
+
+    static void tape_fill(TapeWriter &w, const Value &v) {
+        if (v.type == STRING) {
+            tape_string(w, get_string(v), string_length(v));
+            return;
+        }
+        size_t self = w.node++;
+        TapeNode &n = w.nodes[self];
+        n.type = v.type;
+        switch (v.type) {
+            case NUMBER:
+                n.num = v.num;
+                break;
+            case ARRAY:
+                n.size = v.a_size;
+                for (size_t i = 0; i < v.a_size; i++)
+                    tape_fill(w, v.arr[i]);
+                w.nodes[self].next = w.node;
+                break;
+            case OBJECT:
+                n.size = v.m_size;
+                for (size_t i = 0; i < v.m_size; i++) {
+                    tape_string(w, v.m[i].k, v.m[i].k_len);
+                    tape_fill(w, v.m[i].v);
+                }
+                w.nodes[self].next = w.node;
+                break;
+            default:
+                break;
+        }
+    }
+
+    void tape_build(Tape &t, const Value &v, const Allocator *alloc) {
+        size_t nodes = 0, strings = 0;
+        tape_count(v, nodes, strings);
+        t.size = sizeof(TapeHeader) + nodes * sizeof(TapeNode) + strings;
+        t.data = (char *) mem_alloc(allocator_or_default(alloc), t.size);
+        auto *h = (TapeHeader *) t.data;
+        h->nodes = nodes;
+        h->strings = strings;
+        TapeWriter w;
+        w.nodes = (TapeNode *) (t.data + sizeof(TapeHeader));
+        w.strings = (char *) (w.nodes + nodes);
+        w.node = w.offset = 0;
+        tape_fill(w, v);
+        assert(w.node == nodes && w.offset == strings);
+    }
+
+    int parse_tape(Tape &t, const char *json, size_t len, const Allocator *alloc) {
+        Value v;
+        ParseOptions opt;
+        opt.alloc = alloc;
+        int ret = parse(v, json, len, opt);
+        t.data = NULL;
+        t.size = 0;
+        if (ret == PARSE_OK) {
+            tape_build(t, v, alloc);
+            value_free(v, alloc);
+        }
+        return ret;
+    }
+
+    void tape_free(Tape &t, const Allocator *alloc) {
+        mem_free(allocator_or_default(alloc), t.data, t.size);
+        t.data = NULL;
+        t.size = 0;
+    }
+
+    size_t tape_skip(const Tape &t, size_t node) {
+        const TapeNode &n = tape_nodes(t)[node];
+        return n.type == ARRAY || n.type == OBJECT ? n.next : node + 1;
+    }
+
+    Type get_type(const Tape &t, size_t node) {
+        return tape_nodes(t)[node].type;
+    }
+
+    int get_boolean(const Tape &t, size_t node) {
+        assert(get_type(t, node) == FALSE || get_type(t, node) == TRUE);
+        return tape_nodes(t)[node].type;
+    }
+
+    double get_number(const Tape &t, size_t node) {
+        assert(get_type(t, node) == NUMBER);
+        return tape_nodes(t)[node].num;
+    }
+
+    const char *get_string(const Tape &t, size_t node) {
+        assert(get_type(t, node) == STRING);
+        return tape_strings(t) + tape_nodes(t)[node].offset;
+    }
+
+    size_t get_string_length(const Tape &t, size_t node) {
+        assert(get_type(t, node) == STRING);
+        return tape_nodes(t)[node].size;
+    }
+
+    size_t get_array_size(const Tape &t, size_t node) {
+        assert(get_type(t, node) == ARRAY);
+        return tape_nodes(t)[node].size;
+    }
+
+    size_t get_array_element(const Tape &t, size_t node, size_t index) {
+        assert(get_type(t, node) == ARRAY);
+        assert(tape_nodes(t)[node].size > index);
+        size_t e = node + 1;
+        while (index--)
+            e = tape_skip(t, e);
+        return e;
+    }
+
+    size_t get_object_size(const Tape &t, size_t node) {
+        assert(get_type(t, node) == OBJECT);
+        return tape_nodes(t)[node].size;
+    }
+
+    static size_t tape_member(const Tape &t, size_t node, size_t index) {
+        assert(get_type(t, node) == OBJECT);
+        assert(tape_nodes(t)[node].size > index);
+        size_t k = node + 1;
+        while (index--)
+            k = tape_skip(t, k + 1);
+        return k;
+    }
+
+    const char *get_object_key(const Tape &t, size_t node, size_t index) {
+        return get_string(t, tape_member(t, node, index));
+    }
+
+    size_t get_object_key_length(const Tape &t, size_t node, size_t index) {
+        return get_string_length(t, tape_member(t, node, index));
+    }
+
+    size_t get_object_value(const Tape &t, size_t node, size_t index) {
+        return tape_member(t, node, index) + 1;
+    }
+
+
+    // 模式编译成 SchemaNode 数组，子模式用下标引用；属性和枚举值分别存放在
+    // props 和 enums 里，每个节点占其中连续的一段。
+#define SCHEMA_ANY ((size_t) -1)      // 不做任何约束
+#define SCHEMA_NONE ((size_t) -2)     // additionalProperties: false
+
+#define SCHEMA_INTEGER (1u << 7)
+#define SCHEMA_ALL_TYPES ((1u << 7) - 1)
+
+    struct SchemaNode {
+        unsigned types;             // 1 << Type 的组合，integer 用 SCHEMA_INTEGER
+        double minimum, exclusive_minimum;
+        double maximum, exclusive_maximum;
+        size_t min_length, max_length;
+        size_t min_items, max_items;
+        size_t items;
+        size_t additional;
+        size_t props, prop_count, required_count;
+        size_t enums, enum_count;
+        size_t konst;               // const 在 enums 里的下标，没有时为 SCHEMA_ANY
+    };
+
+    struct SchemaProp {
+        char *k;
+        size_t k_len;
+        size_t node;
+        bool required;
+    };
+
+    struct Schema {
+        SchemaNode *nodes;
+        size_t node_count, node_cap;
+        SchemaProp *props;
+        size_t prop_count, prop_cap;
+        Value *enums;
+        size_t enum_count, enum_cap;
+        size_t root;                // 可能是 SCHEMA_ANY
+        const Allocator *alloc;
+    };
+
+    // 保证数组能再容纳 n 个元素
+    static void *schema_reserve(const Allocator *alloc, void *p, size_t elem, size_t count, size_t &cap, size_t n) {
+        if (count + n <= cap) return p;
+        size_t new_cap = cap ? cap : 8;
+        while (new_cap < count + n) new_cap += new_cap >> 1;
+        p = mem_realloc(alloc, p, cap * elem, new_cap * elem);
+        cap = new_cap;
+        return p;
+    }
+
+    static bool schema_get_size(const Value &v, size_t &n) {
+        if (v.type != NUMBER || v.num < 0 || v.num != std::floor(v.num)) return false;
+        // 超出 size_t 的上限等同于不限制，直接转换是未定义行为
+        n = v.num >= std::ldexp(1.0, std::numeric_limits<size_t>::digits) ? (size_t) -1 : (size_t) v.num;
+        return true;
+    }
+
+    static int schema_type_bits(const Value &name, unsigned &types) {
+        static const struct {
+            const char *name;
+            unsigned bits;
+        } names[] = {
+                {"null",    1u << NUL},
+                {"boolean", 1u << FALSE | 1u << TRUE},
+                {"number",  1u << NUMBER},
+                {"integer", SCHEMA_INTEGER},
+                {"string",  1u << STRING},
+                {"array",   1u << ARRAY},
+                {"object",  1u << OBJECT},
+        };
+        if (name.type != STRING) return SCHEMA_INVALID;
+        for (auto &n: names) {
+            if (string_equal(name, n.name, strlen(n.name))) {
+                types |= n.bits;
+                return PARSE_OK;
+            }
+        }
+        return SCHEMA_INVALID;
+    }
+
+    static int schema_compile_node(Schema *s, const Value &doc, size_t &index);
+
+    static int schema_compile_props(Schema *s, size_t index, const Value *properties, const Value *required) {
+        size_t max = (properties ? properties->m_size : 0) + (required ? required->a_size : 0);
+        size_t begin = s->prop_count, count = 0;
+        s->props = (SchemaProp *) schema_reserve(s->alloc, s->props, sizeof(SchemaProp), s->prop_count,
+                                                 s->prop_cap, max);
+        if (properties) {
+            for (size_t i = 0; i < properties->m_size; i++, count++) {
+                SchemaProp &p = s->props[begin + count];
+                p.k_len = properties->m[i].k_len;
+                p.k = (char *) mem_alloc(s->alloc, p.k_len + 1);
+                memcpy(p.k, properties->m[i].k, p.k_len + 1);
+                p.node = SCHEMA_ANY;
+                p.required = false;
+                s->prop_count++;
+            }
+        }
+        size_t required_count = 0;
+        if (required) {
+            for (size_t i = 0; i < required->a_size; i++) {
+                const Value &name = required->arr[i];
+                if (name.type != STRING) return SCHEMA_INVALID;
+                size_t j = 0;
+                while (j < count && !string_equal(name, s->props[begin + j].k, s->props[begin + j].k_len)) j++;
+                SchemaProp &p = s->props[begin + j];
+                if (j == count) {
+                    p.k_len = string_length(name);
+                    p.k = (char *) mem_alloc(s->alloc, p.k_len + 1);
+                    memcpy(p.k, get_string(name), p.k_len + 1);
+                    p.node = SCHEMA_ANY;
+                    p.required = false;
+                    s->prop_count++;
+                    count++;
+                }
+                if (!p.required) {
+                    p.required = true;
+                    required_count++;
+                }
+            }
+        }
+        s->nodes[index].props = begin;
+        s->nodes[index].prop_count = count;
+        s->nodes[index].required_count = required_count;
+        // 子模式追加在这一段之后，下标不变
+        if (properties) {
+            for (size_t i = 0; i < properties->m_size; i++) {
+                size_t child;
+                int ret = schema_compile_node(s, properties->m[i].v, child);
+                if (ret != PARSE_OK) return ret;
+                s->props[begin + i].node = child;
+            }
+        }
+        return PARSE_OK;
+    }
+
+    static int schema_compile_node(Schema *s, const Value &doc, size_t &index) {
+        if (doc.type == TRUE) {
+            index = SCHEMA_ANY;
+            return PARSE_OK;
+        }
+        if (doc.type != FALSE && doc.type != OBJECT) return SCHEMA_INVALID;
+
+        s->nodes = (SchemaNode *) schema_reserve(s->alloc, s->nodes, sizeof(SchemaNode), s->node_count,
+                                                 s->node_cap, 1);
+        index = s->node_count++;
+        SchemaNode &n = s->nodes[index];
+        n.types = doc.type == FALSE ? 0 : SCHEMA_ALL_TYPES | SCHEMA_INTEGER;
+        n.minimum = n.exclusive_minimum = -HUGE_VAL;
+        n.maximum = n.exclusive_maximum = HUGE_VAL;
+        n.min_length = n.min_items = 0;
+        n.max_length = n.max_items = (size_t) -1;
+        n.items = n.additional = SCHEMA_ANY;
+        n.props = n.prop_count = n.required_count = 0;
+        n.enums = n.enum_count = 0;
+        n.konst = SCHEMA_ANY;
+        if (doc.type == FALSE) return PARSE_OK;
+
+        const Value *properties = NULL, *required = NULL, *items = NULL, *additional = NULL;
+        for (size_t i = 0; i < doc.m_size; i++) {
+            std::string_view key(doc.m[i].k, doc.m[i].k_len);
+            const Value &v = doc.m[i].v;
+            // 子模式会追加节点，数组可能搬迁，所以每次都重新取 node
+            SchemaNode &node = s->nodes[index];
+            int ret = PARSE_OK;
+            if (key == "type") {
+                node.types = 0;
+                if (v.type == ARRAY) {
+                    for (size_t j = 0; j < v.a_size && ret == PARSE_OK; j++)
+                        ret = schema_type_bits(v.arr[j], node.types);
+                } else {
+                    ret = schema_type_bits(v, node.types);
+                }
+                // number 已经包含了 integer
+                if (node.types & 1u << NUMBER) node.types |= SCHEMA_INTEGER;
+            } else if (key == "enum" || key == "const") {
+                // enum 和 const 各自独立检查，同时出现时两个都要满足
+                bool is_enum = key == "enum";
+                if (is_enum && v.type != ARRAY) return SCHEMA_INVALID;
+                const Value *src = is_enum ? v.arr : &v;
+                size_t count = is_enum ? v.a_size : 1;
+                s->enums = (Value *) schema_reserve(s->alloc, s->enums, sizeof(Value), s->enum_count,
+                                                    s->enum_cap, count);
+                if (is_enum) {
+                    node.enums = s->enum_count;
+                    node.enum_count = count;
+                } else {
+                    node.konst = s->enum_count;
+                }
+                for (size_t j = 0; j < count; j++)
+                    value_copy_raw(s->enums[s->enum_count++], src[j], s->alloc);
+            } else if (key == "minimum" || key == "exclusiveMinimum") {
+                if (v.type != NUMBER) return SCHEMA_INVALID;
+                (key == "minimum" ? node.minimum : node.exclusive_minimum) = v.num;
+            } else if (key == "maximum" || key == "exclusiveMaximum") {
+                if (v.type != NUMBER) return SCHEMA_INVALID;
+                (key == "maximum" ? node.maximum : node.exclusive_maximum) = v.num;
+            } else if (key == "minLength") {
+                if (!schema_get_size(v, node.min_length)) return SCHEMA_INVALID;
+            } else if (key == "maxLength") {
+                if (!schema_get_size(v, node.max_length)) return SCHEMA_INVALID;
+            } else if (key == "minItems") {
+                if (!schema_get_size(v, node.min_items)) return SCHEMA_INVALID;
+            } else if (key == "maxItems") {
+                if (!schema_get_size(v, node.max_items)) return SCHEMA_INVALID;
+            } else if (key == "properties") {
+                if (v.type != OBJECT) return SCHEMA_INVALID;
+                properties = &v;
+            } else if (key == "required") {
+                if (v.type != ARRAY) return SCHEMA_INVALID;
+                required = &v;
+            } else if (key == "items") {
+                items = &v;
+            } else if (key == "additionalProperties") {
+                additional = &v;
+            }
+            if (ret != PARSE_OK) return ret;
+        }
+
+        int ret;
+        if (properties || required) {
+            if ((ret = schema_compile_props(s, index, properties, required)) != PARSE_OK) return ret;
+        }
+        if (items) {
+            size_t child;
+            if ((ret = schema_compile_node(s, *items, child)) != PARSE_OK) return ret;
+            s->nodes[index].items = child;
+        }
+        if (additional) {
+            size_t child = SCHEMA_NONE;
+            if (additional->type != FALSE && (ret = schema_compile_node(s, *additional, child)) != PARSE_OK)
+                return ret;
+            s->nodes[index].additional = child;
+        }
+
+        // 没有任何约束的节点（例如 {}）不占位置，校验时直接跳过
+        const SchemaNode &last = s->nodes[index];
+        if (index == s->node_count - 1 && last.types == (SCHEMA_ALL_TYPES | SCHEMA_INTEGER) &&
+            last.minimum == -HUGE_VAL && last.exclusive_minimum == -HUGE_VAL && last.maximum == HUGE_VAL &&
+            last.exclusive_maximum == HUGE_VAL && last.min_length == 0 && last.max_length == (size_t) -1 &&
+            last.min_items == 0 && last.max_items == (size_t) -1 && last.items == SCHEMA_ANY &&
+            last.additional == SCHEMA_ANY && last.prop_count == 0 && last.enum_count == 0 &&
+            last.konst == SCHEMA_ANY) {
+            s->node_count--;
+            index = SCHEMA_ANY;
+        }
+        return PARSE_OK;
+    }
+
+    int schema_compile(Schema *&s, const Value &doc, const Allocator *alloc) {
+        alloc = allocator_or_default(alloc);
+        s = (Schema *) mem_alloc(alloc, sizeof(Schema));
+        memset(s, 0, sizeof(Schema));
+        s->alloc = alloc;
+        int ret = schema_compile_node(s, doc, s->root);
+        if (ret != PARSE_OK) {
+            schema_free(s);
+            s = NULL;
+        }
+        return ret;
+    }
+
+    void schema_free(Schema *s) {
+        if (!s) return;
+        const Allocator *alloc = s->alloc;
+        for (size_t i = 0; i < s->prop_count; i++)
+            mem_free(alloc, s->props[i].k, s->props[i].k_len + 1);
+        for (size_t i = 0; i < s->enum_count; i++)
+            value_free(s->enums[i], alloc);
+        mem_free(alloc, s->nodes, s->node_cap * sizeof(SchemaNode));
+        mem_free(alloc, s->props, s->prop_cap * sizeof(SchemaProp));
+        mem_free(alloc, s->enums, s->enum_cap * sizeof(Value));
+        mem_free(alloc, s, sizeof(Schema));
+    }
+
+    // 以下检查在值树校验和流式校验之间共用
+    static bool schema_check_type(const SchemaNode &n, Type type, double num) {
+        if (n.types & 1u << type) return true;
+        return type == NUMBER && (n.types & SCHEMA_INTEGER) && std::isfinite(num) && num == std::floor(num);
+    }
+
+    static int schema_check_number(const SchemaNode &n, double num) {
+        if (num < n.minimum || num <= n.exclusive_minimum) return SCHEMA_RANGE;
+        if (num > n.maximum || num >= n.exclusive_maximum) return SCHEMA_RANGE;
+        return PARSE_OK;
+    }
+
+    // 长度按 UTF-8 码点计，即不以 10xxxxxx 开头的字节数
+    static int schema_check_string(const SchemaNode &n, const char *str, size_t len) {
+        if (n.min_length == 0 && n.max_length == (size_t) -1) return PARSE_OK;
+        size_t count = 0;
+        for (size_t i = 0; i < len; i++)
+            count += ((unsigned char) str[i] & 0xC0) != 0x80;
+        return count < n.min_length || count > n.max_length ? SCHEMA_LENGTH : PARSE_OK;
+    }
+
+    static bool schema_check_enum(const Schema *s, const SchemaNode &n, const Value &v) {
+        if (n.konst != SCHEMA_ANY && !value_equal(s->enums[n.konst], v)) return false;
+        for (size_t i = 0; i < n.enum_count; i++)
+            if (value_equal(s->enums[n.enums + i], v)) return true;
+        return n.enum_count == 0;
+    }
+
+    static size_t schema_find_prop(const Schema *s, const SchemaNode &n, const char *k, size_t klen) {
+        for (size_t i = n.props; i < n.props + n.prop_count; i++)
+            if (s->props[i].k_len == klen && memcmp(s->props[i].k, k, klen) == 0) return i;
+        return KEY_NOT_EXIST;
+    }
+
+    // 在 c 的栈上为当前对象的每个属性记一个是否出现过的标记，返回标记的起始偏移
+    static size_t schema_seen_begin(Context &c, const SchemaNode &n) {
+        size_t offset = c.top;
+        if (n.prop_count) memset(context_push(c, n.prop_count), 0, n.prop_count);
+        return offset;
+    }
+
+    static int schema_seen_end(Context &c, const Schema *s, const SchemaNode &n, size_t offset) {
+        size_t required = 0;
+        for (size_t i = 0; i < n.prop_count; i++)
+            required += c.stack[offset + i] && s->props[n.props + i].required;
+        c.top = offset;
+        return required == n.required_count ? PARSE_OK : SCHEMA_REQUIRED;
+    }
+
+    static int schema_validate_value(const Schema *s, size_t index, const Value &v, Context &c) {
+        if (index == SCHEMA_ANY) return PARSE_OK;
+        const SchemaNode &n = s->nodes[index];
+        if (!schema_check_type(n, v.type, v.type == NUMBER ? v.num : 0.0)) return SCHEMA_TYPE;
+        if (!schema_check_enum(s, n, v)) return SCHEMA_ENUM;
+        int ret = PARSE_OK;
+        switch (v.type) {
+            case NUMBER:
+                return schema_check_number(n, v.num);
+            case STRING:
+                return schema_check_string(n, get_string(v), string_length(v));
+            case ARRAY:
+                // 与流式校验的检查顺序一致：元素依次校验，超过 maxItems 时立即失败
+                for (size_t i = 0; i < v.a_size && ret == PARSE_OK; i++) {
+                    if (i >= n.max_items) return SCHEMA_LENGTH;
+                    ret = schema_validate_value(s, n.items, v.arr[i], c);
+                }
+                if (ret != PARSE_OK) return ret;
+                return v.a_size < n.min_items ? SCHEMA_LENGTH : PARSE_OK;
+            case OBJECT: {
+                size_t seen = schema_seen_begin(c, n);
+                for (size_t i = 0; i < v.m_size && ret == PARSE_OK; i++) {
+                    size_t p = schema_find_prop(s, n, v.m[i].k, v.m[i].k_len);
+                    size_t child = n.additional;
+                    if (p != KEY_NOT_EXIST) {
+                        c.stack[seen + p - n.props] = 1;
+                        child = s->props[p].node;
+                    }
+                    ret = child == SCHEMA_NONE ? SCHEMA_ADDITIONAL : schema_validate_value(s, child, v.m[i].v, c);
+                }
+                if (ret != PARSE_OK) {
+                    c.top = seen;
+                    return ret;
+                }
+                return schema_seen_end(c, s, n, seen);
+            }
+            default:
+                return PARSE_OK;
+        }
+    }
+
+    int schema_validate(const Schema *s, const Value &v) {
+        Context c;
+        context_init(c, NULL, 0, s->alloc);
+        int ret = schema_validate_value(s, s->root, v, c);
+        context_free(c);
+        return ret;
+    }
+
+    static int schema_validate_stream(const Schema *s, size_t index, Reader &r, Context &c) {
+        if (index == SCHEMA_ANY) return reader_skip(r);
+        const SchemaNode &n = s->nodes[index];
+        Type type;
+        int ret = reader_peek(r, type);
+        if (ret != PARSE_OK) return ret;
+
+        // 带枚举或 const 的节点取出整个值比较，枚举值通常很短
+        if (n.enum_count || n.konst != SCHEMA_ANY) {
+            Value v;
+            if ((ret = reader_value(r, v)) == PARSE_OK)
+                ret = schema_validate_value(s, index, v, c);
+            value_free(v, r.c.alloc);
+            return ret;
+        }
+
+        // 标量先读完再检查类型，这样非法的文本报告的是语法错误
+        switch (type) {
+            case NUL:
+                if ((ret = reader_null(r)) != PARSE_OK) return ret;
+                return schema_check_type(n, NUL, 0.0) ? PARSE_OK : SCHEMA_TYPE;
+            case FALSE:
+            case TRUE: {
+                bool b;
+                if ((ret = reader_bool(r, b)) != PARSE_OK) return ret;
+                return schema_check_type(n, type, 0.0) ? PARSE_OK : SCHEMA_TYPE;
+            }
+            case NUMBER: {
+                double num;
+                if ((ret = reader_number(r, num)) != PARSE_OK)
+                    return ret == PARSE_TYPE_MISMATCH ? PARSE_INVALID_VALUE : ret;
+                return schema_check_type(n, NUMBER, num) ? schema_check_number(n, num) : SCHEMA_TYPE;
+            }
+            case STRING: {
+                const char *str;
+                size_t len;
+                if ((ret = reader_string(r, str, len)) != PARSE_OK) return ret;
+                return schema_check_type(n, STRING, 0.0) ? schema_check_string(n, str, len) : SCHEMA_TYPE;
+            }
+            case ARRAY: {
+                if (!schema_check_type(n, ARRAY, 0.0)) return SCHEMA_TYPE;
+                bool more;
+                size_t count = 0;
+                reader_begin_array(r);
+                while ((ret = reader_next_element(r, more)) == PARSE_OK && more) {
+                    if (++count > n.max_items) return SCHEMA_LENGTH;
+                    if ((ret = schema_validate_stream(s, n.items, r, c)) != PARSE_OK) return ret;
+                }
+                if (ret != PARSE_OK) return ret;
+                return count < n.min_items ? SCHEMA_LENGTH : PARSE_OK;
+            }
+            case OBJECT: {
+                if (!schema_check_type(n, OBJECT, 0.0)) return SCHEMA_TYPE;
+                bool more;
+                const char *k;
+                size_t klen;
+                size_t seen = schema_seen_begin(c, n);
+                reader_begin_object(r);
+                while ((ret = reader_next_member(r, more, k, klen)) == PARSE_OK && more) {
+                    // 键在读取值之后失效，先查好
+                    size_t p = schema_find_prop(s, n, k, klen);
+                    size_t child = n.additional;
+                    if (p != KEY_NOT_EXIST) {
+                        c.stack[seen + p - n.props] = 1;
+                        child = s->props[p].node;
+                    }
+                    if (child == SCHEMA_NONE) ret = SCHEMA_ADDITIONAL;
+                    else ret = schema_validate_stream(s, child, r, c);
+                    if (ret != PARSE_OK) break;
+                }
+                if (ret != PARSE_OK) {
+                    c.top = seen;
+                    return ret;
+                }
+                return schema_seen_end(c, s, n, seen);
+            }
+        }
+        return PARSE_OK;
+    }
+
+    int schema_validate(const Schema *s, const char *json, size_t len) {
+        Reader r;
+        Context c;
+        reader_init(r, json, len, s->alloc);
+        context_init(c, NULL, 0, s->alloc);
+        int ret = schema_validate_stream(s, s->root, r, c);
+        if (ret == PARSE_OK) ret = reader_end(r);
+        context_free(c);
+        reader_free(r);
+        return ret;
     }
 
-}
\ No newline at end of file
+}
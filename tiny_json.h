@@ -10,6 +10,9 @@
 #include <crtdbg.h>
 #endif
 
+#include <cstddef>
+#include <string_view>
+
 namespace tiny_json {
 
     enum Type {
@@ -30,6 +33,21 @@ namespace tiny_json {
         PARSE_MISS_KEY,
         PARSE_MISS_COLON,
         PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+        PARSE_FILE_ERROR,
+        PARSE_INVALID_BINARY,
+        PARSE_TYPE_MISMATCH,
+        PARSE_INVALID_UTF8,     // 开启 validate_utf8 时，字符串不是合法的 UTF-8
+        PARSE_DUPLICATE_KEY,    // duplicate_keys 为 DUPLICATE_KEYS_REJECT 时，同一个对象里出现重复的键
+        SCHEMA_INVALID,         // 模式文档本身不合法或用到了不支持的写法
+        SCHEMA_TYPE,
+        SCHEMA_REQUIRED,
+        SCHEMA_ADDITIONAL,
+        SCHEMA_RANGE,
+        SCHEMA_LENGTH,
+        SCHEMA_ENUM,
+        PATCH_INVALID,          // 补丁格式错误：缺少字段、未知的 op、路径不以 '/' 开头等
+        PATCH_PATH,             // 路径指向的位置不存在
+        PATCH_TEST,             // test 操作比较失败
         STRINGIFY_OK,
     };
 
@@ -41,6 +59,7 @@ namespace tiny_json {
                 char *str;
                 size_t len;
             };  // string
+            char short_str[16]; // 不超过 15 字节的字符串直接存放在这里，不另外分配
             struct {
                 Value *arr;
                 size_t a_size;
@@ -52,40 +71,261 @@ namespace tiny_json {
             double num;
         };
         Type type;
+        unsigned char short_len;    // STRING: 0 表示堆上的字符串，否则是短字符串长度加 1
     };
 
     struct member {
         char *k;
-        size_t k_len;
+        // 键的长度和标记共用一个字，不让每个成员为一个标记多占 8 字节
+        size_t k_len: sizeof(size_t) * 8 - 1;
+        size_t k_interned: 1;       // k 属于某个 KeyTable，释放时不归还
         Value v;
     };
 
+    // short_len 用的是 Value 原有的填充字节，64 位平台上 Value 仍是 24 字节，member 是 40 字节
+    static_assert(sizeof(void *) != 8 || sizeof(Value) == 24, "Value must stay 24 bytes");
+    static_assert(sizeof(void *) != 8 || sizeof(member) == 40, "member must stay 40 bytes");
+
+    // 键表：相同的键只保存一份不可变的拷贝。解析时通过 ParseOptions::keys 使用，
+    // 用键表解析出来的值必须在键表释放之前释放。
+    struct KeyTable;
+
 
 #define init(v) do {(v).type = NUL; } while(0)
 
-    void value_free(Value &v);
+    // 库内所有内存都经由分配器申请。realloc_fn 和 free_fn 收到的 size
+    // 总是这块内存申请时的大小，内存池或 arena 可以据此直接归还。
+    // 值树本身不记录分配器，释放时要传入解析时用的同一个分配器。
+    // 各接口的分配器参数为 NULL 时使用 default_allocator()。
+    struct Allocator {
+        void *(*malloc_fn)(void *user, size_t size);
+        void *(*realloc_fn)(void *user, void *p, size_t old_size, size_t new_size);
+        void (*free_fn)(void *user, void *p, size_t size);
+        void *user;
+    };
+
+    // 直接转发给 malloc / realloc / free
+    const Allocator *default_allocator();
+
+    // 解析和生成的统计计数，只有用 TINY_JSON_STATS 编译时才收集，否则全部为 0。
+    // 一次 parse、parse_parallel、parse_ndjson 或 stringify 算一次调用，计在调用它的线程上；
+    // 工作线程上的分块和记录在返回前合并进这一次调用，回调里的调用也包含在内。
+    // 分配和栈的计数包含调用过程中的所有分配，stack_peak 取各线程中的最大值。
+    struct Stats {
+        size_t calls;
+        size_t bytes_parsed, bytes_stringified;
+        size_t nodes[OBJECT + 1];   // 按 Type 统计的节点数
+        size_t escapes;             // 字符串中的转义序列
+        size_t stack_reallocs;      // Context 栈扩容的次数
+        size_t stack_peak;          // Context 栈使用的最大字节数
+        size_t alloc_calls, alloc_bytes;
+        size_t max_depth;           // 数组、对象的最大嵌套层数
+    };
+
+    // 当前线程最近一次调用的统计
+    Stats last_call_stats();
+
+    // 当前线程所有调用的累计，stack_peak 和 max_depth 取最大值
+    Stats thread_stats();
+
+    void reset_thread_stats();
+
+    // 跳过空白、扫描字符串中无需处理的字节（解析和生成共用）的实现。
+    // 程序启动时按 CPU 支持的指令集选出最快的一种，set_kernel 可以强制使用某一种，用于测试和性能比较。
+    enum Kernel {
+        KERNEL_AUTO, KERNEL_SCALAR, KERNEL_SSE42, KERNEL_AVX2, KERNEL_AVX512
+    };
+
+    // 当前的编译器和 CPU 是否支持，KERNEL_AUTO 和 KERNEL_SCALAR 总是支持
+    bool kernel_supported(Kernel k);
+
+    // 不支持时返回 false，当前实现不变；KERNEL_AUTO 恢复自动选择。
+    // 可以和解析、生成并发调用，进行中的调用可能前后用到不同的实现，结果相同。
+    bool set_kernel(Kernel k);
+
+    // 当前使用的实现，不会是 KERNEL_AUTO
+    Kernel active_kernel();
+
+    const char *kernel_name(Kernel k);
+
+    // 解析和生成共用的状态：输入游标和一个按需增长的字节栈
+    struct Context {
+        const char *json;
+        const char *end;    // 输入的末尾，解析时不会读取 end 及之后的字节
+        char *stack;
+        size_t size, top;
+        const Allocator *alloc;
+        KeyTable *keys;
+        unsigned flags;     // 由 ParseOptions 决定的解析行为，见 tiny_json.cpp 中的 CONTEXT_*
+    };
+
+    void value_free(Value &v, const Allocator *alloc = NULL);
 
     int parse(Value &v, const char *json);
 
+    // 只解析 [json, json + len)，不要求以 '\0' 结尾，也不会读取范围之外的字节
+    int parse(Value &v, const char *json, size_t len);
+
+    // 同一个对象里出现重复的键时的处理方式
+    enum DuplicateKeys {
+        DUPLICATE_KEYS_ALLOW,   // 全部按原样保留，查找返回第一个
+        DUPLICATE_KEYS_REJECT,  // 返回 PARSE_DUPLICATE_KEY
+        DUPLICATE_KEYS_FIRST,   // 只保留第一个
+        DUPLICATE_KEYS_LAST,    // 只保留最后一个的值，位置仍是第一次出现的位置
+    };
+
+    struct ParseOptions {
+        // 不为 1 时 parse(v, json, len, opt) 和 parse_file 把顶层数组交给 parse_parallel，
+        // 0 表示 hardware_concurrency。Parser 和 NDJSON 的每条记录总是单线程解析
+        unsigned threads = 1;
+        const Allocator *alloc = NULL;
+        KeyTable *keys = NULL;  // 不为空时对象的键从这里取，多线程共用时要创建 shared 的键表
+        // 严格检查字符串的编码：拒绝过长编码、孤立的后续字节、截断的序列、编码后的代理项和超过 U+10FFFF 的码点，
+        // 以及 \u 转义出的孤立低代理项，保证解析结果都是合法的 UTF-8
+        bool validate_utf8 = false;
+        // 宽松语法，用于手写的配置文件，默认都不允许：
+        bool allow_comments = false;        // 空白可以出现的地方允许 // 行注释和 /* */ 块注释
+        bool allow_trailing_commas = false; // 数组、对象的最后一个元素后面可以有逗号
+        bool allow_single_quotes = false;   // 字符串和键可以用单引号，其中的 " 不用转义，' 可以写成 \'
+        bool allow_nan_inf = false;         // 数字可以是 NaN、Infinity、-Infinity
+        // 不为 ALLOW 时每个对象解析完后用临时的哈希表查重
+        DuplicateKeys duplicate_keys = DUPLICATE_KEYS_ALLOW;
+        // 对象的成员按键的字节序稳定排序，可以用 find_sorted_object_index 二分查找，
+        // stringify 的输出也与输入的成员顺序无关
+        bool sort_members = false;
+    };
+
+    int parse(Value &v, const char *json, size_t len, const ParseOptions &opt);
+
+#ifndef PARSER_RETAIN_DEFAULT
+#define PARSER_RETAIN_DEFAULT (1 << 20)
+#endif
+
+    // 可复用的解析器：解析栈在多次 parse 之间保留，不必每个文档都从头 realloc。
+    // 每个线程各用一个 Parser 即可，Parser 之间没有共享状态。
+    struct Parser {
+        Context c;
+        size_t retain;          // 一次解析结束后栈超过这个字节数就释放
+        ParseOptions opt;
+    };
+
+    void parser_init(Parser &p, size_t retain = PARSER_RETAIN_DEFAULT);
+
+    void parser_free(Parser &p);
+
+    int parse(Parser &p, Value &v, const char *json);
+
+    int parse(Parser &p, Value &v, const char *json, size_t len);
+
+    // 拉取式读取器：按调用顺序逐个消费 JSON 记号，不构建值树。
+    // 各函数返回 PARSE_OK 或错误码，遇到与期望不符的类型返回 PARSE_TYPE_MISMATCH。
+    //
+    //     reader_begin_array(r);
+    //     while (reader_next_element(r, more) == PARSE_OK && more)
+    //         reader_number(r, d);
+    struct Reader {
+        Context c;
+        bool first;     // 刚读过 '[' 或 '{'，下一个元素前不需要逗号
+    };
+
+    void reader_init(Reader &r, const char *json, size_t len, const Allocator *alloc = NULL);
+
+    void reader_free(Reader &r);
+
+    // 查看下一个值的类型但不消费它，数字以外的非法字符也报告为 NUMBER，由 reader_number 报错
+    int reader_peek(Reader &r, Type &type);
+
+    int reader_null(Reader &r);
+
+    int reader_bool(Reader &r, bool &b);
+
+    int reader_number(Reader &r, double &d);
+
+    // s 指向读取器内部的缓冲区，下一次调用任何 reader_* 后失效
+    int reader_string(Reader &r, const char *&s, size_t &len);
+
+    // 把下一个值完整解析成值树
+    int reader_value(Reader &r, Value &v);
+
+    // 跳过下一个值，只检查语法，不建值树也不分配内存；错误码与 reader_value 相同
+    int reader_skip(Reader &r);
+
+    int reader_begin_array(Reader &r);
+
+    // more 为 false 表示已经读到 ']'
+    int reader_next_element(Reader &r, bool &more);
+
+    int reader_begin_object(Reader &r);
+
+    // more 为 true 时 k 是下一个成员的键（同 reader_string 的有效期），接着读取它的值
+    int reader_next_member(Reader &r, bool &more, const char *&k, size_t &klen);
+
+    // 确认输入只剩空白
+    int reader_end(Reader &r);
+
+    // 以 mmap 方式读取整个文件并原地解析，打开失败返回 PARSE_FILE_ERROR
+    int parse_file(Value &v, const char *path, const ParseOptions &opt = ParseOptions());
+
+    // 顶层为数组且输入足够大时，预扫描切分元素后多线程解析，结果与 parse 相同。
+    // threads 为 0 时使用 std::thread::hardware_concurrency()。
+    // 各分块在自己的线程上用 alloc 分配，alloc 会被多个线程同时调用，必须是线程安全的。
+    int parse_parallel(Value &v, const char *json, size_t len, unsigned threads = 0,
+                       const Allocator *alloc = NULL);
+
+    // 同上，线程数取 opt.threads，其余选项（键表、UTF-8 校验、宽松语法、重复键等）对每个分块都生效。
+    // 多个分块共用 opt.keys 和 opt.alloc，所以键表要是 shared 的，分配器要是线程安全的
+    int parse_parallel(Value &v, const char *json, size_t len, const ParseOptions &opt);
+
+    // NDJSON (JSON Lines)：每行一个 JSON 文本，空行被忽略。记录按换行字节切分，
+    // 允许注释时 /* */ 块注释也不能跨行。
+    // 回调返回后 v 会被释放，需要保留时可以拷走 v 再 init(v)。
+    typedef void (*ndjson_callback)(Value &v, size_t index, void *user);
+
+    struct NdjsonOptions {
+        unsigned threads = 0;   // 0 表示 std::thread::hardware_concurrency()
+        bool ordered = true;    // false 时回调在工作线程上并发调用，顺序不定
+        ParseOptions parse;     // 每条记录的解析选项，其中的 threads 不起作用，alloc 要是线程安全的
+        // 为 true 时每个工作线程把记录解析到自己的 arena 里，arena 的块向 parse.alloc 申请，
+        // 一批记录回调完后整块归还，不再逐个释放节点。此时回调不能留下 v 或其中的指针，
+        // 需要保留时用 value_copy 拷出。
+        bool arena = false;
+    };
+
+    // 返回 PARSE_OK 或最早出错记录的错误码。有序模式下出错记录之前的记录都会被回调，
+    // 无序模式下出错记录之后的记录也可能已经被回调。
+    int parse_ndjson(const char *json, size_t len, ndjson_callback cb, void *user,
+                     const NdjsonOptions &opt = NdjsonOptions());
+
+    // 以 mmap 方式读取文件，打开失败返回 PARSE_FILE_ERROR
+    int parse_ndjson(const char *path, ndjson_callback cb, void *user,
+                     const NdjsonOptions &opt = NdjsonOptions());
+
     Type get_type(const Value &v);
 
 #define set_null(v) value_free(v)
 
     int get_boolean(const Value &v);
 
-    void set_boolean(Value &v, bool flag);
+    void set_boolean(Value &v, bool flag, const Allocator *alloc = NULL);
 
     double get_number(const Value &v);
 
-    void set_number(Value &v, double nu);
+    void set_number(Value &v, double nu, const Allocator *alloc = NULL);
 
     typedef Value const value;
 
     const char *get_string(const value &v);
 
-    size_t get_string_length(Value &v);
+    // 长度直接取自 Value，O(1)，包含字符串中间的 '\0'
+    size_t get_string_length(const Value &v);
 
-    void set_string(Value &v, const char *s, size_t len);
+    std::string_view get_string_view(const Value &v);
+
+    bool string_equal(const Value &v, const char *s, size_t len);
+
+    int string_compare(const Value &a, const Value &b);
+
+    void set_string(Value &v, const char *s, size_t len, const Allocator *alloc = NULL);
 
     size_t get_array_size(const Value &v);
 
@@ -97,9 +337,235 @@ namespace tiny_json {
 
     size_t get_object_key_length(const Value &v, size_t index);
 
+    std::string_view get_object_key_view(const Value &v, size_t index);
+
     Value * get_object_value(const Value &v, size_t index);
 
-    char * stringify(const Value&v, size_t &len);
+    // 返回的缓冲区用同一个分配器释放，大小为 len + 1
+    // shared 为 true 时内部加锁，可以被多个线程的解析同时使用
+    KeyTable *key_table_create(bool shared = false, const Allocator *alloc = NULL);
+
+    void key_table_free(KeyTable *t);
+
+    // 返回键在表中的唯一拷贝，以 '\0' 结尾，在键表释放前一直有效
+    const char *key_table_intern(KeyTable *t, const char *k, size_t len);
+
+    size_t key_table_size(KeyTable *t);
+
+#define KEY_NOT_EXIST ((size_t) -1)
+
+    // 按键查找成员，找不到返回 KEY_NOT_EXIST
+    size_t find_object_index(const Value &v, const char *key, size_t klen);
+
+    // key 必须是 key_table_intern 的返回值，且 v 是用同一个键表解析的，只比较指针
+    size_t find_interned_object_index(const Value &v, const char *key);
+
+    Value *find_object_value(const Value &v, const char *key, size_t klen);
+
+    // v 的成员必须已按键排序（sort_members 解析或调用过 sort_members），二分查找，重复的键返回第一个
+    size_t find_sorted_object_index(const Value &v, const char *key, size_t klen);
+
+    // 递归地把所有对象的成员按键的字节序稳定排序，alloc 只用来申请归并的临时空间
+    void sort_members(Value &v, const Allocator *alloc = NULL);
+
+    // 按 JSON Pointer (RFC 6901) 查找，空串表示 v 本身，找不到返回 NULL
+    Value *find_pointer(const Value &v, const char *ptr, size_t len);
+
+    // 深拷贝，dst 原有的内容先被释放
+    void value_copy(Value &dst, const Value &src, const Allocator *alloc = NULL);
+
+    // 深比较，对象按键比较，与成员顺序无关
+    bool value_equal(const Value &a, const Value &b);
+
+    // 原地修改。只搬动所在的数组或成员块，兄弟的子树不会被拷贝，
+    // 但之前取得的指向这个块里元素的指针随之失效。
+    // 在 index 处插入一个 null 元素并返回它，index 可以等于元素个数
+    Value *array_insert(Value &v, size_t index, const Allocator *alloc = NULL);
+
+    void array_erase(Value &v, size_t index, const Allocator *alloc = NULL);
+
+    // 返回键对应的值，键不存在时在末尾追加一个 null 成员
+    Value *object_set(Value &v, const char *key, size_t klen, const Allocator *alloc = NULL);
+
+    // 键不存在时返回 false
+    bool object_remove(Value &v, const char *key, size_t klen, const Allocator *alloc = NULL);
+
+    // JSON Patch (RFC 6902)：原地修改 doc，开销只与补丁涉及的位置有关。
+    // 任何一个操作失败都会撤销之前的全部修改，doc 保持原样，返回 PATCH_* 错误码。
+    // move 直接搬动子树；add、replace、copy 拷贝补丁或源位置的值。
+    int apply_patch(Value &doc, const Value &patch, const Allocator *alloc = NULL);
+
+    // JSON Merge Patch (RFC 7396)，总是成功
+    void apply_merge_patch(Value &doc, const Value &patch, const Allocator *alloc = NULL);
+
+    // 生成把 a 变成 b 的 JSON Patch，patch 原有的内容先被释放。
+    // 对象按键匹配成员；数组用哈希去掉相同的头尾，中间部分按 LCS 对齐，
+    // 对不上的元素两两递归比较。相同的子树不产生任何操作。
+    void diff(Value &patch, const Value &a, const Value &b, const Allocator *alloc = NULL);
+
+    // 冻结的文档：接管一棵值树之后不再修改，可以被任意多个线程同时读取。
+    // 线程安全的约定：
+    //   - 树上的只读接口（get_*、find_*、value_equal、stringify、encode_binary 等）都可以并发调用；
+    //   - document_find 第一次在大对象上查找时建立键的哈希索引，用 CAS 发布，不加锁，
+    //     多个线程同时建立时只保留一份；
+    //   - 文档带原子引用计数，document_retain/document_release 可以在任意线程调用。
+    // 不能通过 document_root 返回的引用修改树（object_set、apply_patch 等）。
+    // 树的键如果来自键表，键表要比文档活得久。
+    struct Document;
+
+    // 接管 v 的值树，v 变为 null，引用计数为 1。alloc 必须是创建 v 时用的分配器
+    Document *document_create(Value &v, const Allocator *alloc = NULL);
+
+    // 增加一个引用并返回 doc，复制快照只需要这一步
+    Document *document_retain(Document *doc);
+
+    // 减少一个引用，最后一个引用释放整棵树和索引
+    void document_release(Document *doc);
+
+    const Value &document_root(const Document *doc);
+
+    // 在文档里的对象 object 中按键查找，语义同 find_object_value，重复的键返回第一个。
+    // 成员数不少于 DOCUMENT_INDEX_MIN_MEMBERS 的对象第一次查找时建立索引，之后为 O(1)
+    const Value *document_find(const Document *doc, const Value &object, const char *key, size_t klen);
+
+    char * stringify(const Value&v, size_t &len, const Allocator *alloc = NULL);
+
+    struct StringifyOptions {
+        const Allocator *alloc = NULL;
+        // 只输出 ASCII：非 ASCII 字符写成 \uXXXX，BMP 之外的写成代理对。
+        // 字符串不是合法的 UTF-8 时，无法解码的字节写成 \uFFFD
+        bool ascii = false;
+    };
+
+    char *stringify(const Value &v, size_t &len, const StringifyOptions &opt);
+
+    // 推送式生成器：不构建值树，按调用顺序直接写进与 stringify 相同的缓冲区，
+    // 字符串的转义、数字的格式也和 stringify 相同。逗号和冒号自动插入。
+    //
+    //     writer_start_object(w);
+    //     writer_key(w, "id", 2);
+    //     writer_number(w, 1);
+    //     writer_end_object(w);
+    //     char *json = writer_finish(w, len);
+    //
+    // 没有定义 NDEBUG 时用 assert 检查调用顺序：对象里键和值交替出现，括号配对，
+    // 根只有一个值，结束时没有未闭合的容器
+    struct Writer {
+        Context c;
+        Context levels;     // 只在检查调用顺序时使用：每层一个字节，'{' 期待键，':' 期待值，'[' 数组
+        bool first;         // 下一个键或值前面不需要逗号
+    };
+
+    void writer_init(Writer &w, const StringifyOptions &opt = StringifyOptions());
+
+    // 丢弃还没有取走的输出
+    void writer_free(Writer &w);
+
+    void writer_start_object(Writer &w);
+
+    void writer_end_object(Writer &w);
+
+    void writer_start_array(Writer &w);
+
+    void writer_end_array(Writer &w);
+
+    void writer_key(Writer &w, const char *k, size_t len);
+
+    void writer_null(Writer &w);
+
+    void writer_bool(Writer &w, bool b);
+
+    void writer_number(Writer &w, double d);
+
+    void writer_string(Writer &w, const char *s, size_t len);
+
+    // 写出整棵子树
+    void writer_value(Writer &w, const Value &v);
+
+    // 当前已经写出的内容，不以 '\0' 结尾，下一次写入后失效
+    const char *writer_data(const Writer &w, size_t &len);
+
+    // 清空输出但保留缓冲区，同一个 Writer 可以反复生成多个文档而不重新分配
+    void writer_clear(Writer &w);
+
+    // 交出缓冲区，同 stringify，以 '\0' 结尾、大小为 len + 1，用同一个分配器释放。
+    // 之后 Writer 回到刚初始化的状态
+    char *writer_finish(Writer &w, size_t &len);
+
+    // 紧凑的二进制编码，字符串带长度前缀、数字为本机 double、容器先写元素个数。
+    // 返回的缓冲区大小为 len，用同一个分配器释放。格式依赖本机字节序，只适合做内部缓存。
+    char *encode_binary(const Value &v, size_t &len, const Allocator *alloc = NULL);
+
+    // 解码 encode_binary 的输出，格式错误返回 PARSE_INVALID_BINARY
+    int decode_binary(Value &v, const char *data, size_t len, const Allocator *alloc = NULL);
+
+    // 磁带（tape）：整棵树放在一块连续内存里，子节点用下标而不是指针引用，
+    // 字符串放在末尾的字符串池中。data 可以直接 memcpy 到别处（例如共享内存）继续使用。
+    // 节点用下标表示，根节点是 0。
+    struct TapeNode {
+        Type type;
+        size_t size;            // STRING: 长度，ARRAY/OBJECT: 元素个数
+        union {
+            double num;
+            size_t offset;      // STRING: 在字符串池中的偏移
+            size_t next;        // ARRAY/OBJECT: 整棵子树之后的节点下标
+        };
+    };
+
+    struct Tape {
+        char *data;
+        size_t size;
+    };
+
+    void tape_build(Tape &t, const Value &v, const Allocator *alloc = NULL);
+
+    int parse_tape(Tape &t, const char *json, size_t len, const Allocator *alloc = NULL);
+
+    void tape_free(Tape &t, const Allocator *alloc = NULL);
+
+    // 跳过 node 的整棵子树，返回下一个兄弟节点
+    size_t tape_skip(const Tape &t, size_t node);
+
+    Type get_type(const Tape &t, size_t node);
+
+    int get_boolean(const Tape &t, size_t node);
+
+    double get_number(const Tape &t, size_t node);
+
+    const char *get_string(const Tape &t, size_t node);
+
+    size_t get_string_length(const Tape &t, size_t node);
+
+    size_t get_array_size(const Tape &t, size_t node);
+
+    // 需要逐个跳过前面的兄弟，顺序遍历时用 tape_skip 更快
+    size_t get_array_element(const Tape &t, size_t node, size_t index);
+
+    size_t get_object_size(const Tape &t, size_t node);
+
+    const char *get_object_key(const Tape &t, size_t node, size_t index);
+
+    size_t get_object_key_length(const Tape &t, size_t node, size_t index);
+
+    size_t get_object_value(const Tape &t, size_t node, size_t index);
+
+    // JSON Schema 的一个子集，先编译成扁平的节点数组再执行。支持的关键字：
+    // type（含 integer）、enum、const、minimum、maximum、exclusiveMinimum、exclusiveMaximum、
+    // minLength、maxLength（按码点计）、minItems、maxItems、items（单个模式）、
+    // properties、required、additionalProperties。其他关键字被忽略。
+    struct Schema;
+
+    // 失败时 s 为 NULL，返回 SCHEMA_INVALID。编译结果不引用 doc，doc 可以随即释放。
+    int schema_compile(Schema *&s, const Value &doc, const Allocator *alloc = NULL);
+
+    void schema_free(Schema *s);
+
+    // 返回 PARSE_OK 或第一个不满足的约束对应的 SCHEMA_* 错误码
+    int schema_validate(const Schema *s, const Value &v);
+
+    // 边读边校验，不构建值树，遇到第一个不满足的约束就返回，不再读后面的输入。
+    // 文本本身有语法错误时返回 PARSE_* 错误码。
+    int schema_validate(const Schema *s, const char *json, size_t len);
 
 }
 
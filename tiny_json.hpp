@@ -0,0 +1,290 @@
+//
+// tiny_json.h 之上的 C++17 封装，只有头文件。
+// Json 持有一棵值树并负责释放；JsonView 是不持有所有权的只读视图；
+// SharedJson 引用冻结文档里的子树，可以在线程之间拷贝共享。
+// 迭代器只包装 Value / member 指针，内联后就是原始的指针遍历。
+//
+
+#ifndef CPPTINYJSON_TINY_JSON_HPP
+#define CPPTINYJSON_TINY_JSON_HPP
+
+#include <cassert>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "tiny_json.h"
+
+namespace tiny_json {
+
+    class JsonView;
+
+    struct MemberView;
+
+    template<typename Node, typename Item>
+    class NodeIterator {
+    public:
+        explicit NodeIterator(Node *p) : p_(p) {}
+
+        Item operator*() const { return Item(p_); }
+
+        NodeIterator &operator++() {
+            ++p_;
+            return *this;
+        }
+
+        bool operator==(const NodeIterator &o) const { return p_ == o.p_; }
+
+        bool operator!=(const NodeIterator &o) const { return p_ != o.p_; }
+
+    private:
+        Node *p_;
+    };
+
+    template<typename Node, typename Item>
+    class NodeRange {
+    public:
+        NodeRange(Node *begin, size_t size) : begin_(begin), end_(begin + size) {}
+
+        NodeIterator<Node, Item> begin() const { return NodeIterator<Node, Item>(begin_); }
+
+        NodeIterator<Node, Item> end() const { return NodeIterator<Node, Item>(end_); }
+
+        size_t size() const { return end_ - begin_; }
+
+    private:
+        Node *begin_, *end_;
+    };
+
+    class JsonView {
+    public:
+        JsonView() : v_(nullptr) {}
+
+        JsonView(const Value *v) : v_(v) {}
+
+        // 查找失败得到的视图为空，可以先判断再取值
+        explicit operator bool() const { return v_ != nullptr; }
+
+        const Value *get() const { return v_; }
+
+        Type type() const { return v_->type; }
+
+        bool is_null() const { return v_->type == NUL; }
+
+        bool is_bool() const { return v_->type == TRUE || v_->type == FALSE; }
+
+        bool is_number() const { return v_->type == NUMBER; }
+
+        bool is_string() const { return v_->type == STRING; }
+
+        bool is_array() const { return v_->type == ARRAY; }
+
+        bool is_object() const { return v_->type == OBJECT; }
+
+        bool boolean() const {
+            assert(is_bool());
+            return v_->type == TRUE;
+        }
+
+        double number() const { return get_number(*v_); }
+
+        std::string_view str() const { return get_string_view(*v_); }
+
+        // 数组或对象的元素个数
+        size_t size() const {
+            assert(is_array() || is_object());
+            return v_->type == ARRAY ? v_->a_size : v_->m_size;
+        }
+
+        JsonView operator[](size_t index) const {
+            assert(is_array() && index < v_->a_size);
+            return JsonView(&v_->arr[index]);
+        }
+
+        JsonView operator[](std::string_view key) const {
+            return JsonView(find_object_value(*v_, key.data(), key.size()));
+        }
+
+        NodeRange<const Value, JsonView> elements() const {
+            assert(is_array());
+            return NodeRange<const Value, JsonView>(v_->arr, v_->a_size);
+        }
+
+        inline NodeRange<const member, MemberView> members() const;
+
+        std::string dump() const {
+            size_t len;
+            char *s = stringify(*v_, len);
+            std::string ret(s, len);
+            free(s);
+            return ret;
+        }
+
+    private:
+        const Value *v_;
+    };
+
+    struct MemberView {
+        explicit MemberView(const member *m) : key(m->k, m->k_len), value(&m->v) {}
+
+        std::string_view key;
+        JsonView value;
+    };
+
+    inline NodeRange<const member, MemberView> JsonView::members() const {
+        assert(is_object());
+        return NodeRange<const member, MemberView>(v_->m, v_->m_size);
+    }
+
+    // 持有一棵值树，只能移动不能拷贝，析构时用构造时的分配器释放
+    class Json {
+    public:
+        explicit Json(const Allocator *alloc = nullptr) : alloc_(alloc) { v_.type = NUL; }
+
+        explicit Json(bool flag) : alloc_(nullptr) { v_.type = flag ? TRUE : FALSE; }
+
+        explicit Json(double num) : alloc_(nullptr) {
+            v_.type = NUMBER;
+            v_.num = num;
+        }
+
+        explicit Json(std::string_view s, const Allocator *alloc = nullptr) : alloc_(alloc) {
+            v_.type = NUL;
+            set_string(v_, s.data(), s.size(), alloc_);
+        }
+
+        // 否则字符串字面量会优先转换成 bool
+        explicit Json(const char *s, const Allocator *alloc = nullptr) : Json(std::string_view(s), alloc) {}
+
+        Json(Json &&o) noexcept : v_(o.v_), alloc_(o.alloc_) { o.v_.type = NUL; }
+
+        Json &operator=(Json &&o) noexcept {
+            if (this != &o) {
+                value_free(v_, alloc_);
+                v_ = o.v_;
+                alloc_ = o.alloc_;
+                o.v_.type = NUL;
+            }
+            return *this;
+        }
+
+        Json(const Json &) = delete;
+
+        Json &operator=(const Json &) = delete;
+
+        ~Json() { value_free(v_, alloc_); }
+
+        // 解析失败时内容为 null，返回 parse 的错误码
+        int parse(std::string_view json, ParseOptions opt = ParseOptions()) {
+            value_free(v_, alloc_);
+            opt.alloc = alloc_;
+            return tiny_json::parse(v_, json.data(), json.size(), opt);
+        }
+
+        // 接管一棵已有的值树，src 被置为 null
+        static Json adopt(Value &src, const Allocator *alloc = nullptr) {
+            Json j(alloc);
+            j.v_ = src;
+            src.type = NUL;
+            return j;
+        }
+
+        // 交出值树的所有权，自身变为 null
+        Value release() {
+            Value v = v_;
+            v_.type = NUL;
+            return v;
+        }
+
+        JsonView view() const { return JsonView(&v_); }
+
+        operator JsonView() const { return view(); }
+
+        const Value &value() const { return v_; }
+
+        const Allocator *allocator() const { return alloc_; }
+
+        Type type() const { return v_.type; }
+
+        size_t size() const { return view().size(); }
+
+        JsonView operator[](size_t index) const { return view()[index]; }
+
+        JsonView operator[](std::string_view key) const { return view()[key]; }
+
+        NodeRange<const Value, JsonView> elements() const { return view().elements(); }
+
+        NodeRange<const member, MemberView> members() const { return view().members(); }
+
+        std::string dump() const { return view().dump(); }
+
+    private:
+        Value v_;
+        const Allocator *alloc_;
+    };
+
+    // 冻结文档（见 document_create）里某棵子树的共享引用。拷贝只增加文档的引用计数，
+    // 最后一个引用析构时释放整个文档。各个线程持有自己的拷贝即可并发读取。
+    class SharedJson {
+    public:
+        SharedJson() : doc_(nullptr), v_(nullptr) {}
+
+        // 接管 json 的值树，json 变为 null
+        explicit SharedJson(Json &&json) : v_(nullptr) {
+            const Allocator *alloc = json.allocator();
+            Value v = json.release();
+            doc_ = document_create(v, alloc);
+            v_ = &document_root(doc_);
+        }
+
+        SharedJson(const SharedJson &o) : doc_(o.doc_ ? document_retain(o.doc_) : nullptr), v_(o.v_) {}
+
+        SharedJson(SharedJson &&o) noexcept : doc_(o.doc_), v_(o.v_) {
+            o.doc_ = nullptr;
+            o.v_ = nullptr;
+        }
+
+        SharedJson &operator=(SharedJson o) noexcept {
+            std::swap(doc_, o.doc_);
+            std::swap(v_, o.v_);
+            return *this;
+        }
+
+        ~SharedJson() { document_release(doc_); }
+
+        // 查找失败得到的引用为空，不持有文档
+        explicit operator bool() const { return v_ != nullptr; }
+
+        JsonView view() const { return JsonView(v_); }
+
+        operator JsonView() const { return view(); }
+
+        Type type() const { return v_->type; }
+
+        size_t size() const { return view().size(); }
+
+        SharedJson operator[](size_t index) const {
+            assert(v_->type == ARRAY && index < v_->a_size);
+            return SharedJson(doc_, &v_->arr[index]);
+        }
+
+        // 大对象第一次查找后走哈希索引
+        SharedJson operator[](std::string_view key) const {
+            assert(v_->type == OBJECT);
+            return SharedJson(doc_, document_find(doc_, *v_, key.data(), key.size()));
+        }
+
+        std::string dump() const { return view().dump(); }
+
+    private:
+        SharedJson(Document *doc, const Value *v)
+                : doc_(v ? document_retain(doc) : nullptr), v_(v) {}
+
+        Document *doc_;
+        const Value *v_;
+    };
+
+}
+
+#endif //CPPTINYJSON_TINY_JSON_HPP
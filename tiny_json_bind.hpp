@@ -0,0 +1,247 @@
+//
+// 编译期字段绑定：声明一次字段映射，直接在 Reader 上把 JSON 读进结构体，不构建值树；
+// 反方向由同一份映射通过 Writer 写出，同样不构建值树。
+//
+//     struct Point { double x, y; std::string name; std::vector<int> ids; };
+//     TINY_JSON_BIND(Point, x, y, name, ids)
+//
+//     Point p;
+//     int ret = tiny_json::from_json(p, text);
+//     std::string out = tiny_json::to_json(p);
+//
+// 支持 bool、算术类型、std::string、std::vector、std::optional 以及其他绑定过的结构体。
+// 输入中未绑定的键被跳过，缺少的字段保持原值。整数字段只接受范围内的整数，否则返回 PARSE_TYPE_MISMATCH。
+//
+
+#ifndef CPPTINYJSON_TINY_JSON_BIND_HPP
+#define CPPTINYJSON_TINY_JSON_BIND_HPP
+
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "tiny_json.h"
+
+namespace tiny_json {
+
+    template<typename C, typename F>
+    struct Field {
+        std::string_view name;
+        F C::*ptr;
+    };
+
+    template<typename C, typename F>
+    constexpr Field<C, F> field(std::string_view name, F C::*ptr) {
+        return Field<C, F>{name, ptr};
+    }
+
+#define TINY_JSON_EXPAND(x) x
+#define TINY_JSON_FE_1(M, T, a) M(T, a)
+#define TINY_JSON_FE_2(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_1(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_3(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_2(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_4(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_3(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_5(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_4(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_6(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_5(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_7(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_6(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_8(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_7(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_9(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_8(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_10(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_9(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_11(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_10(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_12(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_11(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_13(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_12(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_14(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_13(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_15(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_14(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_16(M, T, a, ...) M(T, a), TINY_JSON_EXPAND(TINY_JSON_FE_15(M, T, __VA_ARGS__))
+#define TINY_JSON_FE_PICK(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, NAME, ...) NAME
+#define TINY_JSON_FOR_EACH(M, T, ...) \
+    TINY_JSON_EXPAND(TINY_JSON_FE_PICK(__VA_ARGS__, TINY_JSON_FE_16, TINY_JSON_FE_15, TINY_JSON_FE_14, \
+        TINY_JSON_FE_13, TINY_JSON_FE_12, TINY_JSON_FE_11, TINY_JSON_FE_10, TINY_JSON_FE_9, TINY_JSON_FE_8, \
+        TINY_JSON_FE_7, TINY_JSON_FE_6, TINY_JSON_FE_5, TINY_JSON_FE_4, TINY_JSON_FE_3, TINY_JSON_FE_2, \
+        TINY_JSON_FE_1)(M, T, __VA_ARGS__))
+
+#define TINY_JSON_FIELD(T, f) ::tiny_json::field(#f, &T::f)
+
+    // 在结构体所在的命名空间里展开，通过 ADL 找到；最多 16 个字段
+#define TINY_JSON_BIND(T, ...) \
+    inline constexpr auto tiny_json_fields(const T *) { \
+        return std::make_tuple(TINY_JSON_FOR_EACH(TINY_JSON_FIELD, T, __VA_ARGS__)); \
+    }
+
+    template<typename T, typename = void>
+    struct is_bound : std::false_type {
+    };
+
+    template<typename T>
+    struct is_bound<T, std::void_t<decltype(tiny_json_fields((const T *) nullptr))>> : std::true_type {
+    };
+
+    // 未特化的类型不能绑定，会在编译期报错
+    template<typename T, typename = void>
+    struct Binder;
+
+    template<>
+    struct Binder<bool> {
+        static int read(Reader &r, bool &out) {
+            return reader_bool(r, out);
+        }
+
+        static void write(Writer &w, bool v) {
+            writer_bool(w, v);
+        }
+    };
+
+    template<typename T>
+    struct Binder<T, std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>>> {
+        // 整数类型要求 d 是范围内的整数，float 要求不超出范围，否则转换是未定义行为；
+        // 这些情况都当作类型不符
+        static bool fits(double d) {
+            if constexpr (std::is_integral_v<T>) {
+                // 2^digits 是 T 最大值加 1，可以用 double 精确表示
+                double limit = std::ldexp(1.0, std::numeric_limits<T>::digits);
+                return std::isfinite(d) && std::trunc(d) == d && d < limit &&
+                       (std::is_signed_v<T> ? d >= -limit : d >= 0);
+            } else if constexpr (sizeof(T) < sizeof(double)) {
+                return !std::isfinite(d) || std::fabs(d) <= std::numeric_limits<T>::max();
+            } else {
+                return true;
+            }
+        }
+
+        static int read(Reader &r, T &out) {
+            double d;
+            int ret = reader_number(r, d);
+            if (ret != PARSE_OK) return ret;
+            if (!fits(d)) return PARSE_TYPE_MISMATCH;
+            out = static_cast<T>(d);
+            return PARSE_OK;
+        }
+
+        static void write(Writer &w, T v) {
+            writer_number(w, (double) v);
+        }
+    };
+
+    template<>
+    struct Binder<std::string> {
+        static int read(Reader &r, std::string &out) {
+            const char *s;
+            size_t len;
+            int ret = reader_string(r, s, len);
+            if (ret == PARSE_OK) out.assign(s, len);
+            return ret;
+        }
+
+        static void write(Writer &w, const std::string &v) {
+            writer_string(w, v.data(), v.size());
+        }
+    };
+
+    template<typename T>
+    struct Binder<std::vector<T>> {
+        static int read(Reader &r, std::vector<T> &out) {
+            int ret = reader_begin_array(r);
+            bool more;
+            out.clear();
+            while (ret == PARSE_OK && (ret = reader_next_element(r, more)) == PARSE_OK && more) {
+                out.emplace_back();
+                ret = Binder<T>::read(r, out.back());
+            }
+            return ret;
+        }
+
+        static void write(Writer &w, const std::vector<T> &v) {
+            writer_start_array(w);
+            for (const T &e: v)
+                Binder<T>::write(w, e);
+            writer_end_array(w);
+        }
+    };
+
+    template<typename T>
+    struct Binder<std::optional<T>> {
+        static int read(Reader &r, std::optional<T> &out) {
+            Type type;
+            int ret = reader_peek(r, type);
+            if (ret != PARSE_OK) return ret;
+            if (type == NUL) {
+                out.reset();
+                return reader_null(r);
+            }
+            return Binder<T>::read(r, out.emplace());
+        }
+
+        static void write(Writer &w, const std::optional<T> &v) {
+            if (v) Binder<T>::write(w, *v);
+            else writer_null(w);
+        }
+    };
+
+    template<typename T>
+    struct Binder<T, std::enable_if_t<is_bound<T>::value>> {
+        static int read(Reader &r, T &out) {
+            constexpr auto fields = tiny_json_fields((const T *) nullptr);
+            int ret = reader_begin_object(r);
+            bool more;
+            const char *k;
+            size_t klen;
+            while (ret == PARSE_OK && (ret = reader_next_member(r, more, k, klen)) == PARSE_OK && more) {
+                // 读取字段值会让 k 失效，所以一旦匹配就不再比较后面的字段
+                std::string_view key(k, klen);
+                bool found = false;
+                std::apply([&](const auto &... f) {
+                    ((!found && f.name == key
+                      ? (found = true, ret = Binder<std::decay_t<decltype(out.*(f.ptr))>>::read(r, out.*(f.ptr)))
+                      : 0), ...);
+                }, fields);
+                if (!found) ret = reader_skip(r);
+            }
+            return ret;
+        }
+
+        static void write(Writer &w, const T &v) {
+            constexpr auto fields = tiny_json_fields((const T *) nullptr);
+            writer_start_object(w);
+            std::apply([&](const auto &... f) {
+                ((writer_key(w, f.name.data(), f.name.size()),
+                  Binder<std::decay_t<decltype(v.*(f.ptr))>>::write(w, v.*(f.ptr))), ...);
+            }, fields);
+            writer_end_object(w);
+        }
+    };
+
+    template<typename T>
+    int from_json(T &out, std::string_view json, const Allocator *alloc = nullptr) {
+        Reader r;
+        reader_init(r, json.data(), json.size(), alloc);
+        int ret = Binder<T>::read(r, out);
+        if (ret == PARSE_OK) ret = reader_end(r);
+        reader_free(r);
+        return ret;
+    }
+
+    // 写进已有的 Writer，可以嵌在手写的输出中间
+    template<typename T>
+    void to_json(Writer &w, const T &v) {
+        Binder<T>::write(w, v);
+    }
+
+    template<typename T>
+    std::string to_json(const T &v, const StringifyOptions &opt = StringifyOptions()) {
+        Writer w;
+        writer_init(w, opt);
+        Binder<T>::write(w, v);
+        size_t len;
+        const char *s = writer_data(w, len);
+        std::string out(s, len);
+        writer_free(w);
+        return out;
+    }
+
+}
+
+#endif //CPPTINYJSON_TINY_JSON_BIND_HPP